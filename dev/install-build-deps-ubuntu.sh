@@ -11,6 +11,7 @@ if [ ! -d /opt/intel/oneapi ]; then
                           intel-oneapi-tbb-common-devel-2021.13 intel-oneapi-tbb-devel-2022.2 \
                           intel-oneapi-mpi-devel-2021.16 \
                           intel-oneapi-dal-common-devel-2025.6 intel-oneapi-dal-devel-2025.6 \
+                          intel-oneapi-mkl-devel-2025.3 \
                           intel-oneapi-compiler-dpcpp-cpp-2025.3 intel-oneapi-compiler-dpcpp-cpp-common-2025.3 intel-oneapi-compiler-dpcpp-cpp-runtime-2025.3 intel-oneapi-dpcpp-cpp-2025.3
 else
   echo "oneAPI components already installed!"
@@ -34,6 +34,11 @@ if [[ -z $CCL_ROOT ]]; then
  exit 1
 fi
 
+if [[ -z $MKLROOT ]]; then
+ echo MKLROOT not defined!
+ exit 1
+fi
+
 MVN_NO_TRANSFER_PROGRESS=
 
 print_usage() {
@@ -104,6 +109,7 @@ elif [[ -n $DALROOT ]]; then
 fi
 echo TBBROOT=$TBBROOT
 echo CCL_ROOT=$CCL_ROOT
+echo MKLROOT=$MKLROOT
 echo =============================
 echo
 
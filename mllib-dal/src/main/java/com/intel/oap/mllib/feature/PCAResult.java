@@ -19,6 +19,8 @@ package com.intel.oap.mllib.feature;
 public class PCAResult {
   private long pcNumericTable;
   private long explainedVarianceNumericTable;
+  private double totalVariance;
+  private long covarianceStateNumericTable;
 
   public long getExplainedVarianceNumericTable() {
     return explainedVarianceNumericTable;
@@ -28,6 +30,22 @@ public class PCAResult {
     this.explainedVarianceNumericTable = explainedVarianceNumericTable;
   }
 
+  public double getTotalVariance() {
+    return totalVariance;
+  }
+
+  public void setTotalVariance(double totalVariance) {
+    this.totalVariance = totalVariance;
+  }
+
+  public long getCovarianceStateNumericTable() {
+    return covarianceStateNumericTable;
+  }
+
+  public void setCovarianceStateNumericTable(long covarianceStateNumericTable) {
+    this.covarianceStateNumericTable = covarianceStateNumericTable;
+  }
+
   public long getPcNumericTable() {
     return pcNumericTable;
   }
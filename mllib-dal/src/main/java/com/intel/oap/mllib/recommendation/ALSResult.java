@@ -22,6 +22,7 @@ public class ALSResult {
   private long cItemsFactorsNumTab;
   private long cUserOffset;
   private long cItemOffset;
+  private double[] lossHistory;
 
   public long getRankId() {
     return rankId;
@@ -62,4 +63,12 @@ public class ALSResult {
   public void setcItemOffset(long cItemOffset) {
     this.cItemOffset = cItemOffset;
   }
+
+  public double[] getLossHistory() {
+    return lossHistory;
+  }
+
+  public void setLossHistory(double[] lossHistory) {
+    this.lossHistory = lossHistory;
+  }
 }
@@ -16,8 +16,12 @@
 
 #include <assert.h>
 #include <chrono>
+#include <cmath>
 #include <iostream>
 
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
 #include "OneCCL.h"
 #include "com_intel_oap_mllib_recommendation_ALSDALImpl.h"
 #include "service.h"
@@ -31,127 +35,116 @@ using namespace daal;
 using namespace daal::algorithms;
 using namespace daal::algorithms::implicit_als;
 
-NumericTablePtr userOffset;
-NumericTablePtr itemOffset;
-
-CSRNumericTablePtr dataTable;
-CSRNumericTablePtr transposedDataTable;
-
-KeyValueDataCollectionPtr userStep3LocalInput;
-KeyValueDataCollectionPtr itemStep3LocalInput;
-
-training::DistributedPartialResultStep4Ptr itemsPartialResultLocal;
-training::DistributedPartialResultStep4Ptr usersPartialResultLocal;
-std::vector<training::DistributedPartialResultStep4Ptr>
-    itemsPartialResultsMaster;
-std::vector<training::DistributedPartialResultStep4Ptr>
-    usersPartialResultsMaster;
-
-template <typename T>
-void gather(size_t rankId, ccl::communicator &comm, size_t nBlocks,
-            const ByteBuffer &nodeResults, T *result) {
-    vector<size_t> perNodeArchLengthMaster(nBlocks);
-    size_t perNodeArchLength = nodeResults.size();
-    ByteBuffer serializedData;
-
-    vector<size_t> recv_counts(nBlocks);
+/*
+ * State of one ALS training job. Each call of cDALImplictALS works on its own
+ * context, so a fit does not see the tables of an earlier fit. Fits still
+ * share the global oneCCL communicator and oneDAL thread setting, so they must
+ * not run in the same executor at once.
+ */
+struct ALSContext {
+    NumericTablePtr userOffset;
+    NumericTablePtr itemOffset;
+
+    CSRNumericTablePtr dataTable;
+    CSRNumericTablePtr transposedDataTable;
+
+    KeyValueDataCollectionPtr userStep3LocalInput;
+    KeyValueDataCollectionPtr itemStep3LocalInput;
+
+    training::DistributedPartialResultStep4Ptr itemsPartialResultLocal;
+    training::DistributedPartialResultStep4Ptr usersPartialResultLocal;
+
+    // Boundaries of the user blocks, equal blocks if empty
+    PartitionBoundaries usersPartition;
+};
+
+/*
+ * Exchange of serialized blocks between all ranks in flight. Block i goes to
+ * rank i, rank r sends to r + d and receives from r - d in the exchange of
+ * distance d, so a received block can be used while the others are still on
+ * the way.
+ */
+struct All2AllExchange {
+    const ByteBuffer *nodeResults;
+    size_t rankId;
+    std::vector<size_t> sources;
+    std::vector<ByteBuffer> recvData;
+    std::vector<ccl::event> events;
+};
+
+void startAll2All(ccl::communicator &comm, const ByteBuffer *nodeResults,
+                  size_t nBlocks, All2AllExchange &exchange) {
+    const size_t rankId = comm.rank();
+    vector<size_t> perNodeArchLengths(nBlocks);
+    vector<size_t> perNodeArchLengthsRecv(nBlocks);
     for (size_t i = 0; i < nBlocks; i++)
-        recv_counts[i] = sizeof(size_t);
+        perNodeArchLengths[i] = nodeResults[i].size();
 
-    ccl::allgatherv(&perNodeArchLength, sizeof(size_t),
-                    perNodeArchLengthMaster.data(), recv_counts,
-                    ccl::datatype::uint8, comm)
+    ccl::alltoall(perNodeArchLengths.data(), perNodeArchLengthsRecv.data(),
+                  sizeof(size_t), ccl::datatype::uint8, comm)
         .wait();
 
-    // should resize for all ranks for ccl_allgatherv
-    size_t memoryBuf = 0;
-    for (size_t i = 0; i < nBlocks; i++) {
-        memoryBuf += perNodeArchLengthMaster[i];
-    }
-    serializedData.resize(memoryBuf);
-
-    std::vector<int> displs(nBlocks);
-    if (rankId == ccl_root) {
-        size_t shift = 0;
-        for (size_t i = 0; i < nBlocks; i++) {
-            displs[i] = shift;
-            shift += perNodeArchLengthMaster[i];
-        }
+    exchange.nodeResults = nodeResults;
+    exchange.rankId = rankId;
+    exchange.sources.clear();
+    exchange.recvData.assign(nBlocks, ByteBuffer());
+    exchange.events.clear();
+
+    vector<size_t> sendCounts(nBlocks), recvCounts(nBlocks);
+    for (size_t distance = 1; distance < nBlocks; distance++) {
+        const size_t dest = (rankId + distance) % nBlocks;
+        const size_t source = (rankId + nBlocks - distance) % nBlocks;
+        std::fill(sendCounts.begin(), sendCounts.end(), 0);
+        std::fill(recvCounts.begin(), recvCounts.end(), 0);
+        sendCounts[dest] = perNodeArchLengths[dest];
+        recvCounts[source] = perNodeArchLengthsRecv[source];
+        exchange.recvData[source].resize(recvCounts[source]);
+        exchange.sources.push_back(source);
+        exchange.events.push_back(ccl::alltoallv(
+            nodeResults[dest].data(), sendCounts,
+            exchange.recvData[source].data(), recvCounts,
+            ccl::datatype::uint8, comm));
     }
+}
 
-    /* Transfer partial results to step 2 on the root node */
-    ccl::allgatherv(&nodeResults[0], perNodeArchLength, &serializedData[0],
-                    perNodeArchLengthMaster, ccl::datatype::uint8, comm)
-        .wait();
-
-    if (rankId == ccl_root) {
-        for (size_t i = 0; i < nBlocks; i++) {
-            /* Deserialize partial results from step 1 */
-            result[i] = result[i]->cast(deserializeDAALObject(
-                &serializedData[0] + displs[i], perNodeArchLengthMaster[i]));
-        }
+// Wait for the blocks in the order they were sent and deserialize each one
+// while the later ones are still on the way
+template <typename T>
+void finishAll2All(All2AllExchange &exchange,
+                   KeyValueDataCollectionPtr result) {
+    const ByteBuffer &own = exchange.nodeResults[exchange.rankId];
+    (*result)[exchange.rankId] = T::cast(
+        deserializeDAALObject((byte *)own.data(), own.size()));
+
+    for (size_t i = 0; i < exchange.events.size(); i++) {
+        exchange.events[i].wait();
+        const size_t source = exchange.sources[i];
+        ByteBuffer &data = exchange.recvData[source];
+        (*result)[source] =
+            T::cast(deserializeDAALObject(&data[0], data.size()));
+        ByteBuffer().swap(data);
     }
 }
 
 template <typename T>
 void all2all(ccl::communicator &comm, ByteBuffer *nodeResults, size_t nBlocks,
              KeyValueDataCollectionPtr result) {
-    size_t memoryBuf = 0;
-    size_t shift = 0;
-    vector<size_t> perNodeArchLengths(nBlocks);
-    vector<size_t> perNodeArchLengthsRecv(nBlocks);
-    std::vector<size_t> sdispls(nBlocks);
-    ByteBuffer serializedSendData;
-    ByteBuffer serializedRecvData;
-
-    for (size_t i = 0; i < nBlocks; i++) {
-        perNodeArchLengths[i] = nodeResults[i].size();
-        memoryBuf += perNodeArchLengths[i];
-        sdispls[i] = shift;
-        shift += perNodeArchLengths[i];
-    }
-    serializedSendData.resize(memoryBuf);
-
-    /* memcpy to avoid double compute */
-    memoryBuf = 0;
-    for (size_t i = 0; i < nBlocks; i++) {
-        for (size_t j = 0; j < perNodeArchLengths[i]; j++)
-            serializedSendData[memoryBuf + j] = nodeResults[i][j];
-        memoryBuf += perNodeArchLengths[i];
-    }
-
-    ccl::alltoall(perNodeArchLengths.data(), perNodeArchLengthsRecv.data(),
-                  sizeof(size_t), ccl::datatype::uint8, comm)
-        .wait();
-
-    memoryBuf = 0;
-    shift = 0;
-    std::vector<size_t> rdispls(nBlocks);
-    for (size_t i = 0; i < nBlocks; i++) {
-        memoryBuf += perNodeArchLengthsRecv[i];
-        rdispls[i] = shift;
-        shift += perNodeArchLengthsRecv[i];
-    }
-
-    serializedRecvData.resize(memoryBuf);
-
-    /* Transfer partial results to step 2 on the root node */
-    ccl::alltoallv(&serializedSendData[0], perNodeArchLengths,
-                   &serializedRecvData[0], perNodeArchLengthsRecv,
-                   ccl::datatype::uint8, comm)
-        .wait();
-
-    for (size_t i = 0; i < nBlocks; i++) {
-        (*result)[i] = T::cast(deserializeDAALObject(
-            &serializedRecvData[rdispls[i]], perNodeArchLengthsRecv[i]));
-    }
+    All2AllExchange exchange;
+    startAll2All(comm, nodeResults, nBlocks, exchange);
+    finishAll2All<T>(exchange, result);
 }
 
-KeyValueDataCollectionPtr initializeStep1Local(size_t rankId,
+KeyValueDataCollectionPtr initializeStep1Local(ALSContext &context,
+                                               size_t rankId,
                                                size_t partitionId,
                                                size_t nBlocks, size_t nUsers,
-                                               size_t nFactors) {
-    int usersPartition[1] = {(int)nBlocks};
+                                               size_t nFactors, size_t seed) {
+    // Either the number of equal user blocks or the first user of each block
+    // followed by the number of users
+    std::vector<int> usersPartition(1, (int)nBlocks);
+    if (!context.usersPartition.empty())
+        usersPartition.assign(context.usersPartition.begin(),
+                              context.usersPartition.end());
 
     /* Create an algorithm object to initialize the implicit ALS model with the
      * default method */
@@ -160,34 +153,37 @@ KeyValueDataCollectionPtr initializeStep1Local(size_t rankId,
         initAlgorithm;
     initAlgorithm.parameter.fullNUsers = nUsers;
     initAlgorithm.parameter.nFactors = nFactors;
-    initAlgorithm.parameter.seed += rankId;
+    // Each rank draws the factors of its own items
+    initAlgorithm.parameter.seed = seed + rankId;
     initAlgorithm.parameter.partition.reset(
-        new HomogenNumericTable<int>((int *)usersPartition, 1, 1));
+        new HomogenNumericTable<int>(usersPartition.data(), 1,
+                                     usersPartition.size()));
     /* Pass a training data set and dependent values to the algorithm */
-    initAlgorithm.input.set(training::init::data, dataTable);
+    initAlgorithm.input.set(training::init::data, context.dataTable);
 
     /* Initialize the implicit ALS model */
     initAlgorithm.compute();
 
     training::init::PartialResultPtr partialResult =
         initAlgorithm.getPartialResult();
-    itemStep3LocalInput =
+    context.itemStep3LocalInput =
         partialResult->get(training::init::outputOfInitForComputeStep3);
-    userOffset = partialResult->get(training::init::offsets, (size_t)rankId);
+    context.userOffset =
+        partialResult->get(training::init::offsets, (size_t)rankId);
 
     PartialModelPtr partialModelLocal =
         partialResult->get(training::init::partialModel);
 
-    itemsPartialResultLocal.reset(
+    context.itemsPartialResultLocal.reset(
         new training::DistributedPartialResultStep4());
-    itemsPartialResultLocal->set(training::outputOfStep4ForStep1,
-                                 partialModelLocal);
+    context.itemsPartialResultLocal->set(training::outputOfStep4ForStep1,
+                                         partialModelLocal);
 
     return partialResult->get(training::init::outputOfStep1ForStep2);
 }
 
 void initializeStep2Local(
-    size_t rankId, size_t partitionId,
+    ALSContext &context, size_t rankId, size_t partitionId,
     const KeyValueDataCollectionPtr &initStep2LocalInput) {
     /* Create an algorithm object to perform the second step of the implicit ALS
      * initialization algorithm */
@@ -203,21 +199,25 @@ void initializeStep2Local(
 
     training::init::DistributedPartialResultStep2Ptr partialResult =
         initAlgorithm.getPartialResult();
-    transposedDataTable = CSRNumericTable::cast(
+    context.transposedDataTable = CSRNumericTable::cast(
         partialResult->get(training::init::transposedData));
-    userStep3LocalInput =
+    context.userStep3LocalInput =
         partialResult->get(training::init::outputOfInitForComputeStep3);
-    itemOffset = partialResult->get(training::init::offsets, (size_t)rankId);
+    context.itemOffset =
+        partialResult->get(training::init::offsets, (size_t)rankId);
 }
 
-void initializeModel(size_t rankId, ccl::communicator &comm, size_t partitionId,
-                     size_t nBlocks, size_t nUsers, size_t nFactors) {
+void initializeModel(ALSContext &context, size_t rankId,
+                     ccl::communicator &comm, size_t partitionId,
+                     size_t nBlocks, size_t nUsers, size_t nFactors,
+                     size_t seed) {
     logger::println(logger::INFO, "ALS (native): initializeModel");
 
     auto t1 = std::chrono::high_resolution_clock::now();
 
     KeyValueDataCollectionPtr initStep1LocalResult =
-        initializeStep1Local(rankId, partitionId, nBlocks, nUsers, nFactors);
+        initializeStep1Local(context, rankId, partitionId, nBlocks, nUsers,
+                             nFactors, seed);
 
     ByteBuffer nodeCPs[nBlocks];
     for (size_t i = 0; i < nBlocks; i++) {
@@ -226,7 +226,7 @@ void initializeModel(size_t rankId, ccl::communicator &comm, size_t partitionId,
     KeyValueDataCollectionPtr initStep2LocalInput(new KeyValueDataCollection());
     all2all<NumericTable>(comm, nodeCPs, nBlocks, initStep2LocalInput);
 
-    initializeStep2Local(rankId, partitionId, initStep2LocalInput);
+    initializeStep2Local(context, rankId, partitionId, initStep2LocalInput);
 
     auto t2 = std::chrono::high_resolution_clock::now();
     auto duration =
@@ -255,28 +255,6 @@ training::DistributedPartialResultStep1Ptr computeStep1Local(
     return algorithm.getPartialResult();
 }
 
-NumericTablePtr computeStep2Master(
-    const training::DistributedPartialResultStep1Ptr *step1LocalResultsOnMaster,
-    size_t nFactors, size_t nBlocks) {
-    /* Create algorithm objects to compute implicit ALS algorithm in the
-     * distributed processing mode on the master node using the default method
-     */
-    training::Distributed<step2Master> algorithm;
-    algorithm.parameter.nFactors = nFactors;
-
-    /* Set input objects for the algorithm */
-    for (size_t i = 0; i < nBlocks; i++) {
-        algorithm.input.add(training::inputOfStep2FromStep1,
-                            step1LocalResultsOnMaster[i]);
-    }
-
-    /* Compute a partial estimate on the master node from the partial estimates
-     * on local nodes */
-    algorithm.compute();
-
-    return algorithm.getPartialResult()->get(training::outputOfStep2ForStep4);
-}
-
 KeyValueDataCollectionPtr computeStep3Local(
     const NumericTablePtr &offset,
     const training::DistributedPartialResultStep4Ptr &partialResultLocal,
@@ -297,7 +275,7 @@ KeyValueDataCollectionPtr computeStep3Local(
 
 training::DistributedPartialResultStep4Ptr
 computeStep4Local(const CSRNumericTablePtr &dataTable,
-                  const NumericTablePtr &step2MasterResult,
+                  const NumericTablePtr &crossProduct,
                   const KeyValueDataCollectionPtr &step4LocalInput,
                   size_t nFactors) {
     training::Distributed<step4Local> algorithm;
@@ -305,30 +283,254 @@ computeStep4Local(const CSRNumericTablePtr &dataTable,
 
     algorithm.input.set(training::partialModels, step4LocalInput);
     algorithm.input.set(training::partialData, dataTable);
-    algorithm.input.set(training::inputOfStep4FromStep2, step2MasterResult);
+    algorithm.input.set(training::inputOfStep4FromStep2, crossProduct);
 
     algorithm.compute();
 
     return algorithm.getPartialResult();
 }
 
-void trainModel(size_t rankId, ccl::communicator &comm, size_t partitionId,
-                size_t nBlocks, size_t nFactors, size_t maxIterations) {
+/*
+ * Cross product of the partial factors on all ranks. Step 2 only sums the
+ * nFactors x nFactors cross products of step 1, so they are allreduced as
+ * raw values instead.
+ */
+NumericTablePtr computeCrossProduct(
+    ccl::communicator &comm,
+    const training::DistributedPartialResultStep4Ptr &partialResultLocal,
+    size_t nFactors) {
+    training::DistributedPartialResultStep1Ptr step1LocalResult =
+        computeStep1Local(partialResultLocal, nFactors);
+    NumericTablePtr localCrossProduct =
+        step1LocalResult->get(training::outputOfStep1ForStep2);
+
+    NumericTablePtr crossProduct = HomogenNumericTable<float>::create(
+        nFactors, nFactors, NumericTable::doAllocate);
+    BlockDescriptor<float> localBlock;
+    BlockDescriptor<float> block;
+    localCrossProduct->getBlockOfRows(0, nFactors, readOnly, localBlock);
+    crossProduct->getBlockOfRows(0, nFactors, writeOnly, block);
+
+    ccl::allreduce(localBlock.getBlockPtr(), block.getBlockPtr(),
+                   nFactors * nFactors, ccl::reduction::sum, comm)
+        .wait();
+
+    localCrossProduct->releaseBlockOfRows(localBlock);
+    crossProduct->releaseBlockOfRows(block);
+
+    return crossProduct;
+}
+
+/*
+ * Gather the factors received from step 3 into columnFactors, columnRows maps
+ * the global column index to the row of its factors or -1 if none was
+ * received.
+ */
+static void getColumnFactors(const KeyValueDataCollectionPtr &step4LocalInput,
+                             size_t nBlocks, size_t nColumns, size_t nFactors,
+                             std::vector<float> &columnFactors,
+                             std::vector<long> &columnRows) {
+    columnFactors.clear();
+    columnRows.assign(nColumns, -1);
+    for (size_t b = 0; b < nBlocks; b++) {
+        PartialModelPtr model = PartialModel::cast((*step4LocalInput)[b]);
+        NumericTablePtr factors = model->getFactors();
+        NumericTablePtr indices = model->getIndices();
+        const size_t n = factors ? factors->getNumberOfRows() : 0;
+        if (n == 0)
+            continue;
+        BlockDescriptor<float> factorsBlock;
+        BlockDescriptor<int> indicesBlock;
+        factors->getBlockOfRows(0, n, readOnly, factorsBlock);
+        indices->getBlockOfRows(0, n, readOnly, indicesBlock);
+        const float *factorsPtr = factorsBlock.getBlockPtr();
+        const int *indicesPtr = indicesBlock.getBlockPtr();
+        const size_t first = columnFactors.size() / nFactors;
+        columnFactors.insert(columnFactors.end(), factorsPtr,
+                             factorsPtr + n * nFactors);
+        for (size_t i = 0; i < n; i++)
+            if (indicesPtr[i] >= 0 && (size_t)indicesPtr[i] < nColumns)
+                columnRows[indicesPtr[i]] = first + i;
+        factors->releaseBlockOfRows(factorsBlock);
+        indices->releaseBlockOfRows(indicesBlock);
+    }
+}
+
+/*
+ * Sum of n * |x|^2 over the rows of dataTable with n ratings and factors x,
+ * the regularization of one side.
+ */
+static double
+computeRegularization(const CSRNumericTablePtr &dataTable,
+                      const training::DistributedPartialResultStep4Ptr &result,
+                      size_t nFactors) {
+    const size_t nRows = dataTable->getNumberOfRows();
+    if (nRows == 0)
+        return 0.0;
+
+    float *values = nullptr;
+    size_t *colIndices = nullptr;
+    size_t *rowOffsets = nullptr;
+    dataTable->getArrays<float>(&values, &colIndices, &rowOffsets);
+
+    NumericTablePtr factors =
+        result->get(training::outputOfStep4ForStep1)->getFactors();
+    BlockDescriptor<float> factorsBlock;
+    factors->getBlockOfRows(0, nRows, readOnly, factorsBlock);
+    const float *x = factorsBlock.getBlockPtr();
+
+    double sum = 0.0;
+    for (size_t row = 0; row < nRows; row++) {
+        double norm = 0.0;
+        for (size_t i = 0; i < nFactors; i++)
+            norm += (double)x[row * nFactors + i] * x[row * nFactors + i];
+        sum += norm * (rowOffsets[row + 1] - rowOffsets[row]);
+    }
+
+    factors->releaseBlockOfRows(factorsBlock);
+    return sum;
+}
+
+/*
+ * Training loss after an iteration. The rows of dataTable are the local items
+ * and step4LocalInput holds the factors of the users they are rated by. For
+ * implicit feedback it is the objective of oneDAL step 4
+ *   sum of c * (p - x^T y)^2 over all pairs of users x and items y
+ *   + lambda * (sum of n * |x|^2 + sum of n * |y|^2)
+ * with c = 1 + alpha * r and p = 1 if r > preferenceThreshold for the rated
+ * pairs, c = 1 and p = 0 for the others, and n the number of ratings. The sum
+ * over all pairs is y^T (X^T X) y with the cross product of the user factors
+ * plus a correction for the rated pairs. For explicit feedback it is the RMSE
+ * of the ratings.
+ */
+static double computeLoss(ALSContext &context, ccl::communicator &comm,
+                          const KeyValueDataCollectionPtr &step4LocalInput,
+                          const NumericTablePtr &crossProduct, size_t nBlocks,
+                          size_t nFactors, bool implicitPrefs) {
+    const CSRNumericTablePtr &dataTable = context.dataTable;
+    const size_t nRows = dataTable->getNumberOfRows();
+    const size_t nColumns = dataTable->getNumberOfColumns();
+
+    // Parameters oneDAL step 4 trains with
+    const implicit_als::Parameter parameter;
+
+    std::vector<float> columnFactors;
+    std::vector<long> columnRows;
+    getColumnFactors(step4LocalInput, nBlocks, nColumns, nFactors,
+                     columnFactors, columnRows);
+
+    float *values = nullptr;
+    size_t *colIndices = nullptr;
+    size_t *rowOffsets = nullptr;
+    dataTable->getArrays<float>(&values, &colIndices, &rowOffsets);
+
+    NumericTablePtr rowFactors =
+        context.itemsPartialResultLocal->get(training::outputOfStep4ForStep1)
+            ->getFactors();
+    BlockDescriptor<float> rowFactorsBlock;
+    rowFactors->getBlockOfRows(0, nRows, readOnly, rowFactorsBlock);
+    const float *y = rowFactorsBlock.getBlockPtr();
+
+    BlockDescriptor<float> crossProductBlock;
+    const float *gram = nullptr;
+    if (implicitPrefs) {
+        crossProduct->getBlockOfRows(0, nFactors, readOnly, crossProductBlock);
+        gram = crossProductBlock.getBlockPtr();
+    }
+
+    std::vector<double> rowLoss(nRows);
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, nRows),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t row = range.begin(); row != range.end(); row++) {
+                const float *rowY = y + row * nFactors;
+                double loss = 0.0;
+                if (implicitPrefs) {
+                    for (size_t i = 0; i < nFactors; i++) {
+                        double gy = 0.0;
+                        for (size_t j = 0; j < nFactors; j++)
+                            gy += (double)gram[i * nFactors + j] * rowY[j];
+                        loss += gy * rowY[i];
+                    }
+                }
+                // CSR offsets and column indices are one-based
+                for (size_t pos = rowOffsets[row] - 1;
+                     pos < rowOffsets[row + 1] - 1; pos++) {
+                    long columnRow = columnRows[colIndices[pos] - 1];
+                    if (columnRow < 0)
+                        continue;
+                    const float *x = &columnFactors[columnRow * nFactors];
+                    double score = 0.0;
+                    for (size_t i = 0; i < nFactors; i++)
+                        score += (double)x[i] * rowY[i];
+                    const double rating = values[pos];
+                    if (implicitPrefs) {
+                        const double c = 1.0 + parameter.alpha * rating;
+                        const double p =
+                            rating > parameter.preferenceThreshold ? 1.0 : 0.0;
+                        loss += c * (p - score) * (p - score) - score * score;
+                    } else {
+                        loss += (rating - score) * (rating - score);
+                    }
+                }
+                rowLoss[row] = loss;
+            }
+        });
+
+    rowFactors->releaseBlockOfRows(rowFactorsBlock);
+    if (implicitPrefs)
+        crossProduct->releaseBlockOfRows(crossProductBlock);
+
+    // Loss and number of ratings over all ranks
+    double sums[2] = {0.0, (double)dataTable->getDataSize()};
+    for (size_t row = 0; row < nRows; row++)
+        sums[0] += rowLoss[row];
+    if (implicitPrefs) {
+        sums[0] += parameter.lambda *
+                   (computeRegularization(dataTable,
+                                          context.itemsPartialResultLocal,
+                                          nFactors) +
+                    computeRegularization(context.transposedDataTable,
+                                          context.usersPartialResultLocal,
+                                          nFactors));
+    }
+    ccl::allreduce(sums, sums, 2, ccl::reduction::sum, comm).wait();
+
+    if (implicitPrefs)
+        return sums[0];
+    return sums[1] > 0 ? std::sqrt(sums[0] / sums[1]) : 0.0;
+}
+
+// Relative change of the loss of the last iteration within tolerance, a
+// tolerance of 0 runs all iterations
+static bool hasConverged(const std::vector<double> &losses, double tolerance) {
+    if (tolerance <= 0 || losses.size() < 2)
+        return false;
+    const double previous = losses[losses.size() - 2];
+    return std::abs(previous - losses.back()) <= tolerance * std::abs(previous);
+}
+
+/*
+ * Step 3 does not depend on the cross product, so its blocks are sent first
+ * and the cross product is computed and allreduced while they are on the way.
+ * Blocks are deserialized as they arrive, oneDAL step 4 then needs all of
+ * them.
+ */
+std::vector<double> trainModel(ALSContext &context, size_t rankId,
+                               ccl::communicator &comm, size_t partitionId,
+                               size_t nBlocks, size_t nFactors,
+                               size_t maxIterations, double tolerance) {
     logger::println(logger::INFO, "ALS (native): trainModel");
 
     auto tStart = std::chrono::high_resolution_clock::now();
 
-    training::DistributedPartialResultStep1Ptr
-        step1LocalResultsOnMaster[nBlocks];
-    training::DistributedPartialResultStep1Ptr step1LocalResult;
-    NumericTablePtr step2MasterResult;
+    NumericTablePtr crossProduct;
     KeyValueDataCollectionPtr step3LocalResult;
     KeyValueDataCollectionPtr step4LocalInput(new KeyValueDataCollection());
 
     ByteBuffer nodeCPs[nBlocks];
-    ByteBuffer nodeResults;
-    ByteBuffer crossProductBuf;
-    int crossProductLen;
+    All2AllExchange exchange;
+    std::vector<double> losses;
 
     for (size_t iteration = 0; iteration < maxIterations; iteration++) {
         auto t1 = std::chrono::high_resolution_clock::now();
@@ -336,138 +538,337 @@ void trainModel(size_t rankId, ccl::communicator &comm, size_t partitionId,
         //
         // Update partial users factors
         //
-        step1LocalResult = computeStep1Local(itemsPartialResultLocal, nFactors);
-
-        serializeDAALObject(step1LocalResult.get(), nodeResults);
-
-        // Gathering step1LocalResult on the master
-        gather(rankId, comm, nBlocks, nodeResults, step1LocalResultsOnMaster);
+        step3LocalResult = computeStep3Local(
+            context.itemOffset, context.itemsPartialResultLocal,
+            context.itemStep3LocalInput, nFactors);
 
-        if (rankId == ccl_root) {
-            step2MasterResult = computeStep2Master(step1LocalResultsOnMaster,
-                                                   nFactors, nBlocks);
-            serializeDAALObject(step2MasterResult.get(), crossProductBuf);
-            crossProductLen = crossProductBuf.size();
+        for (size_t i = 0; i < nBlocks; i++) {
+            serializeDAALObject((*step3LocalResult)[i].get(), nodeCPs[i]);
         }
+        startAll2All(comm, nodeCPs, nBlocks, exchange);
 
-        ccl::broadcast(&crossProductLen, sizeof(int), ccl::datatype::uint8,
-                       ccl_root, comm)
-            .wait();
+        crossProduct = computeCrossProduct(
+            comm, context.itemsPartialResultLocal, nFactors);
 
-        if (rankId != ccl_root) {
-            crossProductBuf.resize(crossProductLen);
-        }
+        finishAll2All<PartialModel>(exchange, step4LocalInput);
 
-        ccl::broadcast(&crossProductBuf[0], crossProductLen,
-                       ccl::datatype::uint8, ccl_root, comm)
-            .wait();
-
-        step2MasterResult = NumericTable::cast(
-            deserializeDAALObject(&crossProductBuf[0], crossProductLen));
+        context.usersPartialResultLocal =
+            computeStep4Local(context.transposedDataTable, crossProduct,
+                              step4LocalInput, nFactors);
 
+        //
+        // Update partial items factors
+        //
         step3LocalResult = computeStep3Local(
-            itemOffset, itemsPartialResultLocal, itemStep3LocalInput, nFactors);
+            context.userOffset, context.usersPartialResultLocal,
+            context.userStep3LocalInput, nFactors);
 
         for (size_t i = 0; i < nBlocks; i++) {
             serializeDAALObject((*step3LocalResult)[i].get(), nodeCPs[i]);
         }
-        all2all<PartialModel>(comm, nodeCPs, nBlocks, step4LocalInput);
+        startAll2All(comm, nodeCPs, nBlocks, exchange);
 
-        usersPartialResultLocal = computeStep4Local(
-            transposedDataTable, step2MasterResult, step4LocalInput, nFactors);
+        crossProduct = computeCrossProduct(
+            comm, context.usersPartialResultLocal, nFactors);
 
-        //
-        // Update partial items factors
-        //
-        step1LocalResult = computeStep1Local(usersPartialResultLocal, nFactors);
+        finishAll2All<PartialModel>(exchange, step4LocalInput);
 
-        serializeDAALObject(step1LocalResult.get(), nodeResults);
+        context.itemsPartialResultLocal = computeStep4Local(
+            context.dataTable, crossProduct, step4LocalInput, nFactors);
 
-        // Gathering step1LocalResult on the master
-        gather(rankId, comm, nBlocks, nodeResults, step1LocalResultsOnMaster);
+        losses.push_back(computeLoss(context, comm, step4LocalInput,
+                                     crossProduct, nBlocks, nFactors, true));
 
-        if (rankId == ccl_root) {
-            step2MasterResult = computeStep2Master(step1LocalResultsOnMaster,
-                                                   nFactors, nBlocks);
-            serializeDAALObject(step2MasterResult.get(), crossProductBuf);
-            crossProductLen = crossProductBuf.size();
-        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration =
+            std::chrono::duration_cast<std::chrono::seconds>(t2 - t1).count();
+        logger::println(logger::INFO,
+                        "ALS (native): iteration %d took %d secs, loss %f",
+                        iteration, duration, losses.back());
+
+        if (hasConverged(losses, tolerance))
+            break;
+    }
 
-        ccl::broadcast(&crossProductLen, sizeof(int), ccl::datatype::uint8,
-                       ccl_root, comm)
-            .wait();
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    auto durationTotal =
+        std::chrono::duration_cast<std::chrono::seconds>(tEnd - tStart).count();
+    logger::println(logger::INFO, "ALS (native): trainModel took %d secs",
+                    durationTotal);
 
-        if (rankId != ccl_root) {
-            crossProductBuf.resize(crossProductLen);
+    return losses;
+}
+
+static size_t getOffsetFromOffsetTable(NumericTablePtr offsetTable) {
+    size_t ret;
+    BlockDescriptor<int> block;
+    offsetTable->getBlockOfRows(0, 1, readOnly, block);
+    ret = (size_t)((block.getBlockPtr())[0]);
+    offsetTable->releaseBlockOfRows(block);
+
+    return ret;
+}
+
+/*
+ * Solve (A + lambda * I) x = b by Cholesky decomposition, A is symmetric
+ * positive semi-definite and only its lower triangle is used. A is overwritten
+ * by the factor. Returns false if the matrix is not positive definite.
+ */
+static bool solveNormalEquation(std::vector<double> &a, std::vector<double> &b,
+                                size_t n, double lambda, float *x) {
+    for (size_t j = 0; j < n; j++) {
+        double diagonal = a[j * n + j] + lambda;
+        for (size_t p = 0; p < j; p++)
+            diagonal -= a[j * n + p] * a[j * n + p];
+        if (diagonal <= 0.0)
+            return false;
+        a[j * n + j] = std::sqrt(diagonal);
+        for (size_t i = j + 1; i < n; i++) {
+            double value = a[i * n + j];
+            for (size_t p = 0; p < j; p++)
+                value -= a[i * n + p] * a[j * n + p];
+            a[i * n + j] = value / a[j * n + j];
         }
+    }
+    // L y = b, then L^T x = y
+    for (size_t i = 0; i < n; i++) {
+        for (size_t p = 0; p < i; p++)
+            b[i] -= a[i * n + p] * b[p];
+        b[i] /= a[i * n + i];
+    }
+    for (size_t i = n; i-- > 0;) {
+        for (size_t p = i + 1; p < n; p++)
+            b[i] -= a[p * n + i] * b[p];
+        b[i] /= a[i * n + i];
+    }
+    for (size_t i = 0; i < n; i++)
+        x[i] = (float)b[i];
+    return true;
+}
+
+/*
+ * Step 4 for explicit feedback. Factors of the rows of dataTable are solved
+ * from the factors of the rated columns received from step 3, with the
+ * weighted-lambda regularization of Spark: a row with n ratings r solves
+ * (Y^T Y + lambda * n * I) x = Y^T r over the factors Y of its columns. Rows
+ * without ratings get zero factors.
+ */
+training::DistributedPartialResultStep4Ptr
+computeStep4LocalExplicit(const CSRNumericTablePtr &dataTable,
+                          const KeyValueDataCollectionPtr &step4LocalInput,
+                          size_t nBlocks, size_t offset, size_t nFactors,
+                          double regParam) {
+    const size_t nRows = dataTable->getNumberOfRows();
+    const size_t nColumns = dataTable->getNumberOfColumns();
+
+    std::vector<float> columnFactors;
+    std::vector<long> columnRows;
+    getColumnFactors(step4LocalInput, nBlocks, nColumns, nFactors,
+                     columnFactors, columnRows);
+
+    float *values = nullptr;
+    size_t *colIndices = nullptr;
+    size_t *rowOffsets = nullptr;
+    dataTable->getArrays<float>(&values, &colIndices, &rowOffsets);
+
+    NumericTablePtr rowFactors = HomogenNumericTable<float>::create(
+        nFactors, nRows, NumericTable::doAllocate);
+    NumericTablePtr rowIndices = HomogenNumericTable<int>::create(
+        1, nRows, NumericTable::doAllocate);
+    BlockDescriptor<float> rowFactorsBlock;
+    BlockDescriptor<int> rowIndicesBlock;
+    rowFactors->getBlockOfRows(0, nRows, writeOnly, rowFactorsBlock);
+    rowIndices->getBlockOfRows(0, nRows, writeOnly, rowIndicesBlock);
+    float *x = rowFactorsBlock.getBlockPtr();
+    int *rowIndicesPtr = rowIndicesBlock.getBlockPtr();
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, nRows),
+        [&](const tbb::blocked_range<size_t> &range) {
+            std::vector<double> ata(nFactors * nFactors);
+            std::vector<double> atb(nFactors);
+            for (size_t row = range.begin(); row != range.end(); row++) {
+                rowIndicesPtr[row] = offset + row;
+                std::fill(ata.begin(), ata.end(), 0.0);
+                std::fill(atb.begin(), atb.end(), 0.0);
+                size_t nRatings = 0;
+                // CSR offsets and column indices are one-based
+                for (size_t pos = rowOffsets[row] - 1;
+                     pos < rowOffsets[row + 1] - 1; pos++) {
+                    long columnRow = columnRows[colIndices[pos] - 1];
+                    if (columnRow < 0)
+                        continue;
+                    const float *y = &columnFactors[columnRow * nFactors];
+                    const double rating = values[pos];
+                    for (size_t i = 0; i < nFactors; i++) {
+                        atb[i] += rating * y[i];
+                        for (size_t j = 0; j <= i; j++)
+                            ata[i * nFactors + j] += (double)y[i] * y[j];
+                    }
+                    nRatings++;
+                }
+                float *rowX = x + row * nFactors;
+                if (nRatings == 0 ||
+                    !solveNormalEquation(ata, atb, nFactors,
+                                         regParam * nRatings, rowX))
+                    std::fill(rowX, rowX + nFactors, 0.0f);
+            }
+        });
+
+    rowFactors->releaseBlockOfRows(rowFactorsBlock);
+    rowIndices->releaseBlockOfRows(rowIndicesBlock);
+
+    training::DistributedPartialResultStep4Ptr result(
+        new training::DistributedPartialResultStep4());
+    result->set(training::outputOfStep4ForStep1,
+                PartialModel::create(rowFactors, rowIndices));
+    return result;
+}
+
+/*
+ * Explicit feedback ALS, the factors of both sides are initialized and
+ * exchanged the same way as implicit ALS, but as the normal equations of
+ * explicit feedback involve the rated columns only, the Gram matrix of step 1
+ * and step 2 is not needed.
+ */
+std::vector<double>
+trainModelExplicit(ALSContext &context, size_t rankId, ccl::communicator &comm,
+                   size_t partitionId, size_t nBlocks, size_t nFactors,
+                   size_t maxIterations, double regParam, double tolerance) {
+    logger::println(logger::INFO, "ALS (native): trainModelExplicit");
+
+    auto tStart = std::chrono::high_resolution_clock::now();
+
+    KeyValueDataCollectionPtr step3LocalResult;
+    KeyValueDataCollectionPtr step4LocalInput(new KeyValueDataCollection());
+    ByteBuffer nodeCPs[nBlocks];
+    std::vector<double> losses;
+
+    const size_t userOffsetValue = getOffsetFromOffsetTable(context.userOffset);
+    const size_t itemOffsetValue = getOffsetFromOffsetTable(context.itemOffset);
+
+    for (size_t iteration = 0; iteration < maxIterations; iteration++) {
+        auto t1 = std::chrono::high_resolution_clock::now();
 
-        ccl::broadcast(&crossProductBuf[0], crossProductLen,
-                       ccl::datatype::uint8, ccl_root, comm)
-            .wait();
+        //
+        // Update partial users factors
+        //
+        step3LocalResult = computeStep3Local(
+            context.itemOffset, context.itemsPartialResultLocal,
+            context.itemStep3LocalInput, nFactors);
+
+        for (size_t i = 0; i < nBlocks; i++) {
+            serializeDAALObject((*step3LocalResult)[i].get(), nodeCPs[i]);
+        }
+        all2all<PartialModel>(comm, nodeCPs, nBlocks, step4LocalInput);
 
-        step2MasterResult = NumericTable::cast(
-            deserializeDAALObject(&crossProductBuf[0], crossProductLen));
+        context.usersPartialResultLocal = computeStep4LocalExplicit(
+            context.transposedDataTable, step4LocalInput, nBlocks,
+            userOffsetValue, nFactors, regParam);
 
+        //
+        // Update partial items factors
+        //
         step3LocalResult = computeStep3Local(
-            userOffset, usersPartialResultLocal, userStep3LocalInput, nFactors);
+            context.userOffset, context.usersPartialResultLocal,
+            context.userStep3LocalInput, nFactors);
 
-        // all2all to populate step4LocalInput
         for (size_t i = 0; i < nBlocks; i++) {
             serializeDAALObject((*step3LocalResult)[i].get(), nodeCPs[i]);
         }
         all2all<PartialModel>(comm, nodeCPs, nBlocks, step4LocalInput);
 
-        itemsPartialResultLocal = computeStep4Local(
-            dataTable, step2MasterResult, step4LocalInput, nFactors);
+        context.itemsPartialResultLocal = computeStep4LocalExplicit(
+            context.dataTable, step4LocalInput, nBlocks, itemOffsetValue,
+            nFactors, regParam);
+
+        losses.push_back(computeLoss(context, comm, step4LocalInput,
+                                     NumericTablePtr(), nBlocks, nFactors,
+                                     false));
 
         auto t2 = std::chrono::high_resolution_clock::now();
         auto duration =
             std::chrono::duration_cast<std::chrono::seconds>(t2 - t1).count();
-        logger::println(logger::INFO, "ALS (native): iteration %d took %f secs",
-                        iteration, duration);
+        logger::println(logger::INFO,
+                        "ALS (native): iteration %d took %d secs, RMSE %f",
+                        iteration, duration, losses.back());
+
+        if (hasConverged(losses, tolerance))
+            break;
     }
 
     auto tEnd = std::chrono::high_resolution_clock::now();
     auto durationTotal =
         std::chrono::duration_cast<std::chrono::seconds>(tEnd - tStart).count();
-    logger::println(logger::INFO, "ALS (native): trainModel took %d secs",
+    logger::println(logger::INFO,
+                    "ALS (native): trainModelExplicit took %d secs",
                     durationTotal);
-}
 
-static size_t getOffsetFromOffsetTable(NumericTablePtr offsetTable) {
-    size_t ret;
-    BlockDescriptor<int> block;
-    offsetTable->getBlockOfRows(0, 1, readOnly, block);
-    ret = (size_t)((block.getBlockPtr())[0]);
-    offsetTable->releaseBlockOfRows(block);
-
-    return ret;
+    return losses;
 }
 
-JNIEXPORT jobject JNICALL
+/*
+ * Class:     com_intel_oap_mllib_recommendation_ALSDALImpl
+ * Method:    cShuffleData
+ * Signature: (JLjava/nio/ByteBuffer;IIIZJILcom/intel/oap/mllib/recommendation/ALSPartitionInfo;)J
+ */
+JNIEXPORT jlong JNICALL
 Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cShuffleData(
-    JNIEnv *env, jobject obj, jobject dataBuffer, jint nTotalKeys, jint nBlocks,
-    jobject infoObj) {
+    JNIEnv *env, jobject obj, jlong contextHandle, jobject dataBuffer,
+    jint nTotalKeys, jint nColumns, jint nBlocks, jboolean balanced,
+    jlong maxRoundBytes, jint ratingEncoding, jobject infoObj) {
     logger::println(logger::INFO, "RATING_SIZE: %d", RATING_SIZE);
 
     ccl::communicator &comm = getComm();
+    size_t rankId = comm.rank();
+    ALSContext &context = *((ALSContext *)contextHandle);
 
     jbyte *ratingsBuf = (jbyte *)env->GetDirectBufferAddress(dataBuffer);
 
     jlong ratingsNum = env->GetDirectBufferCapacity(dataBuffer) / RATING_SIZE;
 
-    std::vector<RatingPartition> ratingPartitions(nBlocks);
-
-    for (int i = 0; i < ratingsNum; i++) {
-        Rating *rating = (Rating *)(ratingsBuf + RATING_SIZE * i);
-        int partition = getPartiton(rating->user, nTotalKeys, nBlocks);
-        ratingPartitions[partition].push_back(*rating);
+    // Keys of the ratings are the rows of the table, items are the columns
+    // which are split into the user blocks of training
+    PartitionBoundaries rowBoundaries;
+    if (balanced) {
+        getBalancedBoundaries(comm, (Rating *)ratingsBuf, ratingsNum,
+                              nTotalKeys, nColumns, nBlocks, rowBoundaries,
+                              context.usersPartition);
+    } else {
+        rowBoundaries = getRangeBoundaries(nTotalKeys, nBlocks);
+        context.usersPartition.clear();
     }
 
-    size_t newRatingsNum = 0;
-    size_t newCsrRowNum = 0;
-    Rating *ratings = shuffle_all2all(comm, ratingPartitions, nBlocks,
-                                      newRatingsNum, newCsrRowNum);
+    // Ratings are grouped in the input buffer, so they are not copied before
+    // being sent
+    std::vector<size_t> partitionOffsets =
+        groupByPartition((Rating *)ratingsBuf, ratingsNum, rowBoundaries);
+
+    // A negative encoding is chosen here, values are not sent if all are 1
+    RatingEncoding encoding = (RatingEncoding)ratingEncoding;
+    if (ratingEncoding < 0)
+        encoding = allRatingsAreOne(comm, (Rating *)ratingsBuf, ratingsNum)
+                       ? RatingEncoding::One
+                       : RatingEncoding::Float32;
+    logger::println(logger::INFO, "ALS (native): %zu bytes per shuffled rating",
+                    CompactRatings::recordSize(encoding));
+
+    CompactRatings ratings(encoding);
+    shuffle_all2all(comm, (Rating *)ratingsBuf, partitionOffsets, nBlocks,
+                    maxRoundBytes, ratings);
+
+    // Rows of the table are all the keys of the partition of this rank
+    auto t1 = std::chrono::high_resolution_clock::now();
+    jlong rowOffset = rowBoundaries[rankId];
+    size_t nRows = rowBoundaries[rankId + 1] - rowBoundaries[rankId];
+    CSRNumericTablePtr table =
+        ratingsToCSRTable(ratings, rowOffset, nRows, nColumns);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    float duration = std::chrono::duration<float>(t2 - t1).count();
+    logger::println(logger::INFO,
+                    "ALS (native): CSR table of %zu ratings and %zu rows "
+                    "took %f secs",
+                    ratings.size(), nRows, duration);
 
     // Get the class of the input object
     jclass clazz = env->GetObjectClass(infoObj);
@@ -475,32 +876,67 @@ Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cShuffleData(
     jfieldID ratingsNumField = env->GetFieldID(clazz, "ratingsNum", "I");
     jfieldID csrRowNumField = env->GetFieldID(clazz, "csrRowNum", "I");
 
-    env->SetIntField(infoObj, ratingsNumField, newRatingsNum);
-    env->SetIntField(infoObj, csrRowNumField, newCsrRowNum);
+    env->SetIntField(infoObj, ratingsNumField, ratings.size());
+    env->SetIntField(infoObj, csrRowNumField, nRows);
+
+    CSRNumericTablePtr *ret = new CSRNumericTablePtr(table);
+    return (jlong)ret;
+}
+
+/*
+ * Class:     com_intel_oap_mllib_recommendation_ALSDALImpl
+ * Method:    cCreateContext
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL
+Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cCreateContext(JNIEnv *env,
+                                                                  jobject obj) {
+    return (jlong) new ALSContext();
+}
 
-    return env->NewDirectByteBuffer(ratings, newRatingsNum * RATING_SIZE);
+/*
+ * Class:     com_intel_oap_mllib_recommendation_ALSDALImpl
+ * Method:    cReleaseContext
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL
+Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cReleaseContext(
+    JNIEnv *env, jobject obj, jlong contextHandle) {
+    delete (ALSContext *)contextHandle;
 }
 
+/*
+ * Class:     com_intel_oap_mllib_recommendation_ALSDALImpl
+ * Method:    cDALImplictALS
+ * Signature: (JJJIIDDDJZIIILcom/intel/oap/mllib/recommendation/ALSResult;)J
+ */
 JNIEXPORT jlong JNICALL
 Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cDALImplictALS(
-    JNIEnv *env, jobject obj, jlong numTableAddr, jlong nUsers, jint nFactors,
-    jint maxIter, jdouble regParam, jdouble alpha, jint executor_num,
-    jint executor_cores, jint partitionId, jobject resultObj) {
+    JNIEnv *env, jobject obj, jlong contextHandle, jlong numTableAddr,
+    jlong nUsers, jint nFactors, jint maxIter, jdouble tolerance,
+    jdouble regParam, jdouble alpha, jlong seed, jboolean implicitPrefs,
+    jint executor_num, jint executor_cores, jint partitionId,
+    jobject resultObj) {
 
     ccl::communicator &comm = getComm();
     size_t rankId = comm.rank();
 
-    dataTable = *((CSRNumericTablePtr *)numTableAddr);
+    ALSContext &context = *((ALSContext *)contextHandle);
+    // The table returned by cShuffleData is owned by the context from now on
+    CSRNumericTablePtr *shuffledTable = (CSRNumericTablePtr *)numTableAddr;
+    context.dataTable = *shuffledTable;
+    delete shuffledTable;
 
     logger::println(logger::INFO, "ALS (native): Input info:");
     logger::println(logger::INFO, "- NumberOfRows: %d",
-                    dataTable->getNumberOfRows());
+                    context.dataTable->getNumberOfRows());
     logger::println(logger::INFO, "- NumberOfColumns: %d",
-                    dataTable->getNumberOfColumns());
+                    context.dataTable->getNumberOfColumns());
     logger::println(logger::INFO, "- NumberOfRatings: %d",
-                    dataTable->getDataSize());
+                    context.dataTable->getDataSize());
     logger::println(logger::INFO, "- fullNUsers: %d", nUsers);
     logger::println(logger::INFO, "- nFactors: %d", nFactors);
+    logger::println(logger::INFO, "- implicitPrefs: %d", implicitPrefs);
 
     // Set number of threads for OneDAL to use for each rank
     services::Environment::getInstance()->setNumberOfThreads(executor_cores);
@@ -511,13 +947,23 @@ Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cDALImplictALS(
                     nThreadsNew);
 
     int nBlocks = executor_num;
-    initializeModel(rankId, comm, partitionId, nBlocks, nUsers, nFactors);
-    trainModel(rankId, comm, partitionId, executor_num, nFactors, maxIter);
-
-    auto pUser = usersPartialResultLocal->get(training::outputOfStep4ForStep1)
-                     ->getFactors();
-    auto pItem = itemsPartialResultLocal->get(training::outputOfStep4ForStep1)
-                     ->getFactors();
+    initializeModel(context, rankId, comm, partitionId, nBlocks, nUsers,
+                    nFactors, seed);
+    std::vector<double> losses;
+    if (implicitPrefs)
+        losses = trainModel(context, rankId, comm, partitionId, executor_num,
+                            nFactors, maxIter, tolerance);
+    else
+        losses = trainModelExplicit(context, rankId, comm, partitionId,
+                                    executor_num, nFactors, maxIter, regParam,
+                                    tolerance);
+
+    auto pUser =
+        context.usersPartialResultLocal->get(training::outputOfStep4ForStep1)
+            ->getFactors();
+    auto pItem =
+        context.itemsPartialResultLocal->get(training::outputOfStep4ForStep1)
+            ->getFactors();
 
     logger::println(logger::INFO, "");
     logger::println(logger::INFO, "=== Results for Rank %d ===", rankId);
@@ -527,9 +973,9 @@ Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cDALImplictALS(
     printNumericTable(pItem, "Item Factors (first 10 rows x 20 columns):", 10,
                       20);
     logger::println(logger::INFO, "User Offset: %d",
-                    getOffsetFromOffsetTable(userOffset));
+                    getOffsetFromOffsetTable(context.userOffset));
     logger::println(logger::INFO, "Item Offset: %d",
-                    getOffsetFromOffsetTable(itemOffset));
+                    getOffsetFromOffsetTable(context.itemOffset));
     logger::println(logger::INFO, "");
 
     // Get the class of the input object
@@ -555,12 +1001,18 @@ Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cDALImplictALS(
     jfieldID cUserOffsetField = env->GetFieldID(clazz, "cUserOffset", "J");
     assert(cUserOffsetField != NULL);
     env->SetLongField(resultObj, cUserOffsetField,
-                      (jlong)getOffsetFromOffsetTable(userOffset));
+                      (jlong)getOffsetFromOffsetTable(context.userOffset));
 
     jfieldID cItemOffsetField = env->GetFieldID(clazz, "cItemOffset", "J");
     assert(cItemOffsetField != NULL);
     env->SetLongField(resultObj, cItemOffsetField,
-                      (jlong)getOffsetFromOffsetTable(itemOffset));
+                      (jlong)getOffsetFromOffsetTable(context.itemOffset));
+
+    // Fill in the loss of each iteration
+    jfieldID lossHistoryField = env->GetFieldID(clazz, "lossHistory", "[D");
+    jdoubleArray jLossHistory = env->NewDoubleArray(losses.size());
+    env->SetDoubleArrayRegion(jLossHistory, 0, losses.size(), losses.data());
+    env->SetObjectField(resultObj, lossHistoryField, jLossHistory);
 
     return 0;
 }
@@ -0,0 +1,196 @@
+/*******************************************************************************
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <mkl_cblas.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include "Logger.h"
+#include "OneCCL.h"
+#include "com_intel_oap_mllib_recommendation_ALSRecommendDALImpl.h"
+#include "service.h"
+
+using namespace std;
+using namespace daal;
+
+// Tile sizes of the score computation, a tile of scores stays in L2 cache
+static const size_t srcTileSize = 256;
+static const size_t dstTileSize = 1024;
+
+struct ScoredItem {
+    float score;
+    jint id;
+};
+
+// Heaps keep the lowest score at the front
+static bool higherScore(const ScoredItem &a, const ScoredItem &b) {
+    return a.score > b.score || (a.score == b.score && a.id < b.id);
+}
+
+/*
+ * Scores of the src rows against a block of dst rows tile by tile, each tile
+ * is a single SGEMM of src rows by the transposed dst rows, then each src row
+ * keeps its num best dst rows in a bounded heap. Threads split the src tiles,
+ * MKL is linked with its sequential layer.
+ */
+static void scoreBlock(const float *srcFactors, size_t nSrc,
+                       const jint *dstIds, const float *dstFactors,
+                       size_t nDst, size_t rank, size_t num,
+                       vector<vector<ScoredItem>> &heaps) {
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, nSrc, srcTileSize),
+        [&](const tbb::blocked_range<size_t> &range) {
+            vector<float> scores(range.size() * dstTileSize);
+            for (size_t dstBegin = 0; dstBegin < nDst;
+                 dstBegin += dstTileSize) {
+                const size_t dstEnd = min(nDst, dstBegin + dstTileSize);
+                const size_t tileDst = dstEnd - dstBegin;
+                cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                            range.size(), tileDst, rank, 1.0f,
+                            srcFactors + range.begin() * rank, rank,
+                            dstFactors + dstBegin * rank, rank, 0.0f,
+                            scores.data(), tileDst);
+                for (size_t s = range.begin(); s != range.end(); s++) {
+                    const float *row = &scores[(s - range.begin()) * tileDst];
+                    vector<ScoredItem> &heap = heaps[s];
+                    for (size_t d = 0; d < tileDst; d++) {
+                        ScoredItem item = {row[d], dstIds[dstBegin + d]};
+                        if (heap.size() < num) {
+                            heap.push_back(item);
+                            push_heap(heap.begin(), heap.end(), higherScore);
+                        } else if (higherScore(item, heap.front())) {
+                            pop_heap(heap.begin(), heap.end(), higherScore);
+                            heap.back() = item;
+                            push_heap(heap.begin(), heap.end(), higherScore);
+                        }
+                    }
+                }
+            }
+        });
+}
+
+/*
+ * Class:     com_intel_oap_mllib_recommendation_ALSRecommendDALImpl
+ * Method:    cRecommendForAll
+ * Signature: (Ljava/nio/ByteBuffer;ILjava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IIIILjava/nio/ByteBuffer;Ljava/nio/ByteBuffer;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_intel_oap_mllib_recommendation_ALSRecommendDALImpl_cRecommendForAll(
+    JNIEnv *env, jobject obj, jobject srcFactorsBuffer, jint nSrc,
+    jobject dstIdsBuffer, jobject dstFactorsBuffer, jint nDst, jint rank,
+    jint num, jint executorCores, jobject recIdsBuffer,
+    jobject recScoresBuffer) {
+    ccl::communicator &comm = getComm();
+    const size_t rankId = comm.rank();
+    const size_t nRanks = comm.size();
+
+    services::Environment::getInstance()->setNumberOfThreads(executorCores);
+
+    const float *srcFactors =
+        (float *)env->GetDirectBufferAddress(srcFactorsBuffer);
+    jint *recIds = (jint *)env->GetDirectBufferAddress(recIdsBuffer);
+    float *recScores = (float *)env->GetDirectBufferAddress(recScoresBuffer);
+
+    // Block of dst rows held now, the block of rank r is at rank r + s after
+    // s shifts of the ring
+    const jint *localDstIds =
+        (jint *)env->GetDirectBufferAddress(dstIdsBuffer);
+    const float *localDstFactors =
+        (float *)env->GetDirectBufferAddress(dstFactorsBuffer);
+    vector<jint> dstIds(localDstIds, localDstIds + nDst);
+    vector<float> dstFactors(localDstFactors,
+                             localDstFactors + (size_t)nDst * rank);
+
+    vector<size_t> blockSizes(nRanks);
+    vector<size_t> countsOfSizes(nRanks, 1);
+    size_t localSize = nDst;
+    ccl::allgatherv(&localSize, 1, blockSizes.data(), countsOfSizes, comm)
+        .wait();
+
+    vector<vector<ScoredItem>> heaps(nSrc);
+    for (auto &heap : heaps)
+        heap.reserve(num);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    const size_t next = (rankId + 1) % nRanks;
+    vector<size_t> idSendCounts(nRanks), idRecvCounts(nRanks);
+    vector<size_t> factorSendCounts(nRanks), factorRecvCounts(nRanks);
+    vector<jint> nextIds;
+    vector<float> nextFactors;
+    for (size_t step = 0; step < nRanks; step++) {
+        const bool shift = step + 1 < nRanks;
+        vector<ccl::event> events;
+        if (shift) {
+            // Pass the block on while scoring it, the ring only talks to the
+            // neighbors
+            const size_t prev = (rankId + nRanks - 1) % nRanks;
+            const size_t incomingSize =
+                blockSizes[(rankId + 2 * nRanks - step - 1) % nRanks];
+            fill(idSendCounts.begin(), idSendCounts.end(), 0);
+            fill(idRecvCounts.begin(), idRecvCounts.end(), 0);
+            fill(factorSendCounts.begin(), factorSendCounts.end(), 0);
+            fill(factorRecvCounts.begin(), factorRecvCounts.end(), 0);
+            idSendCounts[next] = dstIds.size();
+            idRecvCounts[prev] = incomingSize;
+            factorSendCounts[next] = dstFactors.size();
+            factorRecvCounts[prev] = incomingSize * rank;
+            nextIds.resize(incomingSize);
+            nextFactors.resize(incomingSize * rank);
+            events.push_back(ccl::alltoallv(dstIds.data(), idSendCounts,
+                                            nextIds.data(), idRecvCounts,
+                                            comm));
+            events.push_back(ccl::alltoallv(dstFactors.data(), factorSendCounts,
+                                            nextFactors.data(),
+                                            factorRecvCounts, comm));
+        }
+
+        scoreBlock(srcFactors, nSrc, dstIds.data(), dstFactors.data(),
+                   dstIds.size(), rank, num, heaps);
+
+        if (shift) {
+            for (auto &event : events)
+                event.wait();
+            dstIds.swap(nextIds);
+            dstFactors.swap(nextFactors);
+        }
+    }
+
+    // Best first
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nSrc),
+                      [&](const tbb::blocked_range<size_t> &range) {
+                          for (size_t s = range.begin(); s != range.end();
+                               s++) {
+                              vector<ScoredItem> &heap = heaps[s];
+                              sort_heap(heap.begin(), heap.end(), higherScore);
+                              for (size_t i = 0; i < heap.size(); i++) {
+                                  recIds[s * num + i] = heap[i].id;
+                                  recScores[s * num + i] = heap[i].score;
+                              }
+                          }
+                      });
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    float duration = std::chrono::duration<float>(t2 - t1).count();
+    logger::println(logger::INFO,
+                    "ALS (native): top %d of %d rows over %zu ranks took %f "
+                    "secs",
+                    num, nSrc, nRanks, duration);
+}
@@ -15,103 +15,412 @@
  *******************************************************************************/
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <set>
 #include <vector>
 
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
 #include "ALSShuffle.h"
 
 #include "Logger.h"
 
 using namespace std;
 
-std::vector<Rating> recvData;
+// IEEE half precision, rounded to nearest even
+uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t floatExponent = (bits >> 23) & 0xff;
+    const int32_t exponent = (int32_t)floatExponent - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    // Infinity and NaN
+    if (floatExponent == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    // Subnormal or zero
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        const uint32_t shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    // A carry of the rounding into the exponent is still correct
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    const uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return sign | half;
+}
+
+float halfToFloat(uint16_t value) {
+    const uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // Normalize the subnormal
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    } else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+CompactRatings::CompactRatings(RatingEncoding encoding)
+    : encoding(encoding), recordBytes(recordSize(encoding)) {}
+
+size_t CompactRatings::recordSize(RatingEncoding encoding) {
+    switch (encoding) {
+    case RatingEncoding::Float32:
+        return 2 * sizeof(uint32_t) + sizeof(float);
+    case RatingEncoding::Float16:
+        return 2 * sizeof(uint32_t) + sizeof(uint16_t);
+    default:
+        return 2 * sizeof(uint32_t);
+    }
+}
+
+void CompactRatings::encode(const Rating &rating, RatingEncoding encoding,
+                            unsigned char *record) {
+    const uint32_t user = rating.user;
+    const uint32_t item = rating.item;
+    memcpy(record, &user, sizeof(user));
+    memcpy(record + sizeof(user), &item, sizeof(item));
+    unsigned char *value = record + 2 * sizeof(uint32_t);
+    if (encoding == RatingEncoding::Float32) {
+        const float rating32 = rating.rating;
+        memcpy(value, &rating32, sizeof(rating32));
+    } else if (encoding == RatingEncoding::Float16) {
+        const uint16_t rating16 = floatToHalf(rating.rating);
+        memcpy(value, &rating16, sizeof(rating16));
+    }
+}
+
+uint32_t CompactRatings::user(size_t i) const {
+    uint32_t user;
+    memcpy(&user, data.data() + i * recordBytes, sizeof(user));
+    return user;
+}
 
-jlong getPartiton(jlong key, jlong totalKeys, long nBlocks) {
+uint32_t CompactRatings::item(size_t i) const {
+    uint32_t item;
+    memcpy(&item, data.data() + i * recordBytes + sizeof(uint32_t),
+           sizeof(item));
+    return item;
+}
 
-    jlong itemsInBlock = totalKeys / nBlocks;
+float CompactRatings::value(size_t i) const {
+    const unsigned char *value =
+        data.data() + i * recordBytes + 2 * sizeof(uint32_t);
+    if (encoding == RatingEncoding::Float32) {
+        float rating;
+        memcpy(&rating, value, sizeof(rating));
+        return rating;
+    }
+    if (encoding == RatingEncoding::Float16) {
+        uint16_t rating;
+        memcpy(&rating, value, sizeof(rating));
+        return halfToFloat(rating);
+    }
+    return 1.0f;
+}
 
-    return min(key / itemsInBlock, nBlocks - 1);
+bool allRatingsAreOne(ccl::communicator &comm, const Rating *ratings,
+                      size_t nRatings) {
+    int allOne = 1;
+    for (size_t i = 0; i < nRatings && allOne; i++)
+        allOne = ratings[i].rating == 1.0f;
+    ccl::allreduce(&allOne, &allOne, 1, ccl::reduction::min, comm).wait();
+    return allOne;
 }
 
-// Compares two Rating according to userId.
-bool compareRatingByUser(Rating r1, Rating r2) {
-    if (r1.user < r2.user)
-        return true;
-    if (r1.user == r2.user && r1.item < r2.item)
-        return true;
-    return false;
+// Number of sampled ratings per partition for balanced boundaries
+static const size_t samplesPerBlock = 10000;
+
+PartitionBoundaries getRangeBoundaries(jlong totalKeys, long nBlocks) {
+    PartitionBoundaries boundaries(nBlocks + 1);
+    for (long i = 0; i < nBlocks; i++)
+        boundaries[i] = i * (totalKeys / nBlocks);
+    boundaries[nBlocks] = totalKeys;
+    return boundaries;
 }
 
-bool compareRatingUserEquality(Rating &r1, Rating &r2) {
-    return r1.user == r2.user;
+// Quantiles of the sorted keys, as ratings are sampled uniformly each key is
+// weighted by its number of ratings. Every partition keeps at least one key.
+static PartitionBoundaries quantileBoundaries(std::vector<jlong> &keys,
+                                              jlong totalKeys, long nBlocks) {
+    if (keys.empty() || totalKeys < nBlocks)
+        return getRangeBoundaries(totalKeys, nBlocks);
+
+    std::sort(keys.begin(), keys.end());
+    PartitionBoundaries boundaries(nBlocks + 1);
+    boundaries[0] = 0;
+    for (long i = 1; i < nBlocks; i++) {
+        jlong quantile = keys[i * keys.size() / nBlocks];
+        boundaries[i] = std::min(std::max(quantile, boundaries[i - 1] + 1),
+                                 totalKeys - (nBlocks - i));
+    }
+    boundaries[nBlocks] = totalKeys;
+    return boundaries;
 }
 
-int distinct_count(std::vector<Rating> &data) {
-    long curUser = -1;
-    long count = 0;
-    for (auto &i : data) {
-        if (i.user > curUser) {
-            curUser = i.user;
-            count += 1;
+void getBalancedBoundaries(ccl::communicator &comm, const Rating *ratings,
+                           size_t nRatings, jlong totalUsers, jlong totalItems,
+                           long nBlocks, PartitionBoundaries &userBoundaries,
+                           PartitionBoundaries &itemBoundaries) {
+    uint64_t totalRatings = nRatings;
+    ccl::allreduce(&totalRatings, &totalRatings, 1, ccl::reduction::sum, comm)
+        .wait();
+
+    // Same sampling rate on all ranks
+    const size_t stride =
+        std::max<uint64_t>(1, totalRatings / (samplesPerBlock * nBlocks));
+    std::vector<int64_t> sample;
+    for (size_t i = 0; i < nRatings; i += stride) {
+        sample.push_back(ratings[i].user);
+        sample.push_back(ratings[i].item);
+    }
+
+    std::vector<size_t> recvCounts(comm.size());
+    std::vector<size_t> countsOfCounts(comm.size(), 1);
+    size_t sampleSize = sample.size();
+    ccl::allgatherv(&sampleSize, 1, recvCounts.data(), countsOfCounts, comm)
+        .wait();
+    size_t totalSampleSize = 0;
+    for (auto count : recvCounts)
+        totalSampleSize += count;
+    std::vector<int64_t> allSamples(totalSampleSize);
+    ccl::allgatherv(sample.data(), sample.size(), allSamples.data(),
+                    recvCounts, comm)
+        .wait();
+
+    std::vector<jlong> users(totalSampleSize / 2);
+    std::vector<jlong> items(totalSampleSize / 2);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i] = allSamples[2 * i];
+        items[i] = allSamples[2 * i + 1];
+    }
+    userBoundaries = quantileBoundaries(users, totalUsers, nBlocks);
+    itemBoundaries = quantileBoundaries(items, totalItems, nBlocks);
+
+    logger::println(logger::INFO,
+                    "ALS (native): balanced boundaries from %zu sampled "
+                    "ratings",
+                    users.size());
+}
+
+jlong getPartition(jlong key, const PartitionBoundaries &boundaries) {
+    return std::upper_bound(boundaries.begin() + 1, boundaries.end() - 1,
+                            key) -
+           boundaries.begin() - 1;
+}
+
+std::vector<size_t> groupByPartition(Rating *ratings, size_t nRatings,
+                                     const PartitionBoundaries &boundaries) {
+    const size_t nBlocks = boundaries.size() - 1;
+    std::vector<size_t> offsets(nBlocks + 1, 0);
+    for (size_t i = 0; i < nRatings; i++)
+        offsets[getPartition(ratings[i].user, boundaries) + 1]++;
+    for (size_t b = 0; b < nBlocks; b++)
+        offsets[b + 1] += offsets[b];
+
+    // Cycle each misplaced rating into the next free slot of its partition
+    std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+    for (size_t b = 0; b < nBlocks; b++) {
+        while (next[b] < offsets[b + 1]) {
+            Rating rating = ratings[next[b]];
+            size_t target = getPartition(rating.user, boundaries);
+            while (target != b) {
+                std::swap(rating, ratings[next[target]++]);
+                target = getPartition(rating.user, boundaries);
+            }
+            ratings[next[b]++] = rating;
         }
     }
-    return count;
+
+    return offsets;
 }
 
-Rating *shuffle_all2all(ccl::communicator &comm,
-                        std::vector<RatingPartition> &partitions,
-                        size_t nBlocks, size_t &newRatingsNum,
-                        size_t &newCsrRowNum) {
-    size_t sendBufSize = 0;
-    size_t recvBufSize = 0;
+void shuffle_all2all(ccl::communicator &comm, const Rating *ratings,
+                     const std::vector<size_t> &partitionOffsets,
+                     size_t nBlocks, size_t maxRoundBytes,
+                     CompactRatings &recvData) {
+    const RatingEncoding encoding = recvData.getEncoding();
+    const size_t recordSize = CompactRatings::recordSize(encoding);
+    vector<size_t> perNodeSendNums(nBlocks);
+    vector<size_t> perNodeRecvNums(nBlocks);
     vector<size_t> perNodeSendLens(nBlocks);
     vector<size_t> perNodeRecvLens(nBlocks);
 
-    ByteBuffer sendData;
+    // Each rank sends at most this many ratings to each rank in a round, so
+    // it also receives at most maxRoundBytes in a round
+    const size_t maxRatingsPerNode =
+        std::max<size_t>(1, maxRoundBytes / (recordSize * nBlocks));
 
-    // Calculate send buffer size
+    uint64_t nRounds = 0;
     for (size_t i = 0; i < nBlocks; i++) {
-        perNodeSendLens[i] = partitions[i].size() * RATING_SIZE;
-        sendBufSize += perNodeSendLens[i];
+        perNodeSendNums[i] = partitionOffsets[i + 1] - partitionOffsets[i];
+        nRounds = std::max<uint64_t>(
+            nRounds, (perNodeSendNums[i] + maxRatingsPerNode - 1) /
+                         maxRatingsPerNode);
     }
-    logger::println(logger::INFO, "sendData size %d", sendBufSize);
-    sendData.resize(sendBufSize);
+    ccl::allreduce(&nRounds, &nRounds, 1, ccl::reduction::max, comm).wait();
 
-    // Fill in send buffer
-    size_t offset = 0;
-    for (size_t i = 0; i < nBlocks; i++) {
-        memcpy(sendData.data() + offset, partitions[i].data(),
-               perNodeSendLens[i]);
-        offset += perNodeSendLens[i];
-    }
-
-    // Send lens first
-    ccl::alltoall(perNodeSendLens.data(), perNodeRecvLens.data(),
-                  sizeof(size_t), ccl::datatype::uint8, comm)
+    // Send numbers first, so the received ratings are appended in place
+    ccl::alltoall(perNodeSendNums.data(), perNodeRecvNums.data(), 1, comm)
         .wait();
+    size_t ratingsNum = 0;
+    for (size_t i = 0; i < nBlocks; i++)
+        ratingsNum += perNodeRecvNums[i];
+    recvData.resize(0);
+    recvData.reserve(ratingsNum);
 
-    // Calculate recv buffer size
-    for (size_t i = 0; i < nBlocks; i++) {
-        recvBufSize += perNodeRecvLens[i];
+    logger::println(logger::INFO,
+                    "sendData size %zu, recvData size %zu in %lu rounds",
+                    partitionOffsets[nBlocks] * recordSize,
+                    ratingsNum * recordSize, nRounds);
+
+    ByteBuffer sendData;
+    vector<size_t> sent(nBlocks, 0);
+    vector<size_t> received(nBlocks, 0);
+    for (uint64_t round = 0; round < nRounds; round++) {
+        size_t sendBufSize = 0;
+        size_t recvBufSize = 0;
+        for (size_t i = 0; i < nBlocks; i++) {
+            size_t sendNum =
+                std::min(maxRatingsPerNode, perNodeSendNums[i] - sent[i]);
+            size_t recvNum =
+                std::min(maxRatingsPerNode, perNodeRecvNums[i] - received[i]);
+            perNodeSendLens[i] = sendNum * recordSize;
+            perNodeRecvLens[i] = recvNum * recordSize;
+            sendBufSize += perNodeSendLens[i];
+            recvBufSize += perNodeRecvLens[i];
+        }
+
+        // Encode the ratings of this round into the send buffer
+        sendData.resize(sendBufSize);
+        unsigned char *record = sendData.data();
+        for (size_t i = 0; i < nBlocks; i++) {
+            const size_t sendNum = perNodeSendLens[i] / recordSize;
+            const Rating *first = ratings + partitionOffsets[i] + sent[i];
+            for (size_t j = 0; j < sendNum; j++, record += recordSize)
+                CompactRatings::encode(first[j], encoding, record);
+            sent[i] += sendNum;
+            received[i] += perNodeRecvLens[i] / recordSize;
+        }
+
+        size_t recvOffset = recvData.size();
+        recvData.resize(recvOffset + recvBufSize / recordSize);
+
+        ccl::alltoallv(sendData.data(), perNodeSendLens,
+                       recvData.record(recvOffset), perNodeRecvLens,
+                       ccl::datatype::uint8, comm)
+            .wait();
     }
 
-    int ratingsNum = recvBufSize / RATING_SIZE;
-    recvData.resize(ratingsNum);
+    logger::println(logger::INFO, "newRatingsNum: %zu", ratingsNum);
+}
 
-    // Send data
-    ccl::alltoallv(sendData.data(), perNodeSendLens, recvData.data(),
-                   perNodeRecvLens, ccl::datatype::uint8, comm)
-        .wait();
+/*
+ * Parallel bucket sort of the ratings by user followed by a sort of each
+ * bucket by item. Rows are counted with atomic counters, the counts are
+ * scanned into row offsets and every rating is scattered straight into the
+ * CSR arrays of the table, so the ratings are never sorted as a whole.
+ */
+CSRNumericTablePtr ratingsToCSRTable(const CompactRatings &ratings,
+                                     jlong rowOffset, size_t nRows,
+                                     size_t nColumns) {
+    const size_t nRatings = ratings.size();
+
+    std::unique_ptr<std::atomic<size_t>[]> cursors(
+        new std::atomic<size_t>[nRows + 1]);
+    for (size_t i = 0; i <= nRows; i++)
+        cursors[i] = 0;
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nRatings),
+                      [&](const tbb::blocked_range<size_t> &range) {
+                          for (size_t i = range.begin(); i < range.end(); i++)
+                              cursors[ratings.user(i) - rowOffset + 1]++;
+                      });
+
+    float *values = NULL;
+    size_t *colIndices = NULL;
+    size_t *rowOffsets = NULL;
+    CSRNumericTable *table =
+        new CSRNumericTable(values, colIndices, rowOffsets, nColumns, nRows);
+    table->allocateDataMemory(nRatings);
+    table->getArrays<float>(&values, &colIndices, &rowOffsets);
+
+    // Zero-based offsets while filling, rowOffsets[row] is the row start
+    rowOffsets[0] = 0;
+    for (size_t row = 0; row < nRows; row++) {
+        rowOffsets[row + 1] = rowOffsets[row] + cursors[row + 1];
+        cursors[row] = rowOffsets[row];
+    }
 
-    sort(recvData.begin(), recvData.end(), compareRatingByUser);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nRatings),
+                      [&](const tbb::blocked_range<size_t> &range) {
+                          for (size_t i = range.begin(); i < range.end();
+                               i++) {
+                              size_t pos =
+                                  cursors[ratings.user(i) - rowOffset]++;
+                              colIndices[pos] = ratings.item(i);
+                              values[pos] = ratings.value(i);
+                          }
+                      });
 
-    newRatingsNum = recvData.size();
-    newCsrRowNum = distinct_count(recvData);
+    // Sort items of each row, ties by value to be independent of the order
+    // the ratings were received
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, nRows),
+        [&](const tbb::blocked_range<size_t> &range) {
+            std::vector<std::pair<size_t, float>> row;
+            for (size_t r = range.begin(); r < range.end(); r++) {
+                const size_t begin = rowOffsets[r];
+                const size_t end = rowOffsets[r + 1];
+                row.clear();
+                for (size_t pos = begin; pos < end; pos++)
+                    row.emplace_back(colIndices[pos], values[pos]);
+                std::sort(row.begin(), row.end());
+                for (size_t pos = begin; pos < end; pos++) {
+                    // One-based column indices
+                    colIndices[pos] = row[pos - begin].first + 1;
+                    values[pos] = row[pos - begin].second;
+                }
+            }
+        });
 
-    logger::println(logger::INFO, "newRatingsNum: %d, newCsrRowNum: %d",
-                    newRatingsNum, newCsrRowNum);
+    // One-based row offsets
+    for (size_t row = 0; row <= nRows; row++)
+        rowOffsets[row] += 1;
 
-    return recvData.data();
+    return CSRNumericTablePtr(table);
 }
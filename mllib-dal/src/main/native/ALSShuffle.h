@@ -16,8 +16,12 @@
 
 #pragma once
 
+#include <cstdint>
 #include <jni.h>
 #include <oneapi/ccl.hpp>
+#include <vector>
+
+#include "service.h"
 
 struct Rating {
     jlong user;
@@ -28,9 +32,79 @@ struct Rating {
 const int RATING_SIZE = sizeof(Rating);
 
 typedef std::vector<unsigned char> ByteBuffer;
-typedef std::vector<Rating> RatingPartition;
 
-jlong getPartiton(jlong key, jlong totalKeys, long nBlocks);
-Rating *shuffle_all2all(ccl::communicator &comm,
-                        std::vector<RatingPartition> &partitions,
-                        size_t nBlocks, size_t &ratingsNum, size_t &csrRowNum);
+// Encodings of the rating values in the shuffle, ids are always 32-bit
+enum class RatingEncoding : int { Float32 = 0, Float16 = 1, One = 2 };
+
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t value);
+
+/*
+ * Ratings as sent by the shuffle, each record is [user | item | value] with
+ * 32-bit ids and the value encoded as float32, float16 or nothing at all if
+ * every rating is 1.
+ */
+class CompactRatings {
+public:
+    explicit CompactRatings(RatingEncoding encoding = RatingEncoding::Float32);
+
+    static size_t recordSize(RatingEncoding encoding);
+    static void encode(const Rating &rating, RatingEncoding encoding,
+                       unsigned char *record);
+
+    RatingEncoding getEncoding() const { return encoding; }
+    size_t size() const { return data.size() / recordBytes; }
+    void reserve(size_t n) { data.reserve(n * recordBytes); }
+    void resize(size_t n) { data.resize(n * recordBytes); }
+    unsigned char *record(size_t i) { return data.data() + i * recordBytes; }
+
+    uint32_t user(size_t i) const;
+    uint32_t item(size_t i) const;
+    float value(size_t i) const;
+
+private:
+    RatingEncoding encoding;
+    size_t recordBytes;
+    ByteBuffer data;
+};
+
+// First key of each of nBlocks partitions followed by the number of keys
+typedef std::vector<jlong> PartitionBoundaries;
+
+// Ranges of totalKeys / nBlocks keys, the remaining keys belong to the last
+// partition
+PartitionBoundaries getRangeBoundaries(jlong totalKeys, long nBlocks);
+
+// Boundaries of users and items which balance the number of ratings of the
+// partitions, estimated from a sample of the ratings of all ranks. All ranks
+// get the same boundaries.
+void getBalancedBoundaries(ccl::communicator &comm, const Rating *ratings,
+                           size_t nRatings, jlong totalUsers, jlong totalItems,
+                           long nBlocks, PartitionBoundaries &userBoundaries,
+                           PartitionBoundaries &itemBoundaries);
+
+jlong getPartition(jlong key, const PartitionBoundaries &boundaries);
+
+// Reorder ratings in place so the ratings of each partition are contiguous.
+// Returns the first rating of each partition followed by nRatings.
+std::vector<size_t> groupByPartition(Rating *ratings, size_t nRatings,
+                                     const PartitionBoundaries &boundaries);
+
+// Whether the ratings of all ranks are 1, so their values need not be sent
+bool allRatingsAreOne(ccl::communicator &comm, const Rating *ratings,
+                      size_t nRatings);
+
+// Send the ratings grouped by groupByPartition to the ranks of their
+// partitions in rounds of at most maxRoundBytes sent and received per rank,
+// encoded as recvData. The received ratings are appended to recvData.
+void shuffle_all2all(ccl::communicator &comm, const Rating *ratings,
+                     const std::vector<size_t> &partitionOffsets,
+                     size_t nBlocks, size_t maxRoundBytes,
+                     CompactRatings &recvData);
+
+// Build a CSR table of nRows x nColumns with one-based indices from ratings
+// whose users are in [rowOffset, rowOffset + nRows), items of each row are
+// sorted
+CSRNumericTablePtr ratingsToCSRTable(const CompactRatings &ratings,
+                                     jlong rowOffset, size_t nRows,
+                                     size_t nColumns);
@@ -0,0 +1,299 @@
+/*******************************************************************************
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <random>
+
+#include "KMeansKernels.h"
+#include "Logger.h"
+#include "OneCCL.h"
+#include "com_intel_oap_mllib_clustering_BisectingKMeansDALImpl.h"
+#include "service.h"
+
+using namespace std;
+using namespace daal;
+using namespace daal::services;
+
+// Same as Spark, indices of the clusters below this level would overflow
+static const int levelLimit = 63;
+
+struct ClusterSummary {
+    CpuAlgorithmFPType size;
+    CpuAlgorithmFPType cost;
+    std::vector<CpuAlgorithmFPType> center;
+};
+
+// Size, center and cost of a cluster from [sums | count | sum of squares]
+static ClusterSummary toClusterSummary(const CpuAlgorithmFPType *stats,
+                                       size_t nFeatures) {
+    ClusterSummary summary;
+    summary.size = stats[nFeatures];
+    summary.center.assign(stats, stats + nFeatures);
+    CpuAlgorithmFPType squaredNorm = 0.0;
+    for (auto &value : summary.center) {
+        value /= summary.size;
+        squaredNorm += value * value;
+    }
+    // The cost is computed the same way as Spark, sum |x|^2 - n * |c|^2
+    summary.cost =
+        std::max(stats[nFeatures + 1] - summary.size * squaredNorm, 0.0);
+    return summary;
+}
+
+/*
+ * Bisecting k-means, the same as BisectingKMeans of Spark MLlib. Clusters are
+ * indexed as a binary tree, the root is 1 and the children of i are 2i and
+ * 2i + 1. The data stays in place and every row keeps the index of its
+ * cluster, so each split runs 2-means on the rows of the dividing clusters
+ * only. Statistics are allreduced, so every rank holds the same clusters.
+ */
+static std::map<long, ClusterSummary>
+bisectingKMeans(ccl::communicator &comm, const NumericTablePtr &pData,
+                size_t nClusters, int maxIterations,
+                double minDivisibleClusterSize, unsigned long seed) {
+    const size_t nRows = pData->getNumberOfRows();
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t statsSize = nFeatures + 2;
+
+    std::vector<long> assignments(nRows, 1);
+    std::vector<CpuAlgorithmFPType> stats;
+
+    std::map<long, ClusterSummary> activeClusters;
+    std::map<long, ClusterSummary> inactiveClusters;
+
+    summarizeClusters(pData, std::vector<int>(nRows, 0), 1, stats);
+    ccl::allreduce(stats.data(), stats.data(), stats.size(),
+                   ccl::reduction::sum, comm)
+        .wait();
+    activeClusters[1] = toClusterSummary(stats.data(), nFeatures);
+
+    const CpuAlgorithmFPType totalRows = activeClusters[1].size;
+    const CpuAlgorithmFPType minSize =
+        minDivisibleClusterSize >= 1.0
+            ? std::ceil(minDivisibleClusterSize)
+            : std::ceil(minDivisibleClusterSize * totalRows);
+    logger::println(logger::INFO,
+                    "BisectingKMeans (native): minimum divisible cluster "
+                    "size %f",
+                    minSize);
+
+    // Same seed on all ranks, so all ranks split centers the same way
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<CpuAlgorithmFPType> uniform(0.0, 1.0);
+
+    long nLeafClustersNeeded = (long)nClusters - 1;
+    int level = 1;
+    while (!activeClusters.empty() && nLeafClustersNeeded > 0 &&
+           level < levelLimit) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        // Divisible clusters are large enough and have non-trivial cost
+        std::vector<long> divisible;
+        for (auto &cluster : activeClusters)
+            if (cluster.second.size >= minSize &&
+                cluster.second.cost > std::numeric_limits<double>::epsilon() *
+                                          cluster.second.size)
+                divisible.push_back(cluster.first);
+        // Take the larger ones if not all are needed
+        if ((long)divisible.size() > nLeafClustersNeeded) {
+            std::stable_sort(divisible.begin(), divisible.end(),
+                             [&](long a, long b) {
+                                 return activeClusters[a].size >
+                                        activeClusters[b].size;
+                             });
+            divisible.resize(nLeafClustersNeeded);
+        }
+
+        inactiveClusters.insert(activeClusters.begin(), activeClusters.end());
+        if (divisible.empty()) {
+            logger::println(logger::INFO,
+                            "BisectingKMeans (native): no divisible clusters "
+                            "left on level %d",
+                            level);
+            activeClusters.clear();
+            break;
+        }
+
+        const size_t nParents = divisible.size();
+        std::map<long, int> parentSlotOf;
+        for (size_t i = 0; i < nParents; i++)
+            parentSlotOf[divisible[i]] = i;
+        std::vector<int> parentSlots(nRows);
+        for (size_t row = 0; row < nRows; row++) {
+            auto found = parentSlotOf.find(assignments[row]);
+            parentSlots[row] =
+                found == parentSlotOf.end() ? -1 : found->second;
+        }
+
+        // Split each center into two by a small random shift
+        CentroidsBuffer childCenters(2 * nParents * nFeatures);
+        std::vector<bool> childPresent(2 * nParents, true);
+        for (size_t i = 0; i < nParents; i++) {
+            const std::vector<CpuAlgorithmFPType> &center =
+                activeClusters[divisible[i]].center;
+            CpuAlgorithmFPType norm = 0.0;
+            for (auto value : center)
+                norm += value * value;
+            const CpuAlgorithmFPType shift = 1e-4 * std::sqrt(norm);
+            for (size_t f = 0; f < nFeatures; f++) {
+                CpuAlgorithmFPType noise = shift * uniform(rng);
+                childCenters[2 * i * nFeatures + f] = center[f] - noise;
+                childCenters[(2 * i + 1) * nFeatures + f] = center[f] + noise;
+            }
+        }
+
+        std::vector<int> childSlots(nRows, -1);
+        int nIterations = 0;
+        while (nIterations < maxIterations) {
+            nIterations++;
+            size_t changed = assignToChildren(pData, parentSlots, childCenters,
+                                              childPresent, childSlots);
+            summarizeClusters(pData, childSlots, 2 * nParents, stats);
+            // Number of changed rows is reduced together with the statistics
+            stats.push_back(changed);
+            ccl::allreduce(stats.data(), stats.data(), stats.size(),
+                           ccl::reduction::sum, comm)
+                .wait();
+            CpuAlgorithmFPType totalChanged = stats.back();
+            stats.pop_back();
+
+            // Children without rows are dropped, as Spark does
+            for (size_t c = 0; c < 2 * nParents; c++) {
+                const CpuAlgorithmFPType *childStats = &stats[c * statsSize];
+                if (childStats[nFeatures] == 0) {
+                    childPresent[c] = false;
+                    continue;
+                }
+                for (size_t f = 0; f < nFeatures; f++)
+                    childCenters[c * nFeatures + f] =
+                        childStats[f] / childStats[nFeatures];
+            }
+
+            if (totalChanged == 0)
+                break;
+        }
+
+        for (size_t row = 0; row < nRows; row++)
+            if (childSlots[row] >= 0)
+                assignments[row] = 2 * divisible[childSlots[row] / 2] +
+                                   childSlots[row] % 2;
+
+        activeClusters.clear();
+        for (size_t c = 0; c < 2 * nParents; c++)
+            if (childPresent[c])
+                activeClusters[2 * divisible[c / 2] + c % 2] =
+                    toClusterSummary(&stats[c * statsSize], nFeatures);
+
+        nLeafClustersNeeded -= nParents;
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        float duration = std::chrono::duration<float>(t2 - t1).count();
+        logger::println(logger::INFO,
+                        "BisectingKMeans (native): divided %zu clusters on "
+                        "level %d in %d iterations, took %f secs",
+                        nParents, level, nIterations, duration);
+        level++;
+    }
+
+    activeClusters.insert(inactiveClusters.begin(), inactiveClusters.end());
+    return activeClusters;
+}
+
+/*
+ * Class:     com_intel_oap_mllib_clustering_BisectingKMeansDALImpl
+ * Method:    cBisectingKMeansDALCompute
+ * Signature: (JIIDJIILcom/intel/oap/mllib/clustering/BisectingKMeansResult;)J
+ */
+JNIEXPORT jlong JNICALL
+Java_com_intel_oap_mllib_clustering_BisectingKMeansDALImpl_cBisectingKMeansDALCompute(
+    JNIEnv *env, jobject obj, jlong pNumTabData, jint clusterNum,
+    jint iterationNum, jdouble minDivisibleClusterSize, jlong seed,
+    jint executorNum, jint executorCores, jobject resultObj) {
+    logger::println(logger::INFO, "OneDAL (native): CPU compute start");
+
+    ccl::communicator &comm = getComm();
+    size_t rankId = comm.rank();
+    NumericTablePtr pData = *((NumericTablePtr *)pNumTabData);
+    const size_t nFeatures = pData->getNumberOfColumns();
+
+    // Set number of threads for OneDAL to use for each rank
+    services::Environment::getInstance()->setNumberOfThreads(executorCores);
+
+    int nThreadsNew =
+        services::Environment::getInstance()->getNumberOfThreads();
+    logger::println(logger::INFO,
+                    "OneDAL (native): Number of CPU threads used %d",
+                    nThreadsNew);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::map<long, ClusterSummary> clusters =
+        bisectingKMeans(comm, pData, clusterNum, iterationNum,
+                        minDivisibleClusterSize, seed);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    float duration = std::chrono::duration<float>(t2 - t1).count();
+    logger::println(logger::INFO,
+                    "BisectingKMeans (native): training step took %f secs",
+                    duration);
+
+    if (rankId != ccl_root)
+        return (jlong)0;
+
+    // Each row of the result is [size, cost, center] of a cluster of the tree
+    const size_t nNodes = clusters.size();
+    NumericTablePtr resultClusters =
+        HomogenNumericTable<CpuAlgorithmFPType>::create(
+            nFeatures + 2, nNodes, NumericTable::doAllocate);
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    resultClusters->getBlockOfRows(0, nNodes, writeOnly, block);
+    CpuAlgorithmFPType *rows = block.getBlockPtr();
+
+    std::vector<jlong> indices;
+    CpuAlgorithmFPType totalCost = 0.0;
+    for (auto &cluster : clusters) {
+        CpuAlgorithmFPType *row = rows + indices.size() * (nFeatures + 2);
+        row[0] = cluster.second.size;
+        row[1] = cluster.second.cost;
+        std::copy(cluster.second.center.begin(), cluster.second.center.end(),
+                  row + 2);
+        indices.push_back(cluster.first);
+
+        // Leaves have no children
+        if (clusters.count(2 * cluster.first) == 0 &&
+            clusters.count(2 * cluster.first + 1) == 0)
+            totalCost += cluster.second.cost;
+    }
+    resultClusters->releaseBlockOfRows(block);
+
+    // Get the class of the input object
+    jclass clazz = env->GetObjectClass(resultObj);
+    // Get Field references
+    jfieldID totalCostField = env->GetFieldID(clazz, "totalCost", "D");
+    jfieldID clusterIndicesField =
+        env->GetFieldID(clazz, "clusterIndices", "[J");
+
+    // Set cost for result
+    env->SetDoubleField(resultObj, totalCostField, totalCost);
+    // Set tree indices of the clusters for result
+    jlongArray clusterIndices = env->NewLongArray(nNodes);
+    env->SetLongArrayRegion(clusterIndices, 0, nNodes, indices.data());
+    env->SetObjectField(resultObj, clusterIndicesField, clusterIndices);
+
+    NumericTablePtr *ret = new NumericTablePtr(resultClusters);
+    return (jlong)ret;
+}
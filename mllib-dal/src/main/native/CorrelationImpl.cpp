@@ -21,6 +21,7 @@
 #include "oneapi/dal/algo/covariance.hpp"
 #endif
 
+#include "CovarianceKernels.h"
 #include "OneCCL.h"
 #include "com_intel_oap_mllib_stat_CorrelationDALImpl.h"
 #include "service.h"
@@ -38,8 +39,7 @@ namespace covariance_cpu = daal::algorithms::covariance;
 static void doCorrelationDaalCompute(JNIEnv *env, jobject obj, size_t rankId,
                                      ccl::communicator &comm,
                                      const NumericTablePtr &pData,
-                                     size_t nBlocks, jobject resultObj) {
-    using daal::byte;
+                                     jobject resultObj) {
     auto t1 = std::chrono::high_resolution_clock::now();
 
     const bool isRoot = (rankId == ccl_root);
@@ -59,29 +59,14 @@ static void doCorrelationDaalCompute(JNIEnv *env, jobject obj, size_t rankId,
 
     t1 = std::chrono::high_resolution_clock::now();
 
-    /* Serialize partial results required by step 2 */
-    services::SharedPtr<byte> serializedData;
-    InputDataArchive dataArch;
-    localAlgorithm.getPartialResult()->serialize(dataArch);
-    size_t perNodeArchLength = dataArch.getSizeOfArchive();
-
-    serializedData =
-        services::SharedPtr<byte>(new byte[perNodeArchLength * nBlocks]);
-
-    byte *nodeResults = new byte[perNodeArchLength];
-    dataArch.copyArchiveToArray(nodeResults, perNodeArchLength);
-    std::vector<size_t> aReceiveCount(comm.size(),
-                                      perNodeArchLength); // 4 x "14016"
-
-    /* Transfer partial results to step 2 on the root node */
-    ccl::gather((int8_t *)nodeResults, perNodeArchLength,
-                (int8_t *)(serializedData.get()), perNodeArchLength, comm)
-        .wait();
+    /* Merge the partial results of all ranks on the root node */
+    covariance_cpu::PartialResultPtr mergedPartialResult =
+        reduceCovariancePartialResults(comm, localAlgorithm.getPartialResult());
     t2 = std::chrono::high_resolution_clock::now();
 
     duration = std::chrono::duration<float>(t2 - t1).count();
     logger::println(logger::INFO,
-                    "Correlation (native): ccl_allgatherv step took %f secs",
+                    "Correlation (native): reduce to master took %f secs",
                     duration);
     if (isRoot) {
         auto t1 = std::chrono::high_resolution_clock::now();
@@ -89,21 +74,10 @@ static void doCorrelationDaalCompute(JNIEnv *env, jobject obj, size_t rankId,
         covariance_cpu::Distributed<step2Master, CpuAlgorithmFPType>
             masterAlgorithm;
 
-        for (size_t i = 0; i < nBlocks; i++) {
-            /* Deserialize partial results from step 1 */
-            OutputDataArchive dataArch(serializedData.get() +
-                                           perNodeArchLength * i,
-                                       perNodeArchLength);
-
-            covariance_cpu::PartialResultPtr dataForStep2FromStep1(
-                new covariance_cpu::PartialResult());
-            dataForStep2FromStep1->deserialize(dataArch);
-
-            /* Set local partial results as input for the master-node algorithm
-             */
-            masterAlgorithm.input.add(covariance_cpu::partialResults,
-                                      dataForStep2FromStep1);
-        }
+        /* Set the merged partial result as input for the master-node
+         * algorithm */
+        masterAlgorithm.input.add(covariance_cpu::partialResults,
+                                  mergedPartialResult);
 
         /* Set the parameter to choose the type of the output matrix */
         masterAlgorithm.parameter.outputMatrixType =
@@ -210,8 +184,7 @@ Java_com_intel_oap_mllib_stat_CorrelationDALImpl_cCorrelationTrainDAL(
         logger::println(logger::INFO,
                         "OneDAL (native): Number of CPU threads used %d",
                         nThreadsNew);
-        doCorrelationDaalCompute(env, obj, rankId, cclComm, pData, executorNum,
-                                 resultObj);
+        doCorrelationDaalCompute(env, obj, rankId, cclComm, pData, resultObj);
         break;
     }
 #ifdef CPU_GPU_PROFILE
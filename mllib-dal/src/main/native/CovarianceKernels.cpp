@@ -0,0 +1,202 @@
+/*******************************************************************************
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+
+#include <algorithm>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include "CovarianceKernels.h"
+#include "OneCCL.h"
+
+using namespace std;
+using namespace daal;
+namespace covariance_cpu = daal::algorithms::covariance;
+
+// New table of nRows x nColumns values
+static NumericTablePtr createTable(size_t nColumns, size_t nRows) {
+    return HomogenNumericTable<CpuAlgorithmFPType>::create(
+        nColumns, nRows, NumericTable::doAllocate);
+}
+
+// Copy all values of table to values
+static void readTable(const NumericTablePtr &table,
+                      CpuAlgorithmFPType *values) {
+    const size_t nRows = table->getNumberOfRows();
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    table->getBlockOfRows(0, nRows, readOnly, block);
+    std::copy(block.getBlockPtr(),
+              block.getBlockPtr() + nRows * table->getNumberOfColumns(),
+              values);
+    table->releaseBlockOfRows(block);
+}
+
+// Copy values to all values of table
+static void writeTable(const NumericTablePtr &table,
+                       const CpuAlgorithmFPType *values) {
+    const size_t nRows = table->getNumberOfRows();
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    table->getBlockOfRows(0, nRows, writeOnly, block);
+    std::copy(values, values + nRows * table->getNumberOfColumns(),
+              block.getBlockPtr());
+    table->releaseBlockOfRows(block);
+}
+
+void shiftCrossProduct(CpuAlgorithmFPType *crossProduct,
+                       const CpuAlgorithmFPType *sums,
+                       CpuAlgorithmFPType nObservations,
+                       const CpuAlgorithmFPType *mean, size_t nFeatures) {
+    if (nObservations <= 0)
+        return;
+
+    std::vector<CpuAlgorithmFPType> shift(nFeatures);
+    for (size_t j = 0; j < nFeatures; j++)
+        shift[j] = sums[j] / nObservations - mean[j];
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, nFeatures),
+        [&](const tbb::blocked_range<size_t> &r) {
+            for (size_t i = r.begin(); i < r.end(); i++) {
+                const CpuAlgorithmFPType scale = nObservations * shift[i];
+                CpuAlgorithmFPType *row = crossProduct + i * nFeatures;
+                for (size_t j = 0; j < nFeatures; j++)
+                    row[j] += scale * shift[j];
+            }
+        });
+}
+
+covariance_cpu::PartialResultPtr reduceCovariancePartialResults(
+    ccl::communicator &comm,
+    const covariance_cpu::PartialResultPtr &partialResult) {
+    const bool isRoot = (comm.rank() == ccl_root);
+    NumericTablePtr sumTable = partialResult->get(covariance_cpu::sum);
+    NumericTablePtr crossProductTable =
+        partialResult->get(covariance_cpu::crossProduct);
+    const size_t nFeatures = sumTable->getNumberOfColumns();
+
+    // Observation count followed by the sums of all features
+    std::vector<CpuAlgorithmFPType> localTotals(nFeatures + 1);
+    readTable(partialResult->get(covariance_cpu::nObservations),
+              localTotals.data());
+    readTable(sumTable, localTotals.data() + 1);
+    std::vector<CpuAlgorithmFPType> totals(nFeatures + 1);
+    ccl::allreduce(localTotals.data(), totals.data(), totals.size(),
+                   ccl::reduction::sum, comm)
+        .wait();
+
+    std::vector<CpuAlgorithmFPType> mean(nFeatures, 0.0);
+    if (totals[0] > 0)
+        for (size_t j = 0; j < nFeatures; j++)
+            mean[j] = totals[j + 1] / totals[0];
+
+    // The receive buffer of the reduction is allocated on all ranks, oneCCL
+    // may use it as scratch space on non-root ranks too
+    NumericTablePtr mergedCrossProduct = createTable(nFeatures, nFeatures);
+    BlockDescriptor<CpuAlgorithmFPType> mergedBlock;
+    mergedCrossProduct->getBlockOfRows(0, nFeatures, writeOnly, mergedBlock);
+
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    crossProductTable->getBlockOfRows(0, nFeatures, readWrite, block);
+    shiftCrossProduct(block.getBlockPtr(), localTotals.data() + 1,
+                      localTotals[0], mean.data(), nFeatures);
+    ccl::reduce(block.getBlockPtr(), mergedBlock.getBlockPtr(),
+                nFeatures * nFeatures, ccl::reduction::sum, ccl_root, comm)
+        .wait();
+    crossProductTable->releaseBlockOfRows(block);
+    mergedCrossProduct->releaseBlockOfRows(mergedBlock);
+
+    if (!isRoot)
+        return covariance_cpu::PartialResultPtr();
+
+    NumericTablePtr nObservations = createTable(1, 1);
+    writeTable(nObservations, totals.data());
+    NumericTablePtr sums = createTable(nFeatures, 1);
+    writeTable(sums, totals.data() + 1);
+
+    covariance_cpu::PartialResultPtr merged(
+        new covariance_cpu::PartialResult());
+    merged->set(covariance_cpu::nObservations, nObservations);
+    merged->set(covariance_cpu::sum, sums);
+    merged->set(covariance_cpu::crossProduct, mergedCrossProduct);
+    return merged;
+}
+
+NumericTablePtr
+getCovarianceState(const covariance_cpu::PartialResultPtr &partialResult) {
+    NumericTablePtr crossProductTable =
+        partialResult->get(covariance_cpu::crossProduct);
+    const size_t nFeatures = crossProductTable->getNumberOfColumns();
+
+    NumericTablePtr state = createTable(nFeatures, nFeatures + 2);
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    state->getBlockOfRows(0, nFeatures + 2, writeOnly, block);
+    CpuAlgorithmFPType *values = block.getBlockPtr();
+    std::fill(values, values + nFeatures, 0.0);
+    readTable(partialResult->get(covariance_cpu::nObservations), values);
+    readTable(partialResult->get(covariance_cpu::sum), values + nFeatures);
+    readTable(crossProductTable, values + 2 * nFeatures);
+    state->releaseBlockOfRows(block);
+    return state;
+}
+
+void addCovarianceState(const covariance_cpu::PartialResultPtr &partialResult,
+                        const NumericTablePtr &state) {
+    NumericTablePtr nObservationsTable =
+        partialResult->get(covariance_cpu::nObservations);
+    NumericTablePtr sumTable = partialResult->get(covariance_cpu::sum);
+    NumericTablePtr crossProductTable =
+        partialResult->get(covariance_cpu::crossProduct);
+    const size_t nFeatures = crossProductTable->getNumberOfColumns();
+
+    std::vector<CpuAlgorithmFPType> stateValues((nFeatures + 2) * nFeatures);
+    readTable(state, stateValues.data());
+    const CpuAlgorithmFPType stateObservations = stateValues[0];
+    const CpuAlgorithmFPType *stateSums = stateValues.data() + nFeatures;
+    CpuAlgorithmFPType *stateCrossProduct = stateValues.data() + 2 * nFeatures;
+
+    CpuAlgorithmFPType nObservations = 0.0;
+    readTable(nObservationsTable, &nObservations);
+    std::vector<CpuAlgorithmFPType> sums(nFeatures);
+    readTable(sumTable, sums.data());
+
+    const CpuAlgorithmFPType totalObservations =
+        nObservations + stateObservations;
+    std::vector<CpuAlgorithmFPType> mean(nFeatures, 0.0);
+    if (totalObservations > 0)
+        for (size_t j = 0; j < nFeatures; j++)
+            mean[j] = (sums[j] + stateSums[j]) / totalObservations;
+
+    // Both cross-products are centered at the merged mean and added
+    shiftCrossProduct(stateCrossProduct, stateSums, stateObservations,
+                      mean.data(), nFeatures);
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    crossProductTable->getBlockOfRows(0, nFeatures, readWrite, block);
+    CpuAlgorithmFPType *crossProduct = block.getBlockPtr();
+    shiftCrossProduct(crossProduct, sums.data(), nObservations, mean.data(),
+                      nFeatures);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nFeatures * nFeatures),
+                      [&](const tbb::blocked_range<size_t> &r) {
+                          for (size_t i = r.begin(); i < r.end(); i++)
+                              crossProduct[i] += stateCrossProduct[i];
+                      });
+    crossProductTable->releaseBlockOfRows(block);
+
+    for (size_t j = 0; j < nFeatures; j++)
+        sums[j] += stateSums[j];
+    writeTable(nObservationsTable, &totalObservations);
+    writeTable(sumTable, sums.data());
+}
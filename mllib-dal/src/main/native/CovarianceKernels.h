@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+
+#pragma once
+
+#include <oneapi/ccl.hpp>
+
+#include "service.h"
+
+// Add n (m_local - m)(m_local - m)^T to crossProduct (d x d), the
+// cross-product of n observations centered at their mean m_local = sums / n,
+// so it becomes centered at mean m instead
+void shiftCrossProduct(CpuAlgorithmFPType *crossProduct,
+                       const CpuAlgorithmFPType *sums,
+                       CpuAlgorithmFPType nObservations,
+                       const CpuAlgorithmFPType *mean, size_t nFeatures);
+
+/*
+ * Merge the covariance partial results (observation count, sums and
+ * cross-product centered at the local mean) of all ranks with collectives on
+ * the raw buffers instead of gathering serialized partial results. The counts
+ * and sums are allreduced first and every rank shifts its cross-product to the
+ * global mean, so the shifted cross-products add up exactly and one reduce of
+ * d x d values to the root merges them. Returns the merged partial result on
+ * the root, ready to be finalized there, and an empty pointer on other ranks.
+ * The local cross-product is shifted in place.
+ */
+daal::algorithms::covariance::PartialResultPtr reduceCovariancePartialResults(
+    ccl::communicator &comm,
+    const daal::algorithms::covariance::PartialResultPtr &partialResult);
+
+/*
+ * Covariance state of the observations merged into partialResult, as a new
+ * table of d + 2 rows of d values: the observation count as the first value of
+ * the first row, then the sums and the cross-product centered at the mean.
+ * States of disjoint data merge exactly, so the state can be saved and later
+ * fits only need to add the new data to it.
+ */
+NumericTablePtr getCovarianceState(
+    const daal::algorithms::covariance::PartialResultPtr &partialResult);
+
+// Merge a covariance state of other observations into partialResult, whose
+// tables are updated in place
+void addCovarianceState(
+    const daal::algorithms::covariance::PartialResultPtr &partialResult,
+    const NumericTablePtr &state);
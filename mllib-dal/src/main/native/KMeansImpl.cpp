@@ -15,14 +15,20 @@
  *******************************************************************************/
 
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
 
 #ifdef CPU_GPU_PROFILE
 #include "Common.hpp"
 #include "oneapi/dal/algo/kmeans.hpp"
 #endif
 
+#include "KMeansKernels.h"
 #include "Logger.h"
 #include "OneCCL.h"
 #include "com_intel_oap_mllib_clustering_KMeansDALImpl.h"
@@ -36,181 +42,383 @@ using namespace daal;
 using namespace daal::services;
 namespace kmeans_cpu = daal::algorithms::kmeans;
 
-static NumericTablePtr kmeans_compute(size_t rankId, ccl::communicator &comm,
-                                      const NumericTablePtr &pData,
-                                      const NumericTablePtr &initialCentroids,
-                                      size_t nClusters, size_t nBlocks,
-                                      CpuAlgorithmFPType &ret_cost) {
-    const bool isRoot = (rankId == ccl_root);
-    size_t CentroidsArchLength = 0;
-    InputDataArchive inputArch;
-    if (isRoot) {
-        /* Retrieve the algorithm results and serialize them */
-        initialCentroids->serialize(inputArch);
-        CentroidsArchLength = inputArch.getSizeOfArchive();
-    }
-
-    /* Get partial results from the root node */
-    ccl::broadcast(&CentroidsArchLength, sizeof(size_t), ccl::datatype::uint8,
-                   ccl_root, comm)
-        .wait();
-
-    ByteBuffer nodeCentroids(CentroidsArchLength);
-    if (isRoot)
-        inputArch.copyArchiveToArray(&nodeCentroids[0], CentroidsArchLength);
-
-    ccl::broadcast(&nodeCentroids[0], CentroidsArchLength, ccl::datatype::uint8,
-                   ccl_root, comm)
-        .wait();
+// Use the bounded local step from this number of clusters in "auto" mode
+static const size_t hamerlyMinClusters = 128;
 
-    /* Deserialize centroids data */
-    OutputDataArchive outArch(nodeCentroids.size() ? &nodeCentroids[0] : NULL,
-                              CentroidsArchLength);
+// Evaluate the full objective every this number of mini-batch iterations
+static const int miniBatchObjectiveInterval = 10;
 
-    NumericTablePtr centroids(new HomogenNumericTable<CpuAlgorithmFPType>());
+// Leading bytes of a centroids checkpoint file
+static const char checkpointMagic[8] = {'O', 'A', 'P', 'K', 'M', 'C', 'K', '1'};
 
-    centroids->deserialize(outArch);
+/*
+ * Local step of one k-means iteration. Rows of pData are assigned to the
+ * nearest of the given centroids and the per-cluster sums, counts and the
+ * objective are packed into partials as [sums (k x p) | counts (k) |
+ * objective (1)], so that one allreduce combines everything the update needs.
+ */
+template <kmeans_cpu::Method method>
+static void computeLocalPartials(const NumericTablePtr &pData,
+                                 CpuAlgorithmFPType *centroids,
+                                 size_t nClusters, size_t nFeatures,
+                                 std::vector<CpuAlgorithmFPType> &partials) {
+    /* Wrap the centroids buffer without copying it */
+    NumericTablePtr centroidsTable =
+        HomogenNumericTable<CpuAlgorithmFPType>::create(centroids, nFeatures,
+                                                        nClusters);
 
     /* Create an algorithm to compute k-means on local nodes */
-    kmeans_cpu::Distributed<step1Local, CpuAlgorithmFPType> localAlgorithm(
-        nClusters);
+    kmeans_cpu::Distributed<step1Local, CpuAlgorithmFPType, method>
+        localAlgorithm(nClusters);
 
     /* Set the input data set to the algorithm */
     localAlgorithm.input.set(kmeans_cpu::data, pData);
-    localAlgorithm.input.set(kmeans_cpu::inputCentroids, centroids);
+    localAlgorithm.input.set(kmeans_cpu::inputCentroids, centroidsTable);
 
     /* Compute k-means */
     localAlgorithm.compute();
 
-    /* Serialize partial results required by step 2 */
-    InputDataArchive dataArch;
-    localAlgorithm.getPartialResult()->serialize(dataArch);
-    size_t perNodeArchLength = dataArch.getSizeOfArchive();
-    ByteBuffer serializedData;
-
-    /* Serialized data is of equal size on each node if each node called
-     * compute() equal number of times */
-    vector<size_t> recvCounts(nBlocks);
-    for (size_t i = 0; i < nBlocks; i++) {
-        recvCounts[i] = perNodeArchLength;
-    }
-    serializedData.resize(perNodeArchLength * nBlocks);
-
-    ByteBuffer nodeResults(perNodeArchLength);
-    dataArch.copyArchiveToArray(&nodeResults[0], perNodeArchLength);
+    kmeans_cpu::PartialResultPtr partialResult =
+        localAlgorithm.getPartialResult();
+
+    CpuAlgorithmFPType *sums = partials.data();
+    CpuAlgorithmFPType *counts = sums + nClusters * nFeatures;
+    CpuAlgorithmFPType *objective = counts + nClusters;
+
+    NumericTablePtr partialSums = partialResult->get(kmeans_cpu::partialSums);
+    BlockDescriptor<CpuAlgorithmFPType> blockSums;
+    partialSums->getBlockOfRows(0, nClusters, readOnly, blockSums);
+    std::copy(blockSums.getBlockPtr(),
+              blockSums.getBlockPtr() + nClusters * nFeatures, sums);
+    partialSums->releaseBlockOfRows(blockSums);
+
+    NumericTablePtr nObservations =
+        partialResult->get(kmeans_cpu::nObservations);
+    BlockDescriptor<CpuAlgorithmFPType> blockCounts;
+    nObservations->getBlockOfRows(0, nClusters, readOnly, blockCounts);
+    std::copy(blockCounts.getBlockPtr(), blockCounts.getBlockPtr() + nClusters,
+              counts);
+    nObservations->releaseBlockOfRows(blockCounts);
+
+    NumericTablePtr partialObjective =
+        partialResult->get(kmeans_cpu::partialObjectiveFunction);
+    *objective = partialObjective->getValue<CpuAlgorithmFPType>(0, 0);
+}
 
-    /* Transfer partial results to step 2 on the root node */
-    ccl::allgatherv(&nodeResults[0], perNodeArchLength, &serializedData[0],
-                    recvCounts, ccl::datatype::uint8, comm)
+/*
+ * One k-means iteration. Partial sums, counts and the objective of all ranks
+ * are combined with a single allreduce, then every rank computes the same new
+ * centroids, so nothing has to be serialized, gathered or broadcast.
+ * Clusters that received no points keep their previous centroid. The local
+ * step is done by hamerly if given, otherwise by oneDAL with the lloydCSR
+ * method for CSR data. For cosine distance rows are unit length and centroids
+ * are scaled to unit length (spherical k-means), oneDAL then assigns rows as
+ * cosine does and its objective is twice the cosine cost.
+ */
+static void kmeans_compute(ccl::communicator &comm, const NumericTablePtr &pData,
+                           const std::vector<CpuAlgorithmFPType> &centroids,
+                           std::vector<CpuAlgorithmFPType> &newCentroids,
+                           std::vector<CpuAlgorithmFPType> &partials,
+                           size_t nClusters, size_t nFeatures,
+                           HamerlyLocalStep *hamerly, bool cosine, bool csr,
+                           CpuAlgorithmFPType &ret_cost) {
+    CpuAlgorithmFPType *centroidsPtr =
+        const_cast<CpuAlgorithmFPType *>(centroids.data());
+    if (csr)
+        computeLocalPartials<kmeans_cpu::lloydCSR>(
+            pData, centroidsPtr, nClusters, nFeatures, partials);
+    else if (cosine)
+        computeCosinePartials(pData, centroids, partials);
+    else if (hamerly)
+        hamerly->computePartials(centroids, partials);
+    else
+        computeLocalPartials<kmeans_cpu::lloydDense>(
+            pData, centroidsPtr, nClusters, nFeatures, partials);
+
+    ccl::allreduce(partials.data(), partials.data(), partials.size(),
+                   ccl::reduction::sum, comm)
         .wait();
 
-    if (isRoot) {
-        /* Create an algorithm to compute k-means on the master node */
-        kmeans_cpu::Distributed<step2Master, CpuAlgorithmFPType>
-            masterAlgorithm(nClusters);
-
-        for (size_t i = 0; i < nBlocks; i++) {
-            /* Deserialize partial results from step 1 */
-            OutputDataArchive dataArch(&serializedData[perNodeArchLength * i],
-                                       perNodeArchLength);
-
-            kmeans_cpu::PartialResultPtr dataForStep2FromStep1(
-                new kmeans_cpu::PartialResult());
-            dataForStep2FromStep1->deserialize(dataArch);
-
-            /* Set local partial results as input for the master-node algorithm
-             */
-            masterAlgorithm.input.add(kmeans_cpu::partialResults,
-                                      dataForStep2FromStep1);
+    const CpuAlgorithmFPType *sums = partials.data();
+    const CpuAlgorithmFPType *counts = sums + nClusters * nFeatures;
+    const CpuAlgorithmFPType *objective = counts + nClusters;
+
+    for (size_t i = 0; i < nClusters; i++) {
+        const CpuAlgorithmFPType *oldCenter = &centroids[i * nFeatures];
+        CpuAlgorithmFPType *newCenter = &newCentroids[i * nFeatures];
+        if (counts[i] > 0) {
+            for (size_t j = 0; j < nFeatures; j++)
+                newCenter[j] = sums[i * nFeatures + j] / counts[i];
+        } else {
+            std::copy(oldCenter, oldCenter + nFeatures, newCenter);
         }
+    }
+    if (cosine)
+        normalizeCentroids(newCentroids, nFeatures);
 
-        /* Merge and finalizeCompute k-means on the master node */
-        masterAlgorithm.compute();
-        masterAlgorithm.finalizeCompute();
-
-        ret_cost = masterAlgorithm.getResult()
-                       ->get(kmeans_cpu::objectiveFunction)
-                       ->getValue<CpuAlgorithmFPType>(0, 0);
+    ret_cost = cosine && csr ? *objective / 2 : *objective;
+}
 
-        /* Retrieve the algorithm results */
-        return masterAlgorithm.getResult()->get(kmeans_cpu::centroids);
+/*
+ * Largest distance a centroid moved between oldCenters and newCenters. As in
+ * Spark the distance is Euclidean, or the cosine distance 1 - cos(old, new)
+ * for cosine training, where centroids are unit length.
+ */
+static CpuAlgorithmFPType
+maxCentroidShift(const std::vector<CpuAlgorithmFPType> &oldCenters,
+                 const std::vector<CpuAlgorithmFPType> &newCenters,
+                 size_t nClusters, size_t nFeatures, bool cosine) {
+    CpuAlgorithmFPType maxShift = 0.0;
+    for (size_t i = 0; i < nClusters; i++) {
+        CpuAlgorithmFPType sums = 0.0;
+        for (size_t j = 0; j < nFeatures; j++) {
+            if (cosine) {
+                sums += newCenters[i * nFeatures + j] *
+                        oldCenters[i * nFeatures + j];
+            } else {
+                CpuAlgorithmFPType diff = newCenters[i * nFeatures + j] -
+                                          oldCenters[i * nFeatures + j];
+                sums += diff * diff;
+            }
+        }
+        maxShift = std::max(maxShift, cosine ? 1.0 - sums : sums);
     }
-    return NumericTablePtr();
+
+    return cosine ? maxShift : std::sqrt(maxShift);
 }
 
-static bool isCenterConverged(const CpuAlgorithmFPType *oldCenter,
-                              const CpuAlgorithmFPType *newCenter, size_t dim,
-                              double tolerance) {
+/*
+ * Training trace written to direct buffers of the caller, any of them may be
+ * null. objectives and maxShifts have an entry for each of the maximum number
+ * of iterations, iterations which are not run or have no value are NaN.
+ * Cluster sizes are the counts of the rows assigned to the final centroids.
+ */
+struct KMeansTrace {
+    jlong *clusterSizes;
+    CpuAlgorithmFPType *objectives;
+    CpuAlgorithmFPType *maxShifts;
+
+    void init(int iterationNum) const {
+        const CpuAlgorithmFPType nan =
+            std::numeric_limits<CpuAlgorithmFPType>::quiet_NaN();
+        if (objectives != nullptr)
+            std::fill(objectives, objectives + iterationNum, nan);
+        if (maxShifts != nullptr)
+            std::fill(maxShifts, maxShifts + iterationNum, nan);
+    }
 
-    CpuAlgorithmFPType sums = 0.0;
+    void record(int iteration, CpuAlgorithmFPType objective,
+                CpuAlgorithmFPType maxShift) const {
+        if (objectives != nullptr)
+            objectives[iteration] = objective;
+        if (maxShifts != nullptr)
+            maxShifts[iteration] = maxShift;
+    }
 
-    for (size_t i = 0; i < dim; i++)
-        sums += (newCenter[i] - oldCenter[i]) * (newCenter[i] - oldCenter[i]);
+    void recordSizes(const CpuAlgorithmFPType *counts,
+                     size_t nClusters) const {
+        if (clusterSizes != nullptr)
+            for (size_t i = 0; i < nClusters; i++)
+                clusterSizes[i] = (jlong)counts[i];
+    }
+};
 
-    return sums <= tolerance * tolerance;
+static std::string jstringToString(JNIEnv *env, jstring str) {
+    const char *chars = env->GetStringUTFChars(str, nullptr);
+    std::string ret(chars);
+    env->ReleaseStringUTFChars(str, chars);
+    return ret;
 }
 
-static bool areAllCentersConverged(const NumericTablePtr &oldCenters,
-                                   const NumericTablePtr &newCenters,
-                                   double tolerance) {
-    size_t rows = oldCenters->getNumberOfRows();
-    size_t cols = oldCenters->getNumberOfColumns();
-
-    BlockDescriptor<CpuAlgorithmFPType> blockOldCenters;
-    oldCenters->getBlockOfRows(0, rows, readOnly, blockOldCenters);
-    CpuAlgorithmFPType *arrayOldCenters = blockOldCenters.getBlockPtr();
-
-    BlockDescriptor<CpuAlgorithmFPType> blockNewCenters;
-    newCenters->getBlockOfRows(0, rows, readOnly, blockNewCenters);
-    CpuAlgorithmFPType *arrayNewCenters = blockNewCenters.getBlockPtr();
+/*
+ * Write the centroids and the number of finished iterations to path as
+ * [magic | nClusters | nFeatures | iteration | centroids]. The file is written
+ * next to path and renamed, so a crash never leaves a partial checkpoint.
+ */
+static void saveCheckpoint(const std::string &path,
+                           const CentroidsBuffer &centroids, size_t nFeatures,
+                           int iteration) {
+    const std::string tmpPath = path + ".tmp";
+    const uint64_t header[3] = {centroids.size() / nFeatures, nFeatures,
+                                (uint64_t)iteration};
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    out.write(checkpointMagic, sizeof(checkpointMagic));
+    out.write((const char *)header, sizeof(header));
+    out.write((const char *)centroids.data(),
+              centroids.size() * sizeof(CpuAlgorithmFPType));
+    out.close();
+    if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        logger::println(logger::WARN,
+                        "KMeans (native): failed to write checkpoint %s",
+                        path.c_str());
+        std::remove(tmpPath.c_str());
+        return;
+    }
+    logger::println(logger::INFO,
+                    "KMeans (native): checkpoint of iteration %d saved to %s",
+                    iteration, path.c_str());
+}
 
-    for (size_t i = 0; i < rows; i++) {
-        if (!isCenterConverged(&arrayOldCenters[i * cols],
-                               &arrayNewCenters[i * cols], cols, tolerance))
-            return false;
+/*
+ * Read the checkpoint at path on the root rank and broadcast it to all ranks.
+ * Returns the number of finished iterations and sets centroids, or returns -1
+ * if there is no valid checkpoint of nClusters x nFeatures centroids.
+ */
+static int loadCheckpoint(ccl::communicator &comm, size_t rankId,
+                          const std::string &path, size_t nClusters,
+                          size_t nFeatures, CentroidsBuffer &centroids) {
+    centroids.resize(nClusters * nFeatures);
+    // [iteration, found]
+    std::vector<CpuAlgorithmFPType> status(2, 0.0);
+    if (rankId == ccl_root) {
+        char magic[sizeof(checkpointMagic)];
+        uint64_t header[3];
+        std::ifstream in(path, std::ios::binary);
+        in.read(magic, sizeof(magic));
+        in.read((char *)header, sizeof(header));
+        if (in && std::equal(magic, magic + sizeof(magic), checkpointMagic) &&
+            header[0] == nClusters && header[1] == nFeatures) {
+            in.read((char *)centroids.data(),
+                    centroids.size() * sizeof(CpuAlgorithmFPType));
+            if (in)
+                status = {(CpuAlgorithmFPType)header[2], 1.0};
+        }
+        if (in.is_open() && status[1] == 0.0)
+            logger::println(logger::WARN,
+                            "KMeans (native): ignore checkpoint %s, it is not "
+                            "a checkpoint of %zu x %zu centroids",
+                            path.c_str(), nClusters, nFeatures);
     }
 
-    return true;
+    ccl::broadcast(status.data(), status.size(), ccl_root, comm).wait();
+    if (status[1] == 0.0)
+        return -1;
+    ccl::broadcast(centroids.data(), centroids.size(), ccl_root, comm).wait();
+    return (int)status[0];
+}
+
+// Set iteration num and cost of resultObj and return the centroids as table
+static jlong saveKMeansResult(JNIEnv *env, jobject resultObj,
+                              const CentroidsBuffer &centroids,
+                              size_t nFeatures, int iterationNum,
+                              CpuAlgorithmFPType totalCost) {
+    const size_t nClusters = centroids.size() / nFeatures;
+
+    // Get the class of the input object
+    jclass clazz = env->GetObjectClass(resultObj);
+    // Get Field references
+    jfieldID totalCostField = env->GetFieldID(clazz, "totalCost", "D");
+    jfieldID iterationNumField = env->GetFieldID(clazz, "iterationNum", "I");
+
+    // Set iteration num for result
+    env->SetIntField(resultObj, iterationNumField, iterationNum);
+    // Set cost for result
+    env->SetDoubleField(resultObj, totalCostField, totalCost);
+
+    NumericTablePtr resultCentroids =
+        HomogenNumericTable<CpuAlgorithmFPType>::create(
+            nFeatures, nClusters, NumericTable::doAllocate);
+    BlockDescriptor<CpuAlgorithmFPType> blockResult;
+    resultCentroids->getBlockOfRows(0, nClusters, writeOnly, blockResult);
+    std::copy(centroids.begin(), centroids.end(), blockResult.getBlockPtr());
+    resultCentroids->releaseBlockOfRows(blockResult);
+
+    NumericTablePtr *ret = new NumericTablePtr(resultCentroids);
+    return (jlong)ret;
 }
 
 static jlong doKMeansDaalCompute(JNIEnv *env, jobject obj, size_t rankId,
                                  ccl::communicator &comm,
                                  NumericTablePtr &pData,
-                                 NumericTablePtr &centroids, jint cluster_num,
-                                 jdouble tolerance, jint iteration_num,
-                                 jint executor_num, jobject resultObj) {
+                                 CentroidsBuffer &centroids, jdouble tolerance,
+                                 jint iteration_num,
+                                 const std::string &localStep, bool cosine,
+                                 int startIteration,
+                                 const std::string &checkpointPath,
+                                 int checkpointInterval,
+                                 const KMeansTrace &trace, jobject resultObj) {
     logger::println(logger::INFO, "OneDAL (native): CPU compute start");
     CpuAlgorithmFPType totalCost;
 
-    NumericTablePtr newCentroids;
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t nClusters = centroids.size() / nFeatures;
+
+    /* Centroids are kept as raw row-major k x p buffers on every rank */
+    CentroidsBuffer newCentroids(nClusters * nFeatures);
+    std::vector<CpuAlgorithmFPType> partials(nClusters * nFeatures + nClusters +
+                                             1);
+
+    // Kernels other than oneDAL read rows as dense blocks
+    const bool csr =
+        pData->getDataLayout() == NumericTable::StorageLayout::csrArray;
+
+    std::unique_ptr<HamerlyLocalStep> hamerly;
+    const char *localStepName = "oneDAL";
+    if (csr) {
+        localStepName = "oneDAL CSR";
+    } else if (cosine) {
+        localStepName = "cosine";
+    } else if (localStep == "hamerly" ||
+               (localStep == "auto" && nClusters >= hamerlyMinClusters)) {
+        hamerly.reset(new HamerlyLocalStep(pData, nClusters));
+        localStepName = "hamerly";
+    }
+    logger::println(logger::INFO, "KMeans (native): %s local step",
+                    localStepName);
+
+    if (cosine)
+        normalizeCentroids(centroids, nFeatures);
+
+    const bool checkpoint = !checkpointPath.empty() && checkpointInterval > 0;
     bool converged = false;
+    trace.init(iteration_num);
 
     int it = 0;
-    for (it = 0; it < iteration_num && !converged; it++) {
+    for (it = startIteration; it < iteration_num && !converged; it++) {
         auto t1 = std::chrono::high_resolution_clock::now();
 
-        newCentroids = kmeans_compute(rankId, comm, pData, centroids,
-                                      cluster_num, executor_num, totalCost);
+        kmeans_compute(comm, pData, centroids, newCentroids, partials,
+                       nClusters, nFeatures, hamerly.get(), cosine, csr,
+                       totalCost);
 
-        if (rankId == ccl_root) {
-            converged =
-                areAllCentersConverged(centroids, newCentroids, tolerance);
-        }
+        // All ranks hold the same centroids, no need to sync converged status
+        CpuAlgorithmFPType maxShift = maxCentroidShift(
+            centroids, newCentroids, nClusters, nFeatures, cosine);
+        converged = maxShift <= tolerance;
+        trace.record(it, totalCost, maxShift);
 
-        // Sync converged status
-        ccl::broadcast(&converged, 1, ccl::datatype::uint8, ccl_root, comm)
-            .wait();
+        centroids.swap(newCentroids);
 
-        centroids = newCentroids;
+        // Only the root rank writes, all ranks hold the same centroids
+        if (checkpoint && rankId == ccl_root && !converged &&
+            (it + 1) % checkpointInterval == 0 && it + 1 < iteration_num)
+            saveCheckpoint(checkpointPath, centroids, nFeatures, it + 1);
 
         auto t2 = std::chrono::high_resolution_clock::now();
         float duration = std::chrono::duration<float>(t2 - t1).count();
         logger::println(logger::INFO,
-                        "KMeans (native): iteration %d took %d secs", it,
+                        "KMeans (native): iteration %d took %f secs", it,
                         duration);
     }
 
+    // Counts of the last iteration belong to the centroids before its update,
+    // so the rows are assigned once more to the final centroids if they moved,
+    // newCentroids holds the centroids before the last update after the swap
+    if (it > startIteration && trace.clusterSizes != nullptr) {
+        if (newCentroids != centroids) {
+            CpuAlgorithmFPType finalCost;
+            kmeans_compute(comm, pData, centroids, newCentroids, partials,
+                           nClusters, nFeatures, hamerly.get(), cosine, csr,
+                           finalCost);
+        }
+        trace.recordSizes(&partials[nClusters * nFeatures], nClusters);
+    }
+
     if (rankId == ccl_root) {
+        // The training finished, a later run must not resume from it
+        if (checkpoint)
+            std::remove(checkpointPath.c_str());
+
         if (it == iteration_num)
             logger::println(logger::INFO,
                             "KMeans (native): reached %d max iterations.",
@@ -218,22 +426,131 @@ static jlong doKMeansDaalCompute(JNIEnv *env, jobject obj, size_t rankId,
         else
             logger::println(logger::INFO,
                             "KMeans (native): converged in %d iterations.",
-                            iteration_num);
+                            it);
 
-        // Get the class of the input object
-        jclass clazz = env->GetObjectClass(resultObj);
-        // Get Field references
-        jfieldID totalCostField = env->GetFieldID(clazz, "totalCost", "D");
-        jfieldID iterationNumField =
-            env->GetFieldID(clazz, "iterationNum", "I");
+        return saveKMeansResult(env, resultObj, centroids, nFeatures, it,
+                                totalCost);
+    } else {
+        return (jlong)0;
+    }
+}
 
-        // Set iteration num for result
-        env->SetIntField(resultObj, iterationNumField, it);
-        // Set cost for result
-        env->SetDoubleField(resultObj, totalCostField, totalCost);
+/*
+ * Mini-batch k-means. Every iteration each rank assigns batchSize rows
+ * sampled from its partition, the batch sums and counts are allreduced and
+ * every center moves towards the mean of its batch rows with a learning rate
+ * of batch count / all rows assigned to it so far. The full objective is
+ * evaluated every miniBatchObjectiveInterval iterations and, as in the full
+ * training, tolerance bounds the centroid shift: the training stops when no
+ * centroid moved more than tolerance since the previous evaluation, a window
+ * of iterations as the shift of a single batch is noisy. For cosine
+ * distance centroids are kept unit length, so the Euclidean assignment of
+ * the unit length rows is the cosine one and the cost is half the objective,
+ * the shift is then measured by cosine distance.
+ */
+static jlong doKMeansMiniBatchCompute(JNIEnv *env, jobject obj, size_t rankId,
+                                      ccl::communicator &comm,
+                                      NumericTablePtr &pData,
+                                      CentroidsBuffer &centroids,
+                                      jdouble tolerance, jint iteration_num,
+                                      jint batchSize, jlong batchSeed,
+                                      bool cosine, const KMeansTrace &trace,
+                                      jobject resultObj) {
+    logger::println(logger::INFO,
+                    "OneDAL (native): CPU mini-batch compute start");
+
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t nClusters = centroids.size() / nFeatures;
+
+    std::vector<CpuAlgorithmFPType> partials(nClusters * nFeatures + nClusters +
+                                             1);
+    std::vector<CpuAlgorithmFPType> assignedCounts(nClusters, 0.0);
+    CentroidsBuffer lastCentroids(centroids.size());
+    std::vector<CpuAlgorithmFPType> stats;
+    // Each rank samples its own rows
+    std::mt19937_64 rng(batchSeed + rankId);
+    if (cosine)
+        normalizeCentroids(centroids, nFeatures);
+    // Centroids at the previous objective evaluation
+    CentroidsBuffer evaluatedCentroids = centroids;
+
+    CpuAlgorithmFPType totalCost = std::numeric_limits<double>::max();
+    bool converged = false;
+    trace.init(iteration_num);
+
+    int it = 0;
+    for (it = 0; it < iteration_num && !converged; it++) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        lastCentroids = centroids;
+        computeBatchPartials(pData, centroids, batchSize, rng, partials);
+        ccl::allreduce(partials.data(), partials.data(), partials.size(),
+                       ccl::reduction::sum, comm)
+            .wait();
+
+        const CpuAlgorithmFPType *sums = partials.data();
+        const CpuAlgorithmFPType *counts = sums + nClusters * nFeatures;
+        for (size_t i = 0; i < nClusters; i++) {
+            if (counts[i] == 0)
+                continue;
+            assignedCounts[i] += counts[i];
+            CpuAlgorithmFPType rate = counts[i] / assignedCounts[i];
+            for (size_t j = 0; j < nFeatures; j++) {
+                CpuAlgorithmFPType &center = centroids[i * nFeatures + j];
+                center += rate * (sums[i * nFeatures + j] / counts[i] - center);
+            }
+        }
+        if (cosine)
+            normalizeCentroids(centroids, nFeatures);
+
+        CpuAlgorithmFPType maxShift =
+            maxCentroidShift(lastCentroids, centroids, nClusters, nFeatures,
+                             cosine);
+        CpuAlgorithmFPType objective =
+            std::numeric_limits<CpuAlgorithmFPType>::quiet_NaN();
+
+        if ((it + 1) % miniBatchObjectiveInterval == 0 ||
+            it + 1 == iteration_num) {
+            // Sizes of the last evaluation are the sizes of the final centers
+            computeCountsAndObjective(pData, centroids, stats);
+            ccl::allreduce(stats.data(), stats.data(), stats.size(),
+                           ccl::reduction::sum, comm)
+                .wait();
+            trace.recordSizes(stats.data(), nClusters);
+            CpuAlgorithmFPType cost =
+                cosine ? stats[nClusters] / 2 : stats[nClusters];
+            converged =
+                maxCentroidShift(evaluatedCentroids, centroids, nClusters,
+                                 nFeatures, cosine) <= tolerance;
+            evaluatedCentroids = centroids;
+            totalCost = cost;
+            objective = cost;
+            logger::println(logger::INFO,
+                            "KMeans (native): objective after iteration %d "
+                            "is %f",
+                            it, totalCost);
+        }
+        trace.record(it, objective, maxShift);
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        float duration = std::chrono::duration<float>(t2 - t1).count();
+        logger::println(logger::INFO,
+                        "KMeans (native): iteration %d took %f secs", it,
+                        duration);
+    }
+
+    if (rankId == ccl_root) {
+        if (converged)
+            logger::println(logger::INFO,
+                            "KMeans (native): converged in %d iterations.",
+                            it);
+        else
+            logger::println(logger::INFO,
+                            "KMeans (native): reached %d max iterations.",
+                            iteration_num);
 
-        NumericTablePtr *ret = new NumericTablePtr(centroids);
-        return (jlong)ret;
+        return saveKMeansResult(env, resultObj, centroids, nFeatures, it,
+                                totalCost);
     } else {
         return (jlong)0;
     }
@@ -297,14 +614,19 @@ static jlong doKMeansOneAPICompute(
 /*
  * Class:     com_intel_oap_mllib_clustering_KMeansDALImpl
  * Method:    cKMeansOneapiComputeWithInitCenters
- * Signature: (JJIDIIILcom/intel/oap/mllib/clustering/KMeansResult;)J
+ * Signature:
+ * (IJJJJIDIIIILjava/lang/String;IJLjava/lang/String;Ljava/lang/String;IJLjava/lang/String;Ljava/lang/String;IZLjava/nio/ByteBuffer;Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;[ILcom/intel/oap/mllib/clustering/KMeansResult;)J
  */
 JNIEXPORT jlong JNICALL
 Java_com_intel_oap_mllib_clustering_KMeansDALImpl_cKMeansOneapiComputeWithInitCenters(
     JNIEnv *env, jobject obj, jint rank, jlong pNumTabData, jlong numRows,
     jlong numCols, jlong pNumTabCenters, jint clusterNum, jdouble tolerance,
     jint iterationNum, jint executorNum, jint executorCores,
-    jint computeDeviceOrdinal, jintArray gpuIdxArray, jobject resultObj) {
+    jint computeDeviceOrdinal, jstring initMode, jint initSteps, jlong seed,
+    jstring localStep, jstring mode, jint batchSize, jlong batchSeed,
+    jstring distanceMeasure, jstring checkpointPath, jint checkpointInterval,
+    jboolean warmStart, jobject clusterSizes, jobject objectives,
+    jobject maxShifts, jintArray gpuIdxArray, jobject resultObj) {
     logger::println(logger::INFO,
                     "OneDAL (native): use DPC++ kernels; device %s",
                     ComputeDeviceString[computeDeviceOrdinal].c_str());
@@ -318,7 +640,6 @@ Java_com_intel_oap_mllib_clustering_KMeansDALImpl_cKMeansOneapiComputeWithInitCe
         ccl::communicator &cclComm = getComm();
         int rankId = cclComm.rank();
         NumericTablePtr pData = *((NumericTablePtr *)pNumTabData);
-        NumericTablePtr centroids = *((NumericTablePtr *)pNumTabCenters);
         // Set number of threads for OneDAL to use for each rank
         services::Environment::getInstance()->setNumberOfThreads(executorCores);
 
@@ -327,9 +648,80 @@ Java_com_intel_oap_mllib_clustering_KMeansDALImpl_cKMeansOneapiComputeWithInitCe
         logger::println(logger::INFO,
                         "OneDAL (native): Number of CPU threads used %d",
                         nThreadsNew);
-        ret = doKMeansDaalCompute(env, obj, rankId, cclComm, pData, centroids,
-                                  clusterNum, tolerance, iterationNum,
-                                  executorNum, resultObj);
+
+        // Batch rows of CSR tables are read densified one at a time
+        const bool miniBatch = jstringToString(env, mode) == "minibatch";
+        // Checkpoints are only taken by the full training
+        const std::string checkpointFile =
+            miniBatch ? std::string() : jstringToString(env, checkpointPath);
+
+        CentroidsBuffer centroids;
+        int startIteration = -1;
+        if (!checkpointFile.empty() && warmStart)
+            startIteration =
+                loadCheckpoint(cclComm, rankId, checkpointFile, clusterNum,
+                               pData->getNumberOfColumns(), centroids);
+        if (startIteration >= iterationNum)
+            startIteration = -1;
+
+        if (startIteration >= 0) {
+            logger::println(logger::INFO,
+                            "KMeans (native): resume from checkpoint %s at "
+                            "iteration %d",
+                            checkpointFile.c_str(), startIteration);
+        } else if (pNumTabCenters != 0) {
+            // Initial centers are computed by Spark and passed by the driver
+            NumericTablePtr initialCentroids =
+                *((NumericTablePtr *)pNumTabCenters);
+            BlockDescriptor<CpuAlgorithmFPType> block;
+            initialCentroids->getBlockOfRows(0, clusterNum, readOnly, block);
+            centroids.assign(block.getBlockPtr(),
+                             block.getBlockPtr() +
+                                 clusterNum * pData->getNumberOfColumns());
+            initialCentroids->releaseBlockOfRows(block);
+        } else {
+            // Initialize centers natively on the distributed data
+            std::string initModeName = jstringToString(env, initMode);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            if (initModeName == "random")
+                centroids =
+                    initCentroidsRandom(cclComm, pData, clusterNum, seed);
+            else
+                centroids = initCentroidsParallel(cclComm, pData, clusterNum,
+                                                  initSteps, seed);
+            auto t2 = std::chrono::high_resolution_clock::now();
+            float duration = std::chrono::duration<float>(t2 - t1).count();
+            logger::println(logger::INFO,
+                            "KMeans (native): %s initialization took %f secs",
+                            initModeName.c_str(), duration);
+            if (centroids.empty()) {
+                logger::printerrln(logger::ERROR,
+                                   "KMeans (native): no rows to train on");
+                break;
+            }
+        }
+
+        // Rows are already scaled to unit length for cosine distance
+        bool cosine = jstringToString(env, distanceMeasure) == "cosine";
+        // Trace is written to direct buffers, each of them may be skipped
+        auto bufferAddress = [env](jobject buffer) {
+            return buffer == nullptr ? nullptr
+                                     : env->GetDirectBufferAddress(buffer);
+        };
+        KMeansTrace trace = {
+            (jlong *)bufferAddress(clusterSizes),
+            (CpuAlgorithmFPType *)bufferAddress(objectives),
+            (CpuAlgorithmFPType *)bufferAddress(maxShifts)};
+        if (miniBatch)
+            ret = doKMeansMiniBatchCompute(
+                env, obj, rankId, cclComm, pData, centroids, tolerance,
+                iterationNum, batchSize, batchSeed, cosine, trace, resultObj);
+        else
+            ret = doKMeansDaalCompute(
+                env, obj, rankId, cclComm, pData, centroids, tolerance,
+                iterationNum, jstringToString(env, localStep), cosine,
+                std::max(startIteration, 0), checkpointFile,
+                checkpointInterval, trace, resultObj);
         break;
     }
 #ifdef CPU_GPU_PROFILE
@@ -352,3 +744,44 @@ Java_com_intel_oap_mllib_clustering_KMeansDALImpl_cKMeansOneapiComputeWithInitCe
     }
     return ret;
 }
+
+/*
+ * Class:     com_intel_oap_mllib_clustering_KMeansDALImpl
+ * Method:    cKMeansPredict
+ * Signature: (JJILjava/lang/String;Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_intel_oap_mllib_clustering_KMeansDALImpl_cKMeansPredict(
+    JNIEnv *env, jobject obj, jlong pNumTabData, jlong pNumTabCenters,
+    jint executorCores, jstring distanceMeasure, jobject clusterIndices,
+    jobject distances) {
+    NumericTablePtr pData = *((NumericTablePtr *)pNumTabData);
+    NumericTablePtr centersTable = *((NumericTablePtr *)pNumTabCenters);
+    const size_t nClusters = centersTable->getNumberOfRows();
+    const size_t nFeatures = centersTable->getNumberOfColumns();
+
+    services::Environment::getInstance()->setNumberOfThreads(executorCores);
+
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    centersTable->getBlockOfRows(0, nClusters, readOnly, block);
+    CentroidsBuffer centroids(block.getBlockPtr(),
+                              block.getBlockPtr() + nClusters * nFeatures);
+    centersTable->releaseBlockOfRows(block);
+
+    // Results are written to direct buffers, distances may be skipped
+    jint *indices = (jint *)env->GetDirectBufferAddress(clusterIndices);
+    CpuAlgorithmFPType *distancesPtr =
+        distances == nullptr
+            ? nullptr
+            : (CpuAlgorithmFPType *)env->GetDirectBufferAddress(distances);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    assignToCentroids(pData, centroids,
+                      jstringToString(env, distanceMeasure) == "cosine",
+                      indices, distancesPtr);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    float duration = std::chrono::duration<float>(t2 - t1).count();
+    logger::println(logger::INFO,
+                    "KMeans (native): predict of %zu rows took %f secs",
+                    pData->getNumberOfRows(), duration);
+}
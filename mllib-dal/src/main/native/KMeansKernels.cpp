@@ -0,0 +1,807 @@
+/*******************************************************************************
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <set>
+
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+
+#include "KMeansKernels.h"
+#include "Logger.h"
+
+using namespace std;
+using namespace daal;
+using namespace daal::services;
+
+// Number of rows fetched from a numeric table at a time
+static const size_t rowBlockSize = 4096;
+
+// Max values in a block of rows, bounds the dense copy oneDAL makes of the
+// rows of a CSR table in getBlockOfRows
+static const size_t rowBlockElements = 1024 * 1024;
+
+// Max iterations of the local k-means run on the k-means|| candidates
+static const size_t localKMeansMaxIterations = 30;
+
+// Coordinates of the centers scanned together by assignRows, sized to stay in
+// L2 cache while all rows of a block are compared against them
+static const size_t centerTileElements = 32 * 1024;
+
+static inline CpuAlgorithmFPType squaredDistance(const CpuAlgorithmFPType *a,
+                                                 const CpuAlgorithmFPType *b,
+                                                 size_t dim) {
+    CpuAlgorithmFPType sum = 0.0;
+    for (size_t i = 0; i < dim; i++)
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+    return sum;
+}
+
+static inline size_t findClosest(const CpuAlgorithmFPType *point,
+                                 const CpuAlgorithmFPType *centers,
+                                 size_t nCenters, size_t dim,
+                                 CpuAlgorithmFPType &minDistance) {
+    size_t closest = 0;
+    minDistance = std::numeric_limits<CpuAlgorithmFPType>::max();
+    for (size_t i = 0; i < nCenters; i++) {
+        CpuAlgorithmFPType distance =
+            squaredDistance(point, &centers[i * dim], dim);
+        if (distance < minDistance) {
+            minDistance = distance;
+            closest = i;
+        }
+    }
+    return closest;
+}
+
+static inline CpuAlgorithmFPType dotProduct(const CpuAlgorithmFPType *a,
+                                            const CpuAlgorithmFPType *b,
+                                            size_t dim) {
+    CpuAlgorithmFPType sum = 0.0;
+    for (size_t i = 0; i < dim; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+/*
+ * Assign each of nRows rows to the center j with the largest score
+ * rows[i] . centers[j] - halfNorms[j], halfNorms may be null for zeros. With
+ * halfNorms[j] = |centers[j]|^2 / 2 that is the closest center in Euclidean
+ * distance, as |x - c|^2 = |x|^2 - 2 * score. Centers are scanned in tiles
+ * that stay in cache for all rows, four centers at a time for each row.
+ */
+static void assignRows(const CpuAlgorithmFPType *rows, size_t nRows,
+                       const CpuAlgorithmFPType *centers, size_t nCenters,
+                       size_t dim, const CpuAlgorithmFPType *halfNorms,
+                       size_t *closest, CpuAlgorithmFPType *bestScores) {
+    const size_t tileSize = std::max<size_t>(4, centerTileElements / dim);
+    std::fill(bestScores, bestScores + nRows,
+              std::numeric_limits<CpuAlgorithmFPType>::lowest());
+    std::fill(closest, closest + nRows, 0);
+
+    for (size_t tile = 0; tile < nCenters; tile += tileSize) {
+        const size_t tileEnd = std::min(nCenters, tile + tileSize);
+        for (size_t i = 0; i < nRows; i++) {
+            const CpuAlgorithmFPType *x = &rows[i * dim];
+            CpuAlgorithmFPType scores[4];
+            size_t j = tile;
+            for (; j + 4 <= tileEnd; j += 4) {
+                const CpuAlgorithmFPType *c0 = &centers[j * dim];
+                const CpuAlgorithmFPType *c1 = c0 + dim;
+                const CpuAlgorithmFPType *c2 = c1 + dim;
+                const CpuAlgorithmFPType *c3 = c2 + dim;
+                CpuAlgorithmFPType d0 = 0.0, d1 = 0.0, d2 = 0.0, d3 = 0.0;
+                for (size_t f = 0; f < dim; f++) {
+                    d0 += x[f] * c0[f];
+                    d1 += x[f] * c1[f];
+                    d2 += x[f] * c2[f];
+                    d3 += x[f] * c3[f];
+                }
+                scores[0] = d0;
+                scores[1] = d1;
+                scores[2] = d2;
+                scores[3] = d3;
+                for (size_t u = 0; u < 4; u++) {
+                    if (halfNorms)
+                        scores[u] -= halfNorms[j + u];
+                    if (scores[u] > bestScores[i]) {
+                        bestScores[i] = scores[u];
+                        closest[i] = j + u;
+                    }
+                }
+            }
+            for (; j < tileEnd; j++) {
+                CpuAlgorithmFPType score =
+                    dotProduct(x, &centers[j * dim], dim);
+                if (halfNorms)
+                    score -= halfNorms[j];
+                if (score > bestScores[i]) {
+                    bestScores[i] = score;
+                    closest[i] = j;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Call func(firstRow, nRows, rows) on blocks of rows of the table in parallel.
+ * TBB threads are shared with oneDAL, so the number of threads follows
+ * services::Environment::setNumberOfThreads().
+ */
+template <typename Func>
+static void forEachRowBlock(const NumericTablePtr &table, Func func) {
+    const size_t nRows = table->getNumberOfRows();
+    const size_t nColumns = std::max<size_t>(1, table->getNumberOfColumns());
+    const size_t blockSize = std::max<size_t>(
+        1, std::min(rowBlockSize, rowBlockElements / nColumns));
+    const size_t nRowBlocks = (nRows + blockSize - 1) / blockSize;
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, nRowBlocks),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i < range.end(); i++) {
+                size_t firstRow = i * blockSize;
+                size_t blockRows = std::min(blockSize, nRows - firstRow);
+                BlockDescriptor<CpuAlgorithmFPType> block;
+                table->getBlockOfRows(firstRow, blockRows, readOnly, block);
+                func(firstRow, blockRows, block.getBlockPtr());
+                table->releaseBlockOfRows(block);
+            }
+        });
+}
+
+// Return the number of rows held by each rank
+static vector<size_t> gatherRowCounts(ccl::communicator &comm, size_t nRows) {
+    vector<size_t> rowCounts(comm.size());
+    vector<size_t> recvCounts(comm.size(), 1);
+    ccl::allgatherv(&nRows, 1, rowCounts.data(), recvCounts, comm).wait();
+    return rowCounts;
+}
+
+// Copy the given global rows to centroids, each rank fills in its own rows
+static void fetchGlobalRows(ccl::communicator &comm,
+                            const NumericTablePtr &pData,
+                            const vector<size_t> &rowCounts,
+                            const vector<size_t> &globalRows,
+                            CentroidsBuffer &centroids) {
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t rank = comm.rank();
+    const size_t firstRow =
+        std::accumulate(rowCounts.begin(), rowCounts.begin() + rank, 0UL);
+    const size_t nRows = rowCounts[rank];
+
+    centroids.assign(globalRows.size() * nFeatures, 0.0);
+    for (size_t i = 0; i < globalRows.size(); i++) {
+        if (globalRows[i] < firstRow || globalRows[i] >= firstRow + nRows)
+            continue;
+        BlockDescriptor<CpuAlgorithmFPType> block;
+        pData->getBlockOfRows(globalRows[i] - firstRow, 1, readOnly, block);
+        std::copy(block.getBlockPtr(), block.getBlockPtr() + nFeatures,
+                  &centroids[i * nFeatures]);
+        pData->releaseBlockOfRows(block);
+    }
+
+    ccl::allreduce(centroids.data(), centroids.data(), centroids.size(),
+                   ccl::reduction::sum, comm)
+        .wait();
+}
+
+CentroidsBuffer initCentroidsRandom(ccl::communicator &comm,
+                                    const NumericTablePtr &pData,
+                                    size_t nClusters, unsigned long seed) {
+    vector<size_t> rowCounts =
+        gatherRowCounts(comm, pData->getNumberOfRows());
+    const size_t totalRows =
+        std::accumulate(rowCounts.begin(), rowCounts.end(), 0UL);
+    nClusters = std::min(nClusters, totalRows);
+    if (totalRows == 0)
+        return CentroidsBuffer();
+
+    // Same seed on all ranks, so all ranks pick the same rows
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<size_t> uniform(0, totalRows - 1);
+    std::set<size_t> picked;
+    vector<size_t> globalRows;
+    while (globalRows.size() < nClusters) {
+        size_t row = uniform(rng);
+        if (picked.insert(row).second)
+            globalRows.push_back(row);
+    }
+
+    CentroidsBuffer centroids;
+    fetchGlobalRows(comm, pData, rowCounts, globalRows, centroids);
+    return centroids;
+}
+
+// Lower costs to the squared distance of the closest of the given centers
+static void updateCosts(const NumericTablePtr &pData,
+                        const CpuAlgorithmFPType *centers, size_t nCenters,
+                        size_t nFeatures, vector<CpuAlgorithmFPType> &costs) {
+    forEachRowBlock(pData, [&](size_t firstRow, size_t nRows,
+                               const CpuAlgorithmFPType *rows) {
+        for (size_t i = 0; i < nRows; i++) {
+            CpuAlgorithmFPType distance;
+            findClosest(&rows[i * nFeatures], centers, nCenters, nFeatures,
+                        distance);
+            costs[firstRow + i] = std::min(costs[firstRow + i], distance);
+        }
+    });
+}
+
+// Remove duplicated candidates, keeping the order of first occurrence
+static size_t distinctCandidates(CentroidsBuffer &candidates,
+                                 size_t nFeatures) {
+    size_t nCandidates = candidates.size() / nFeatures;
+    std::set<vector<CpuAlgorithmFPType>> seen;
+    size_t nDistinct = 0;
+    for (size_t i = 0; i < nCandidates; i++) {
+        vector<CpuAlgorithmFPType> row(candidates.data() + i * nFeatures,
+                                       candidates.data() + (i + 1) * nFeatures);
+        if (seen.insert(row).second) {
+            std::copy(row.begin(), row.end(),
+                      &candidates[nDistinct * nFeatures]);
+            nDistinct++;
+        }
+    }
+    candidates.resize(nDistinct * nFeatures);
+    return nDistinct;
+}
+
+static size_t pickWeighted(std::mt19937_64 &rng,
+                           const vector<CpuAlgorithmFPType> &weights) {
+    std::uniform_real_distribution<CpuAlgorithmFPType> uniform(0.0, 1.0);
+    CpuAlgorithmFPType r =
+        uniform(rng) * std::accumulate(weights.begin(), weights.end(), 0.0);
+    CpuAlgorithmFPType cumulative = 0.0;
+    for (size_t i = 0; i < weights.size(); i++) {
+        cumulative += weights[i];
+        if (cumulative >= r)
+            return i;
+    }
+    return weights.size() - 1;
+}
+
+/*
+ * Weighted k-means++ followed by Lloyd iterations on the candidates, the same
+ * as LocalKMeans of Spark MLlib. Every rank runs it on the same input with the
+ * same seed, so all ranks end up with the same centroids.
+ */
+static CentroidsBuffer
+localKMeansPlusPlus(const CentroidsBuffer &points,
+                    const vector<CpuAlgorithmFPType> &weights,
+                    size_t nClusters, size_t nFeatures, std::mt19937_64 &rng) {
+    const size_t nPoints = weights.size();
+    std::uniform_real_distribution<CpuAlgorithmFPType> uniform(0.0, 1.0);
+    CentroidsBuffer centers(nClusters * nFeatures);
+
+    size_t first = pickWeighted(rng, weights);
+    const CpuAlgorithmFPType *firstPoint = points.data() + first * nFeatures;
+    std::copy(firstPoint, firstPoint + nFeatures, centers.data());
+
+    vector<CpuAlgorithmFPType> costs(nPoints);
+    tbb::parallel_for(size_t(0), nPoints, [&](size_t j) {
+        costs[j] = squaredDistance(&points[j * nFeatures], &centers[0],
+                                   nFeatures);
+    });
+
+    for (size_t i = 1; i < nClusters; i++) {
+        CpuAlgorithmFPType sum = 0.0;
+        for (size_t j = 0; j < nPoints; j++)
+            sum += costs[j] * weights[j];
+        CpuAlgorithmFPType r = uniform(rng) * sum;
+        CpuAlgorithmFPType cumulative = 0.0;
+        size_t j = 0;
+        while (j < nPoints && cumulative < r) {
+            cumulative += weights[j] * costs[j];
+            j++;
+        }
+        size_t picked = j == 0 ? 0 : j - 1;
+        CpuAlgorithmFPType *center = &centers[i * nFeatures];
+        const CpuAlgorithmFPType *pickedPoint =
+            points.data() + picked * nFeatures;
+        std::copy(pickedPoint, pickedPoint + nFeatures, center);
+
+        tbb::parallel_for(size_t(0), nPoints, [&](size_t j) {
+            costs[j] = std::min(
+                costs[j],
+                squaredDistance(&points[j * nFeatures], center, nFeatures));
+        });
+    }
+
+    vector<size_t> closest(nPoints);
+    vector<size_t> oldClosest(nPoints, nClusters);
+    bool moved = true;
+    for (size_t it = 0; moved && it < localKMeansMaxIterations; it++) {
+        tbb::parallel_for(size_t(0), nPoints, [&](size_t j) {
+            CpuAlgorithmFPType distance;
+            closest[j] = findClosest(&points[j * nFeatures], centers.data(),
+                                     nClusters, nFeatures, distance);
+        });
+
+        moved = false;
+        vector<CpuAlgorithmFPType> sums(nClusters * nFeatures, 0.0);
+        vector<CpuAlgorithmFPType> counts(nClusters, 0.0);
+        for (size_t j = 0; j < nPoints; j++) {
+            for (size_t f = 0; f < nFeatures; f++)
+                sums[closest[j] * nFeatures + f] +=
+                    weights[j] * points[j * nFeatures + f];
+            counts[closest[j]] += weights[j];
+            if (closest[j] != oldClosest[j]) {
+                moved = true;
+                oldClosest[j] = closest[j];
+            }
+        }
+
+        std::uniform_int_distribution<size_t> uniformPoint(0, nPoints - 1);
+        for (size_t i = 0; i < nClusters; i++) {
+            if (counts[i] == 0.0) {
+                const CpuAlgorithmFPType *randomPoint =
+                    points.data() + uniformPoint(rng) * nFeatures;
+                std::copy(randomPoint, randomPoint + nFeatures,
+                          &centers[i * nFeatures]);
+            } else {
+                for (size_t f = 0; f < nFeatures; f++)
+                    centers[i * nFeatures + f] =
+                        sums[i * nFeatures + f] / counts[i];
+            }
+        }
+    }
+
+    return centers;
+}
+
+CentroidsBuffer initCentroidsParallel(ccl::communicator &comm,
+                                      const NumericTablePtr &pData,
+                                      size_t nClusters, size_t initSteps,
+                                      unsigned long seed) {
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t nRows = pData->getNumberOfRows();
+    const size_t rank = comm.rank();
+
+    vector<size_t> rowCounts = gatherRowCounts(comm, nRows);
+    const size_t totalRows =
+        std::accumulate(rowCounts.begin(), rowCounts.end(), 0UL);
+    if (totalRows == 0)
+        return CentroidsBuffer();
+
+    // Same seed on all ranks, so all ranks pick the same first center
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<size_t> uniformRow(0, totalRows - 1);
+    CentroidsBuffer candidates;
+    fetchGlobalRows(comm, pData, rowCounts, {uniformRow(rng)}, candidates);
+
+    vector<CpuAlgorithmFPType> costs(
+        nRows, std::numeric_limits<CpuAlgorithmFPType>::max());
+    updateCosts(pData, candidates.data(), 1, nFeatures, costs);
+
+    // Each rank samples its own rows with a different seed
+    std::mt19937_64 rankRng(seed + rank + 1);
+    std::uniform_real_distribution<CpuAlgorithmFPType> uniform(0.0, 1.0);
+
+    for (size_t step = 0; step < initSteps; step++) {
+        CpuAlgorithmFPType sumCosts =
+            std::accumulate(costs.begin(), costs.end(), 0.0);
+        ccl::allreduce(&sumCosts, &sumCosts, 1, ccl::reduction::sum, comm)
+            .wait();
+
+        // Select each row with probability proportional to its cost
+        CentroidsBuffer selected;
+        for (size_t i = 0; i < nRows; i++) {
+            if (uniform(rankRng) < 2.0 * nClusters * costs[i] / sumCosts) {
+                BlockDescriptor<CpuAlgorithmFPType> block;
+                pData->getBlockOfRows(i, 1, readOnly, block);
+                selected.insert(selected.end(), block.getBlockPtr(),
+                                block.getBlockPtr() + nFeatures);
+                pData->releaseBlockOfRows(block);
+            }
+        }
+
+        // Gather the selected rows of all ranks as new candidates
+        size_t sendCount = selected.size();
+        vector<size_t> recvCounts(comm.size());
+        vector<size_t> countsOfCounts(comm.size(), 1);
+        ccl::allgatherv(&sendCount, 1, recvCounts.data(), countsOfCounts,
+                        comm)
+            .wait();
+        size_t recvCount =
+            std::accumulate(recvCounts.begin(), recvCounts.end(), 0UL);
+        if (recvCount == 0)
+            continue;
+
+        CentroidsBuffer newCandidates(recvCount);
+        ccl::allgatherv(selected.data(), sendCount, newCandidates.data(),
+                        recvCounts, comm)
+            .wait();
+
+        updateCosts(pData, newCandidates.data(), recvCount / nFeatures,
+                    nFeatures, costs);
+        candidates.insert(candidates.end(), newCandidates.begin(),
+                          newCandidates.end());
+    }
+
+    size_t nCandidates = distinctCandidates(candidates, nFeatures);
+    logger::println(logger::INFO,
+                    "KMeans (native): k-means|| picked %zu distinct candidates",
+                    nCandidates);
+    if (nCandidates <= nClusters)
+        return candidates;
+
+    // Weight each candidate by the number of rows closest to it
+    tbb::enumerable_thread_specific<vector<CpuAlgorithmFPType>> localWeights(
+        vector<CpuAlgorithmFPType>(nCandidates, 0.0));
+    forEachRowBlock(pData, [&](size_t firstRow, size_t nBlockRows,
+                               const CpuAlgorithmFPType *rows) {
+        vector<CpuAlgorithmFPType> &weights = localWeights.local();
+        for (size_t i = 0; i < nBlockRows; i++) {
+            CpuAlgorithmFPType distance;
+            weights[findClosest(&rows[i * nFeatures], candidates.data(),
+                                nCandidates, nFeatures, distance)] += 1.0;
+        }
+    });
+    vector<CpuAlgorithmFPType> weights(nCandidates, 0.0);
+    for (auto &local : localWeights)
+        for (size_t i = 0; i < nCandidates; i++)
+            weights[i] += local[i];
+    ccl::allreduce(weights.data(), weights.data(), nCandidates,
+                   ccl::reduction::sum, comm)
+        .wait();
+
+    return localKMeansPlusPlus(candidates, weights, nClusters, nFeatures, rng);
+}
+
+void computeBatchPartials(const NumericTablePtr &pData,
+                          const CentroidsBuffer &centroids, size_t batchSize,
+                          std::mt19937_64 &rng,
+                          std::vector<CpuAlgorithmFPType> &partials) {
+    const size_t nRows = pData->getNumberOfRows();
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t nClusters = centroids.size() / nFeatures;
+    std::fill(partials.begin(), partials.end(), 0.0);
+    if (nRows == 0)
+        return;
+
+    // Sorted, so rows are read in the order of the table
+    vector<size_t> batch(batchSize);
+    std::uniform_int_distribution<size_t> uniformRow(0, nRows - 1);
+    for (size_t i = 0; i < batchSize; i++)
+        batch[i] = uniformRow(rng);
+    std::sort(batch.begin(), batch.end());
+
+    vector<size_t> closest(batchSize);
+    vector<CpuAlgorithmFPType> distances(batchSize);
+    tbb::parallel_for(size_t(0), batchSize, [&](size_t i) {
+        BlockDescriptor<CpuAlgorithmFPType> block;
+        pData->getBlockOfRows(batch[i], 1, readOnly, block);
+        closest[i] = findClosest(block.getBlockPtr(), centroids.data(),
+                                 nClusters, nFeatures, distances[i]);
+        pData->releaseBlockOfRows(block);
+    });
+
+    CpuAlgorithmFPType *sums = partials.data();
+    CpuAlgorithmFPType *counts = sums + nClusters * nFeatures;
+    CpuAlgorithmFPType *objective = counts + nClusters;
+    for (size_t i = 0; i < batchSize; i++) {
+        BlockDescriptor<CpuAlgorithmFPType> block;
+        pData->getBlockOfRows(batch[i], 1, readOnly, block);
+        const CpuAlgorithmFPType *point = block.getBlockPtr();
+        for (size_t f = 0; f < nFeatures; f++)
+            sums[closest[i] * nFeatures + f] += point[f];
+        pData->releaseBlockOfRows(block);
+        counts[closest[i]] += 1.0;
+        *objective += distances[i];
+    }
+}
+
+void computeCountsAndObjective(const NumericTablePtr &pData,
+                               const CentroidsBuffer &centroids,
+                               std::vector<CpuAlgorithmFPType> &stats) {
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t nClusters = centroids.size() / nFeatures;
+
+    tbb::enumerable_thread_specific<vector<CpuAlgorithmFPType>> localStats(
+        vector<CpuAlgorithmFPType>(nClusters + 1, 0.0));
+    forEachRowBlock(pData, [&](size_t firstRow, size_t nRows,
+                               const CpuAlgorithmFPType *rows) {
+        vector<CpuAlgorithmFPType> &local = localStats.local();
+        for (size_t i = 0; i < nRows; i++) {
+            CpuAlgorithmFPType distance;
+            size_t closest = findClosest(&rows[i * nFeatures], centroids.data(),
+                                         nClusters, nFeatures, distance);
+            local[closest] += 1.0;
+            local[nClusters] += distance;
+        }
+    });
+
+    stats.assign(nClusters + 1, 0.0);
+    for (auto &local : localStats)
+        for (size_t i = 0; i <= nClusters; i++)
+            stats[i] += local[i];
+}
+
+void computeCosinePartials(const NumericTablePtr &pData,
+                           const CentroidsBuffer &centroids,
+                           std::vector<CpuAlgorithmFPType> &partials) {
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t nClusters = centroids.size() / nFeatures;
+
+    tbb::enumerable_thread_specific<vector<CpuAlgorithmFPType>> localPartials(
+        vector<CpuAlgorithmFPType>(partials.size(), 0.0));
+    forEachRowBlock(pData, [&](size_t firstRow, size_t nRows,
+                               const CpuAlgorithmFPType *rows) {
+        vector<CpuAlgorithmFPType> &local = localPartials.local();
+        CpuAlgorithmFPType *sums = local.data();
+        CpuAlgorithmFPType *counts = sums + nClusters * nFeatures;
+        CpuAlgorithmFPType *objective = counts + nClusters;
+
+        vector<size_t> closest(nRows);
+        vector<CpuAlgorithmFPType> similarities(nRows);
+        assignRows(rows, nRows, centroids.data(), nClusters, nFeatures,
+                   nullptr, closest.data(), similarities.data());
+
+        for (size_t i = 0; i < nRows; i++) {
+            for (size_t f = 0; f < nFeatures; f++)
+                sums[closest[i] * nFeatures + f] += rows[i * nFeatures + f];
+            counts[closest[i]] += 1.0;
+            *objective += 1.0 - similarities[i];
+        }
+    });
+
+    std::fill(partials.begin(), partials.end(), 0.0);
+    for (auto &local : localPartials)
+        for (size_t i = 0; i < partials.size(); i++)
+            partials[i] += local[i];
+}
+
+void normalizeCentroids(CentroidsBuffer &centroids, size_t nFeatures) {
+    const size_t nClusters = centroids.size() / nFeatures;
+    for (size_t i = 0; i < nClusters; i++) {
+        CpuAlgorithmFPType *center = &centroids[i * nFeatures];
+        CpuAlgorithmFPType norm =
+            std::sqrt(dotProduct(center, center, nFeatures));
+        if (norm > 0.0)
+            for (size_t f = 0; f < nFeatures; f++)
+                center[f] /= norm;
+    }
+}
+
+void assignToCentroids(const NumericTablePtr &pData,
+                       const CentroidsBuffer &centroids, bool cosine,
+                       int *clusterIndices, CpuAlgorithmFPType *distances) {
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t nClusters = centroids.size() / nFeatures;
+
+    vector<CpuAlgorithmFPType> halfNorms(nClusters, 0.0);
+    if (!cosine)
+        for (size_t j = 0; j < nClusters; j++)
+            halfNorms[j] = 0.5 * dotProduct(&centroids[j * nFeatures],
+                                            &centroids[j * nFeatures],
+                                            nFeatures);
+
+    forEachRowBlock(pData, [&](size_t firstRow, size_t nRows,
+                               const CpuAlgorithmFPType *rows) {
+        vector<size_t> closest(nRows);
+        vector<CpuAlgorithmFPType> scores(nRows);
+        assignRows(rows, nRows, centroids.data(), nClusters, nFeatures,
+                   halfNorms.data(), closest.data(), scores.data());
+
+        for (size_t i = 0; i < nRows; i++) {
+            clusterIndices[firstRow + i] = closest[i];
+            if (!distances)
+                continue;
+            if (cosine) {
+                distances[firstRow + i] = 1.0 - scores[i];
+            } else {
+                const CpuAlgorithmFPType *x = &rows[i * nFeatures];
+                // |x - c|^2 = |x|^2 - 2 * score, may round below zero
+                CpuAlgorithmFPType squared =
+                    dotProduct(x, x, nFeatures) - 2.0 * scores[i];
+                distances[firstRow + i] = std::sqrt(std::max(squared, 0.0));
+            }
+        }
+    });
+}
+
+void summarizeClusters(const NumericTablePtr &pData,
+                       const std::vector<int> &slots, size_t nSlots,
+                       std::vector<CpuAlgorithmFPType> &stats) {
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t statsSize = nFeatures + 2;
+
+    tbb::enumerable_thread_specific<vector<CpuAlgorithmFPType>> localStats(
+        vector<CpuAlgorithmFPType>(nSlots * statsSize, 0.0));
+    forEachRowBlock(pData, [&](size_t firstRow, size_t nRows,
+                               const CpuAlgorithmFPType *rows) {
+        vector<CpuAlgorithmFPType> &local = localStats.local();
+        for (size_t i = 0; i < nRows; i++) {
+            int slot = slots[firstRow + i];
+            if (slot < 0)
+                continue;
+            const CpuAlgorithmFPType *x = &rows[i * nFeatures];
+            CpuAlgorithmFPType *slotStats = &local[slot * statsSize];
+            for (size_t f = 0; f < nFeatures; f++)
+                slotStats[f] += x[f];
+            slotStats[nFeatures] += 1.0;
+            slotStats[nFeatures + 1] += dotProduct(x, x, nFeatures);
+        }
+    });
+
+    stats.assign(nSlots * statsSize, 0.0);
+    for (auto &local : localStats)
+        for (size_t i = 0; i < stats.size(); i++)
+            stats[i] += local[i];
+}
+
+size_t assignToChildren(const NumericTablePtr &pData,
+                        const std::vector<int> &parentSlots,
+                        const CentroidsBuffer &childCenters,
+                        const std::vector<bool> &childPresent,
+                        std::vector<int> &childSlots) {
+    const size_t nFeatures = pData->getNumberOfColumns();
+
+    tbb::enumerable_thread_specific<size_t> localChanged(0);
+    forEachRowBlock(pData, [&](size_t firstRow, size_t nRows,
+                               const CpuAlgorithmFPType *rows) {
+        size_t &changed = localChanged.local();
+        for (size_t i = 0; i < nRows; i++) {
+            const size_t row = firstRow + i;
+            int parent = parentSlots[row];
+            int child = -1;
+            if (parent >= 0) {
+                const int left = 2 * parent, right = left + 1;
+                if (!childPresent[right]) {
+                    child = left;
+                } else if (!childPresent[left]) {
+                    child = right;
+                } else {
+                    const CpuAlgorithmFPType *x = &rows[i * nFeatures];
+                    CpuAlgorithmFPType leftDistance = squaredDistance(
+                        x, &childCenters[left * nFeatures], nFeatures);
+                    CpuAlgorithmFPType rightDistance = squaredDistance(
+                        x, &childCenters[right * nFeatures], nFeatures);
+                    child = leftDistance <= rightDistance ? left : right;
+                }
+            }
+            if (child != childSlots[row]) {
+                childSlots[row] = child;
+                changed++;
+            }
+        }
+    });
+    return localChanged.combine(std::plus<size_t>());
+}
+
+HamerlyLocalStep::HamerlyLocalStep(const NumericTablePtr &pData,
+                                   size_t nClusters)
+    : pData(pData), nClusters(nClusters),
+      nFeatures(pData->getNumberOfColumns()) {}
+
+void HamerlyLocalStep::computePartials(
+    const CentroidsBuffer &centroids,
+    std::vector<CpuAlgorithmFPType> &partials) {
+    const size_t nRows = pData->getNumberOfRows();
+    const CpuAlgorithmFPType maxValue =
+        std::numeric_limits<CpuAlgorithmFPType>::max();
+
+    // Rows have no bounds yet in the first iteration
+    const bool hasBounds = !lastCentroids.empty();
+    if (!hasBounds) {
+        assignments.assign(nRows, 0);
+        lowerBounds.assign(nRows, 0.0);
+    }
+
+    // Lower bounds shrink by the largest move of the other centroids
+    size_t maxMoved = 0;
+    CpuAlgorithmFPType maxMove = 0.0, secondMaxMove = 0.0;
+    if (hasBounds) {
+        for (size_t i = 0; i < nClusters; i++) {
+            CpuAlgorithmFPType move = std::sqrt(
+                squaredDistance(&centroids[i * nFeatures],
+                                &lastCentroids[i * nFeatures], nFeatures));
+            if (move > maxMove) {
+                secondMaxMove = maxMove;
+                maxMove = move;
+                maxMoved = i;
+            } else if (move > secondMaxMove) {
+                secondMaxMove = move;
+            }
+        }
+    }
+
+    // Half of the distance from each centroid to its closest other centroid
+    vector<CpuAlgorithmFPType> halfSeparation(nClusters, maxValue);
+    tbb::parallel_for(size_t(0), nClusters, [&](size_t i) {
+        for (size_t j = 0; j < nClusters; j++) {
+            if (j == i)
+                continue;
+            CpuAlgorithmFPType distance =
+                squaredDistance(&centroids[i * nFeatures],
+                                &centroids[j * nFeatures], nFeatures);
+            halfSeparation[i] =
+                std::min(halfSeparation[i], 0.5 * std::sqrt(distance));
+        }
+    });
+
+    tbb::enumerable_thread_specific<vector<CpuAlgorithmFPType>> localPartials(
+        vector<CpuAlgorithmFPType>(partials.size(), 0.0));
+    forEachRowBlock(pData, [&](size_t firstRow, size_t nBlockRows,
+                               const CpuAlgorithmFPType *rows) {
+        vector<CpuAlgorithmFPType> &local = localPartials.local();
+        CpuAlgorithmFPType *sums = local.data();
+        CpuAlgorithmFPType *counts = sums + nClusters * nFeatures;
+        CpuAlgorithmFPType *objective = counts + nClusters;
+
+        for (size_t i = 0; i < nBlockRows; i++) {
+            const size_t row = firstRow + i;
+            const CpuAlgorithmFPType *point = &rows[i * nFeatures];
+            size_t closest = assignments[row];
+            CpuAlgorithmFPType closestDistance = 0.0;
+
+            if (hasBounds) {
+                lowerBounds[row] -=
+                    closest == maxMoved ? secondMaxMove : maxMove;
+                // The exact distance to the assigned centroid is the tightest
+                // upper bound and is needed for the objective anyway
+                closestDistance = squaredDistance(
+                    point, &centroids[closest * nFeatures], nFeatures);
+                CpuAlgorithmFPType upperBound = std::sqrt(closestDistance);
+                if (upperBound <=
+                    std::max(halfSeparation[closest], lowerBounds[row])) {
+                    *objective += closestDistance;
+                    counts[closest] += 1.0;
+                    for (size_t f = 0; f < nFeatures; f++)
+                        sums[closest * nFeatures + f] += point[f];
+                    continue;
+                }
+            }
+
+            // Bounds can not rule out a change, compare with all centroids
+            CpuAlgorithmFPType secondDistance = maxValue;
+            closestDistance = maxValue;
+            for (size_t j = 0; j < nClusters; j++) {
+                CpuAlgorithmFPType distance = squaredDistance(
+                    point, &centroids[j * nFeatures], nFeatures);
+                if (distance < closestDistance) {
+                    secondDistance = closestDistance;
+                    closestDistance = distance;
+                    closest = j;
+                } else if (distance < secondDistance) {
+                    secondDistance = distance;
+                }
+            }
+            assignments[row] = closest;
+            lowerBounds[row] = std::sqrt(secondDistance);
+
+            *objective += closestDistance;
+            counts[closest] += 1.0;
+            for (size_t f = 0; f < nFeatures; f++)
+                sums[closest * nFeatures + f] += point[f];
+        }
+    });
+
+    std::fill(partials.begin(), partials.end(), 0.0);
+    for (auto &local : localPartials)
+        for (size_t i = 0; i < partials.size(); i++)
+            partials[i] += local[i];
+
+    lastCentroids = centroids;
+}
@@ -0,0 +1,108 @@
+/*******************************************************************************
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+
+#pragma once
+
+#include <oneapi/ccl.hpp>
+#include <random>
+#include <vector>
+
+#include "service.h"
+
+typedef std::vector<CpuAlgorithmFPType> CentroidsBuffer;
+
+// Pick nClusters distinct rows uniformly at random from the rows of all ranks,
+// empty if there are no rows
+CentroidsBuffer initCentroidsRandom(ccl::communicator &comm,
+                                    const NumericTablePtr &pData,
+                                    size_t nClusters, unsigned long seed);
+
+// Scalable k-means++ (k-means||) over the rows of all ranks, may return less
+// than nClusters centroids if there are not enough distinct candidates and
+// none if there are no rows
+CentroidsBuffer initCentroidsParallel(ccl::communicator &comm,
+                                      const NumericTablePtr &pData,
+                                      size_t nClusters, size_t initSteps,
+                                      unsigned long seed);
+
+// Partials of batchSize rows sampled with replacement from pData, packed as
+// [sums (k x p) | counts (k) | objective (1)]
+void computeBatchPartials(const NumericTablePtr &pData,
+                          const CentroidsBuffer &centroids, size_t batchSize,
+                          std::mt19937_64 &rng,
+                          std::vector<CpuAlgorithmFPType> &partials);
+
+// Number of rows of pData closest to each centroid and the sum of squared
+// distances of the rows to their closest centroid, as [counts (k) | objective]
+void computeCountsAndObjective(const NumericTablePtr &pData,
+                               const CentroidsBuffer &centroids,
+                               std::vector<CpuAlgorithmFPType> &stats);
+
+// Partials of cosine k-means for unit length rows and centroids. Rows are
+// assigned to the centroid of the largest dot product and the objective is
+// the sum of 1 - cosine similarity.
+void computeCosinePartials(const NumericTablePtr &pData,
+                           const CentroidsBuffer &centroids,
+                           std::vector<CpuAlgorithmFPType> &partials);
+
+// Scale centroids to unit length, zero centroids are left as is
+void normalizeCentroids(CentroidsBuffer &centroids, size_t nFeatures);
+
+// Index of the closest centroid of every row of pData and, if distances is
+// not null, the distance to it. For cosine distance rows and centroids are
+// unit length and the distance is 1 - cosine similarity.
+void assignToCentroids(const NumericTablePtr &pData,
+                       const CentroidsBuffer &centroids, bool cosine,
+                       int *clusterIndices, CpuAlgorithmFPType *distances);
+
+// Statistics [sums (p) | count (1) | sum of squared norms (1)] of the rows of
+// each of nSlots clusters, rows with negative slots are skipped
+void summarizeClusters(const NumericTablePtr &pData,
+                       const std::vector<int> &slots, size_t nSlots,
+                       std::vector<CpuAlgorithmFPType> &stats);
+
+// Move each row with parentSlots[row] = s >= 0 to the closer of the child
+// centers 2s and 2s + 1 which are present and set childSlots[row], rows with
+// negative parent slots get negative child slots. Returns the number of rows
+// whose child slot changed.
+size_t assignToChildren(const NumericTablePtr &pData,
+                        const std::vector<int> &parentSlots,
+                        const CentroidsBuffer &childCenters,
+                        const std::vector<bool> &childPresent,
+                        std::vector<int> &childSlots);
+
+/*
+ * Local step of k-means with Hamerly's bounds. The assignment and a lower
+ * bound of the distance to the second closest centroid are kept for every row
+ * across iterations, so only rows whose bounds allow a change of cluster are
+ * compared against all centroids. Partials are packed the same way as the
+ * oneDAL local step: [sums (k x p) | counts (k) | objective (1)].
+ */
+class HamerlyLocalStep {
+public:
+    HamerlyLocalStep(const NumericTablePtr &pData, size_t nClusters);
+
+    void computePartials(const CentroidsBuffer &centroids,
+                         std::vector<CpuAlgorithmFPType> &partials);
+
+private:
+    NumericTablePtr pData;
+    size_t nClusters;
+    size_t nFeatures;
+    CentroidsBuffer lastCentroids;
+    std::vector<size_t> assignments;
+    std::vector<CpuAlgorithmFPType> lowerBounds;
+};
@@ -23,8 +23,10 @@
 #include "oneapi/dal/algo/pca.hpp"
 #endif
 
+#include "CovarianceKernels.h"
 #include "Logger.h"
 #include "OneCCL.h"
+#include "PCAKernels.h"
 #include "com_intel_oap_mllib_feature_PCADALImpl.h"
 #include "service.h"
 
@@ -35,14 +37,52 @@ namespace covariance_gpu = oneapi::dal::covariance;
 #endif
 using namespace daal;
 using namespace daal::services;
-namespace pca_cpu = daal::algorithms::pca;
 namespace covariance_cpu = daal::algorithms::covariance;
 
+// Extra columns of the random basis of randomized PCA beyond k, the number
+// of subspace iterations and the seed of the basis
+static const size_t randomizedPCAOversampling = 10;
+static const size_t randomizedPCAIterations = 5;
+static const unsigned long randomizedPCASeed = 777;
+
+// Seed of the start vectors of the eigensolver of the full covariance
+static const unsigned long eigensolverSeed = 777;
+
+// Copy a row-major buffer to a new numeric table
+static NumericTablePtr toNumericTable(const DenseBuffer &buffer,
+                                      size_t nColumns, size_t nRows) {
+    NumericTablePtr table = HomogenNumericTable<CpuAlgorithmFPType>::create(
+        nColumns, nRows, NumericTable::doAllocate);
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    table->getBlockOfRows(0, nRows, writeOnly, block);
+    std::copy(buffer.begin(), buffer.end(), block.getBlockPtr());
+    table->releaseBlockOfRows(block);
+    return table;
+}
+
+// Set the components, their variances and the total variance on resultObj
+static void setPCAResult(JNIEnv *env, jobject resultObj,
+                         NumericTablePtr *eigenvectors,
+                         NumericTablePtr *eigenvalues,
+                         CpuAlgorithmFPType totalVariance) {
+    jclass clazz = env->GetObjectClass(resultObj);
+    jfieldID pcNumericTableField =
+        env->GetFieldID(clazz, "pcNumericTable", "J");
+    jfieldID explainedVarianceNumericTableField =
+        env->GetFieldID(clazz, "explainedVarianceNumericTable", "J");
+    jfieldID totalVarianceField = env->GetFieldID(clazz, "totalVariance", "D");
+
+    env->SetLongField(resultObj, pcNumericTableField, (jlong)eigenvectors);
+    env->SetLongField(resultObj, explainedVarianceNumericTableField,
+                      (jlong)eigenvalues);
+    env->SetDoubleField(resultObj, totalVarianceField, totalVariance);
+}
+
 static void doPCADAALCompute(JNIEnv *env, jobject obj, size_t rankId,
                              ccl::communicator &comm, NumericTablePtr &pData,
-                             size_t nBlocks, jobject resultObj) {
+                             size_t k, const NumericTablePtr &covarianceState,
+                             bool saveCovarianceState, jobject resultObj) {
     logger::println(logger::INFO, "OneDAL (native): CPU compute start");
-    using daal::byte;
     auto t1 = std::chrono::high_resolution_clock::now();
 
     const bool isRoot = (rankId == ccl_root);
@@ -63,50 +103,39 @@ static void doPCADAALCompute(JNIEnv *env, jobject obj, size_t rankId,
 
     t1 = std::chrono::high_resolution_clock::now();
 
-    /* Serialize partial results required by step 2 */
-    services::SharedPtr<byte> serializedData;
-    InputDataArchive dataArch;
-    localAlgorithm.getPartialResult()->serialize(dataArch);
-    size_t perNodeArchLength = dataArch.getSizeOfArchive();
-
-    serializedData =
-        services::SharedPtr<byte>(new byte[perNodeArchLength * nBlocks]);
-
-    byte *nodeResults = new byte[perNodeArchLength];
-    dataArch.copyArchiveToArray(nodeResults, perNodeArchLength);
-    std::vector<size_t> aReceiveCount(comm.size(), perNodeArchLength);
-
-    /* Transfer partial results to step 2 on the root node */
-    ccl::gather((int8_t *)nodeResults, perNodeArchLength,
-                (int8_t *)(serializedData.get()), perNodeArchLength, comm)
-        .wait();
+    /* Merge the partial results of all ranks on the root node */
+    covariance_cpu::PartialResultPtr mergedPartialResult =
+        reduceCovariancePartialResults(comm, localAlgorithm.getPartialResult());
     t2 = std::chrono::high_resolution_clock::now();
 
     duration = std::chrono::duration<float>(t2 - t1).count();
     logger::println(logger::INFO,
-                    "PCA (native): Covariance gather to master took %f secs",
-                    duration / 1000);
+                    "PCA (native): Covariance reduce to master took %f secs",
+                    duration);
     if (isRoot) {
         auto t1 = std::chrono::high_resolution_clock::now();
+
+        /* Add the saved covariance state of previous fits */
+        if (covarianceState)
+            addCovarianceState(mergedPartialResult, covarianceState);
+        if (saveCovarianceState) {
+            jclass clazz = env->GetObjectClass(resultObj);
+            jfieldID covarianceStateNumericTableField =
+                env->GetFieldID(clazz, "covarianceStateNumericTable", "J");
+            NumericTablePtr *state =
+                new NumericTablePtr(getCovarianceState(mergedPartialResult));
+            env->SetLongField(resultObj, covarianceStateNumericTableField,
+                              (jlong)state);
+        }
+
         /* Create an algorithm to compute covariance on the master node */
         covariance_cpu::Distributed<step2Master, CpuAlgorithmFPType>
             masterAlgorithm;
 
-        for (size_t i = 0; i < nBlocks; i++) {
-            /* Deserialize partial results from step 1 */
-            OutputDataArchive dataArch(serializedData.get() +
-                                           perNodeArchLength * i,
-                                       perNodeArchLength);
-
-            covariance_cpu::PartialResultPtr dataForStep2FromStep1(
-                new covariance_cpu::PartialResult());
-            dataForStep2FromStep1->deserialize(dataArch);
-
-            /* Set local partial results as input for the master-node algorithm
-             */
-            masterAlgorithm.input.add(covariance_cpu::partialResults,
-                                      dataForStep2FromStep1);
-        }
+        /* Set the merged partial result as input for the master-node
+         * algorithm */
+        masterAlgorithm.input.add(covariance_cpu::partialResults,
+                                  mergedPartialResult);
 
         /* Set the parameter to choose the type of the output matrix */
         masterAlgorithm.parameter.outputMatrixType =
@@ -128,50 +157,85 @@ static void doPCADAALCompute(JNIEnv *env, jobject obj, size_t rankId,
 
         t1 = std::chrono::high_resolution_clock::now();
 
-        /* Create an algorithm for principal component analysis using the
-         * correlation method*/
-        pca_cpu::Batch<CpuAlgorithmFPType> algorithm;
-
-        /* Set the algorithm input data*/
-        algorithm.input.set(pca_cpu::correlation,
-                            covariance_result->get(covariance_cpu::covariance));
-        algorithm.parameter.resultsToCompute = pca_cpu::eigenvalue;
+        /* Only the top k eigenpairs of the covariance are computed */
+        NumericTablePtr covariance =
+            covariance_result->get(covariance_cpu::covariance);
+        DenseBuffer eigenvalues;
+        DenseBuffer eigenvectors;
+        computeTopEigenpairs(covariance, k, eigensolverSeed, eigenvalues,
+                             eigenvectors);
 
-        /* Compute results of the PCA algorithm*/
-        algorithm.compute();
+        // Total variance is the trace of the covariance
+        const size_t nFeatures = covariance->getNumberOfColumns();
+        CpuAlgorithmFPType totalVariance = 0.0;
+        for (size_t i = 0; i < nFeatures; i++)
+            totalVariance += covariance->getValue<CpuAlgorithmFPType>(i, i);
 
         t2 = std::chrono::high_resolution_clock::now();
         duration = std::chrono::duration<float>(t2 - t1).count();
         logger::println(logger::INFO, "PCA (native): master step took %f secs",
-                        duration / 1000);
+                        duration);
+
+        const size_t nComponents = eigenvalues.size();
+        NumericTablePtr *retEigenvalues =
+            new NumericTablePtr(toNumericTable(eigenvalues, nComponents, 1));
+        NumericTablePtr *retEigenvectors = new NumericTablePtr(
+            toNumericTable(eigenvectors, nFeatures, nComponents));
 
         /* Print the results */
-        pca_cpu::ResultPtr result = algorithm.getResult();
-        printNumericTable(result->get(pca_cpu::eigenvalues),
-                          "First 10 eigenvalues with first 20 dimensions:", 10,
-                          20);
-        printNumericTable(result->get(pca_cpu::eigenvectors),
-                          "First 10 eigenvectors with first 20 dimensions:", 10,
-                          20);
+        printNumericTable(*retEigenvalues, "First 10 eigenvalues:", 1, 10);
+        printNumericTable(*retEigenvectors,
+                          "First 10 eigenvectors with first 20 dimensions:",
+                          10, 20);
+
+        // Return the top k eigenvalues & eigenvectors
+        setPCAResult(env, resultObj, retEigenvectors, retEigenvalues,
+                     totalVariance);
+    }
+}
 
-        // Return all eigenvalues & eigenvectors
-        // Get the class of the input object
-        jclass clazz = env->GetObjectClass(resultObj);
-        // Get Field references
-        jfieldID pcNumericTableField =
-            env->GetFieldID(clazz, "pcNumericTable", "J");
-        jfieldID explainedVarianceNumericTableField =
-            env->GetFieldID(clazz, "explainedVarianceNumericTable", "J");
+/*
+ * PCA by randomized subspace iteration, only d x (k + oversampling) blocks
+ * are exchanged and the root keeps k components, instead of the d x d
+ * covariance of doPCADAALCompute.
+ */
+static void doRandomizedPCACompute(JNIEnv *env, size_t rankId,
+                                   ccl::communicator &comm,
+                                   NumericTablePtr &pData, size_t k,
+                                   jobject resultObj) {
+    logger::println(logger::INFO,
+                    "OneDAL (native): CPU randomized compute start");
+    auto t1 = std::chrono::high_resolution_clock::now();
 
-        NumericTablePtr *eigenvalues =
-            new NumericTablePtr(result->get(pca_cpu::eigenvalues));
-        NumericTablePtr *eigenvectors =
-            new NumericTablePtr(result->get(pca_cpu::eigenvectors));
+    DenseBuffer eigenvalues;
+    DenseBuffer eigenvectors;
+    CpuAlgorithmFPType totalVariance = 0.0;
+    computeRandomizedPCA(comm, pData, k, randomizedPCAOversampling,
+                         randomizedPCAIterations, randomizedPCASeed,
+                         eigenvalues, eigenvectors, totalVariance);
 
-        env->SetLongField(resultObj, pcNumericTableField, (jlong)eigenvectors);
-        env->SetLongField(resultObj, explainedVarianceNumericTableField,
-                          (jlong)eigenvalues);
-    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    float duration = std::chrono::duration<float>(t2 - t1).count();
+    logger::println(logger::INFO,
+                    "PCA (native): randomized compute took %f secs", duration);
+
+    if (rankId != ccl_root)
+        return;
+
+    const size_t nFeatures = pData->getNumberOfColumns();
+    const size_t nComponents = eigenvalues.size();
+    NumericTablePtr *retEigenvalues =
+        new NumericTablePtr(toNumericTable(eigenvalues, nComponents, 1));
+    NumericTablePtr *retEigenvectors = new NumericTablePtr(
+        toNumericTable(eigenvectors, nFeatures, nComponents));
+
+    printNumericTable(*retEigenvalues, "First 10 eigenvalues:", 1, 10);
+    printNumericTable(*retEigenvectors,
+                      "First 10 eigenvectors with first 20 dimensions:", 10,
+                      20);
+
+    setPCAResult(env, resultObj, retEigenvectors, retEigenvalues,
+                 totalVariance);
 }
 
 #ifdef CPU_GPU_PROFILE
@@ -234,10 +298,16 @@ static void doPCAOneAPICompute(
 }
 #endif
 
+/*
+ * Class:     com_intel_oap_mllib_feature_PCADALImpl
+ * Method:    cPCATrainDAL
+ * Signature: (IJJJIZJZIII[ILcom/intel/oap/mllib/feature/PCAResult;)J
+ */
 JNIEXPORT jlong JNICALL
 Java_com_intel_oap_mllib_feature_PCADALImpl_cPCATrainDAL(
     JNIEnv *env, jobject obj, jint rank, jlong pNumTabData, jlong numRows,
-    jlong numCols, jint executorNum, jint executorCores,
+    jlong numCols, jint k, jboolean randomized, jlong pCovarianceState,
+    jboolean saveCovarianceState, jint executorNum, jint executorCores,
     jint computeDeviceOrdinal, jintArray gpuIdxArray, jobject resultObj) {
     logger::println(logger::INFO,
                     "OneDAL (native): use DPC++ kernels; device %s",
@@ -257,8 +327,15 @@ Java_com_intel_oap_mllib_feature_PCADALImpl_cPCATrainDAL(
         logger::println(logger::INFO,
                         "OneDAL (native): Number of CPU threads used %d",
                         nThreadsNew);
-        doPCADAALCompute(env, obj, rankId, cclComm, pData, executorNum,
-                         resultObj);
+        // Saved covariance state of previous fits, only passed to the root
+        NumericTablePtr covarianceState;
+        if (pCovarianceState != 0)
+            covarianceState = *((NumericTablePtr *)pCovarianceState);
+        if (randomized)
+            doRandomizedPCACompute(env, rankId, cclComm, pData, k, resultObj);
+        else
+            doPCADAALCompute(env, obj, rankId, cclComm, pData, k,
+                             covarianceState, saveCovarianceState, resultObj);
         break;
     }
 #ifdef CPU_GPU_PROFILE
@@ -278,3 +355,38 @@ Java_com_intel_oap_mllib_feature_PCADALImpl_cPCATrainDAL(
     }
     return 0;
 }
+
+/*
+ * Class:     com_intel_oap_mllib_feature_PCADALImpl
+ * Method:    cPCATransform
+ * Signature: (JJILjava/nio/ByteBuffer;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_intel_oap_mllib_feature_PCADALImpl_cPCATransform(
+    JNIEnv *env, jobject obj, jlong pNumTabData, jlong pNumTabComponents,
+    jint executorCores, jobject result) {
+    NumericTablePtr pData = *((NumericTablePtr *)pNumTabData);
+    NumericTablePtr componentsTable = *((NumericTablePtr *)pNumTabComponents);
+    const size_t k = componentsTable->getNumberOfRows();
+    const size_t nFeatures = componentsTable->getNumberOfColumns();
+
+    services::Environment::getInstance()->setNumberOfThreads(executorCores);
+
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    componentsTable->getBlockOfRows(0, k, readOnly, block);
+    DenseBuffer components(block.getBlockPtr(),
+                           block.getBlockPtr() + k * nFeatures);
+    componentsTable->releaseBlockOfRows(block);
+
+    // Projected rows (n x k) are written to a direct buffer
+    CpuAlgorithmFPType *resultPtr =
+        (CpuAlgorithmFPType *)env->GetDirectBufferAddress(result);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    projectRows(pData, components.data(), k, resultPtr);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    float duration = std::chrono::duration<float>(t2 - t1).count();
+    logger::println(logger::INFO,
+                    "PCA (native): transform of %zu rows took %f secs",
+                    pData->getNumberOfRows(), duration);
+}
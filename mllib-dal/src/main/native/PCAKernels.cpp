@@ -0,0 +1,489 @@
+/*******************************************************************************
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include "Logger.h"
+#include "OneCCL.h"
+#include "PCAKernels.h"
+
+using namespace std;
+using namespace daal;
+using namespace daal::services;
+namespace pca_cpu = daal::algorithms::pca;
+
+// Number of rows fetched from a numeric table at a time
+static const size_t rowBlockSize = 4096;
+
+// Tile sizes of the projection, rows by features of the components
+static const size_t projectionRowTile = 64;
+static const size_t projectionFeatureTile = 256;
+
+// Lanczos vectors added between convergence checks, the residual of a
+// converged Ritz pair relative to the largest Ritz value, and the size of the
+// Krylov basis for k eigenpairs, a * k + b vectors, before falling back to the
+// eigendecomposition of the whole matrix
+static const size_t lanczosCheckInterval = 10;
+static const CpuAlgorithmFPType lanczosTolerance = 1e-10;
+static const size_t lanczosBasisPerEigenpair = 4;
+static const size_t lanczosExtraBasis = 20;
+
+void multiplyByGram(const NumericTablePtr &pData, const DenseBuffer &q,
+                    size_t l, DenseBuffer &result) {
+    const size_t nRows = pData->getNumberOfRows();
+    const size_t d = pData->getNumberOfColumns();
+
+    result.assign(d * l, 0.0);
+    DenseBuffer y(rowBlockSize * l);
+
+    // Blocks of rows one by one, threads split the rows of X Q and then the
+    // rows of the result, so no thread needs its own d x l accumulator
+    for (size_t firstRow = 0; firstRow < nRows; firstRow += rowBlockSize) {
+        const size_t blockRows = std::min(rowBlockSize, nRows - firstRow);
+        BlockDescriptor<CpuAlgorithmFPType> block;
+        pData->getBlockOfRows(firstRow, blockRows, readOnly, block);
+        const CpuAlgorithmFPType *x = block.getBlockPtr();
+
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, blockRows),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i < range.end(); i++) {
+                    CpuAlgorithmFPType *yRow = &y[i * l];
+                    std::fill(yRow, yRow + l, 0.0);
+                    for (size_t j = 0; j < d; j++) {
+                        const CpuAlgorithmFPType v = x[i * d + j];
+                        const CpuAlgorithmFPType *qRow = &q[j * l];
+                        for (size_t c = 0; c < l; c++)
+                            yRow[c] += v * qRow[c];
+                    }
+                }
+            });
+
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, d),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = 0; i < blockRows; i++) {
+                    const CpuAlgorithmFPType *yRow = &y[i * l];
+                    for (size_t j = range.begin(); j < range.end(); j++) {
+                        const CpuAlgorithmFPType v = x[i * d + j];
+                        CpuAlgorithmFPType *resultRow = &result[j * l];
+                        for (size_t c = 0; c < l; c++)
+                            resultRow[c] += v * yRow[c];
+                    }
+                }
+            });
+
+        pData->releaseBlockOfRows(block);
+    }
+}
+
+void projectRows(const NumericTablePtr &pData,
+                 const CpuAlgorithmFPType *components, size_t k,
+                 CpuAlgorithmFPType *result) {
+    const size_t nRows = pData->getNumberOfRows();
+    const size_t d = pData->getNumberOfColumns();
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, nRows, projectionRowTile),
+        [&](const tbb::blocked_range<size_t> &range) {
+            const size_t firstRow = range.begin();
+            const size_t blockRows = range.size();
+            BlockDescriptor<CpuAlgorithmFPType> block;
+            pData->getBlockOfRows(firstRow, blockRows, readOnly, block);
+            const CpuAlgorithmFPType *x = block.getBlockPtr();
+            CpuAlgorithmFPType *y = result + firstRow * k;
+            std::fill(y, y + blockRows * k, 0.0);
+
+            for (size_t f0 = 0; f0 < d; f0 += projectionFeatureTile) {
+                const size_t f1 = std::min(d, f0 + projectionFeatureTile);
+                for (size_t r = 0; r < blockRows; r++) {
+                    const CpuAlgorithmFPType *xRow = x + r * d;
+                    for (size_t c = 0; c < k; c++) {
+                        const CpuAlgorithmFPType *component =
+                            components + c * d;
+                        CpuAlgorithmFPType dot = 0.0;
+                        for (size_t f = f0; f < f1; f++)
+                            dot += xRow[f] * component[f];
+                        y[r * k + c] += dot;
+                    }
+                }
+            }
+
+            pData->releaseBlockOfRows(block);
+        });
+}
+
+CpuAlgorithmFPType sumOfSquares(const NumericTablePtr &pData) {
+    const size_t nRows = pData->getNumberOfRows();
+    const size_t d = pData->getNumberOfColumns();
+
+    CpuAlgorithmFPType sum = 0.0;
+    for (size_t firstRow = 0; firstRow < nRows; firstRow += rowBlockSize) {
+        const size_t blockRows = std::min(rowBlockSize, nRows - firstRow);
+        BlockDescriptor<CpuAlgorithmFPType> block;
+        pData->getBlockOfRows(firstRow, blockRows, readOnly, block);
+        const CpuAlgorithmFPType *x = block.getBlockPtr();
+        for (size_t i = 0; i < blockRows * d; i++)
+            sum += x[i] * x[i];
+        pData->releaseBlockOfRows(block);
+    }
+    return sum;
+}
+
+void orthonormalizeColumns(DenseBuffer &a, size_t nRows, size_t nColumns) {
+    for (size_t pass = 0; pass < 2; pass++) {
+        for (size_t c = 0; c < nColumns; c++) {
+            // Norm before the projections, to detect dependent columns
+            CpuAlgorithmFPType initialNorm = 0.0;
+            for (size_t r = 0; r < nRows; r++)
+                initialNorm += a[r * nColumns + c] * a[r * nColumns + c];
+            initialNorm = std::sqrt(initialNorm);
+
+            for (size_t p = 0; p < c; p++) {
+                CpuAlgorithmFPType dot = 0.0;
+                for (size_t r = 0; r < nRows; r++)
+                    dot += a[r * nColumns + p] * a[r * nColumns + c];
+                for (size_t r = 0; r < nRows; r++)
+                    a[r * nColumns + c] -= dot * a[r * nColumns + p];
+            }
+
+            CpuAlgorithmFPType norm = 0.0;
+            for (size_t r = 0; r < nRows; r++)
+                norm += a[r * nColumns + c] * a[r * nColumns + c];
+            norm = std::sqrt(norm);
+
+            const bool dependent = norm <= 1e-12 * initialNorm || norm == 0.0;
+            for (size_t r = 0; r < nRows; r++)
+                a[r * nColumns + c] =
+                    dependent ? 0.0 : a[r * nColumns + c] / norm;
+        }
+    }
+}
+
+// Eigenvalues in descending order and eigenvectors, one per row, of the
+// symmetric matrix, by oneDAL PCA with the matrix as precomputed correlation,
+// which decomposes it with the LAPACK eigensolver of oneDAL
+static void eigenByOneDAL(const NumericTablePtr &matrix,
+                          NumericTablePtr &eigenvalues,
+                          NumericTablePtr &eigenvectors) {
+    pca_cpu::Batch<CpuAlgorithmFPType> algorithm;
+    algorithm.input.set(pca_cpu::correlation, matrix);
+    algorithm.parameter.resultsToCompute = pca_cpu::eigenvalue;
+    algorithm.compute();
+
+    pca_cpu::ResultPtr result = algorithm.getResult();
+    eigenvalues = result->get(pca_cpu::eigenvalues);
+    eigenvectors = result->get(pca_cpu::eigenvectors);
+}
+
+void symmetricEigen(const DenseBuffer &a, size_t n, DenseBuffer &eigenvalues,
+                    DenseBuffer &eigenvectors) {
+    NumericTablePtr matrix = HomogenNumericTable<CpuAlgorithmFPType>::create(
+        n, n, NumericTable::doAllocate);
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    matrix->getBlockOfRows(0, n, writeOnly, block);
+    std::copy(a.begin(), a.end(), block.getBlockPtr());
+    matrix->releaseBlockOfRows(block);
+
+    NumericTablePtr values, vectors;
+    eigenByOneDAL(matrix, values, vectors);
+
+    eigenvalues.resize(n);
+    values->getBlockOfRows(0, 1, readOnly, block);
+    std::copy(block.getBlockPtr(), block.getBlockPtr() + n,
+              eigenvalues.begin());
+    values->releaseBlockOfRows(block);
+
+    // Rows of the oneDAL result are the columns of eigenvectors
+    eigenvectors.resize(n * n);
+    vectors->getBlockOfRows(0, n, readOnly, block);
+    const CpuAlgorithmFPType *v = block.getBlockPtr();
+    for (size_t c = 0; c < n; c++)
+        for (size_t r = 0; r < n; r++)
+            eigenvectors[r * n + c] = v[c * n + r];
+    vectors->releaseBlockOfRows(block);
+}
+
+// Orthogonalize v against the first n rows of basis (each of size d) twice,
+// and return the norm of what is left
+static CpuAlgorithmFPType orthogonalize(const DenseBuffer &basis, size_t n,
+                                        size_t d, CpuAlgorithmFPType *v) {
+    for (size_t pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < n; i++) {
+            const CpuAlgorithmFPType *b = &basis[i * d];
+            CpuAlgorithmFPType dot = 0.0;
+            for (size_t j = 0; j < d; j++)
+                dot += b[j] * v[j];
+            for (size_t j = 0; j < d; j++)
+                v[j] -= dot * b[j];
+        }
+    }
+    CpuAlgorithmFPType norm = 0.0;
+    for (size_t j = 0; j < d; j++)
+        norm += v[j] * v[j];
+    return std::sqrt(norm);
+}
+
+// Fill v with a random direction orthogonal to the first n rows of basis and
+// normalize it
+static void randomOrthogonalVector(const DenseBuffer &basis, size_t n,
+                                   size_t d, std::mt19937_64 &rng,
+                                   CpuAlgorithmFPType *v) {
+    std::normal_distribution<CpuAlgorithmFPType> normal;
+    CpuAlgorithmFPType norm = 0.0;
+    while (norm <= 1e-8) {
+        for (size_t j = 0; j < d; j++)
+            v[j] = normal(rng);
+        norm = orthogonalize(basis, n, d, v);
+    }
+    for (size_t j = 0; j < d; j++)
+        v[j] /= norm;
+}
+
+void computeTopEigenpairs(const NumericTablePtr &matrix, size_t k,
+                          unsigned long seed, DenseBuffer &eigenvalues,
+                          DenseBuffer &eigenvectors) {
+    const size_t d = matrix->getNumberOfColumns();
+    k = std::min(k, d);
+    // A block of k vectors spans every eigenvalue of multiplicity up to k,
+    // a single Krylov vector only finds one vector of each eigenspace
+    const size_t blockSize = std::max<size_t>(k, 1);
+    // Basis size is capped, a gap between eigenvalue k and k + 1 too small to
+    // converge would otherwise grow it to d vectors
+    const size_t maxBasis = std::min(
+        d, lanczosBasisPerEigenpair * k + lanczosExtraBasis);
+
+    BlockDescriptor<CpuAlgorithmFPType> block;
+    matrix->getBlockOfRows(0, d, readOnly, block);
+    const CpuAlgorithmFPType *a = block.getBlockPtr();
+
+    // Orthonormal basis vectors as rows, the matrix times each of them, and
+    // the lower triangle of the projection T = V A V^T row by row
+    DenseBuffer basis, products, projection;
+    std::mt19937_64 rng(seed);
+
+    DenseBuffer ritzValues, ritzVectors;
+    size_t m = 0;
+    size_t lastCheck = 0;
+    CpuAlgorithmFPType normEstimate = 0.0;
+    bool converged = false;
+    while (m < maxBasis && !converged) {
+        // Next block is the last block times the matrix, orthogonalized
+        // against the basis. Random directions replace the vectors of the
+        // first block and the ones in the span of the basis.
+        const size_t first = m;
+        const size_t nNew = std::min(blockSize, maxBasis - m);
+        basis.resize((m + nNew) * d);
+        for (size_t b = 0; b < nNew; b++, m++) {
+            CpuAlgorithmFPType *v = &basis[m * d];
+            CpuAlgorithmFPType norm = 0.0;
+            if (first > 0) {
+                std::copy(&products[(first - blockSize + b) * d],
+                          &products[(first - blockSize + b) * d] + d, v);
+                norm = orthogonalize(basis, m, d, v);
+            }
+            if (norm <= 1e-10 * normEstimate || norm == 0.0)
+                randomOrthogonalVector(basis, m, d, rng, v);
+            else
+                for (size_t j = 0; j < d; j++)
+                    v[j] /= norm;
+        }
+
+        // Products of the new vectors, rows of the matrix are read once
+        products.resize(m * d);
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, d),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i < range.end(); i++)
+                    for (size_t b = first; b < m; b++) {
+                        const CpuAlgorithmFPType *v = &basis[b * d];
+                        CpuAlgorithmFPType sum = 0.0;
+                        for (size_t j = 0; j < d; j++)
+                            sum += a[i * d + j] * v[j];
+                        products[b * d + i] = sum;
+                    }
+            });
+        for (size_t b = first; b < m; b++) {
+            CpuAlgorithmFPType norm = 0.0;
+            for (size_t j = 0; j < d; j++)
+                norm += products[b * d + j] * products[b * d + j];
+            normEstimate = std::max(normEstimate, std::sqrt(norm));
+            for (size_t c = 0; c <= b; c++) {
+                CpuAlgorithmFPType dot = 0.0;
+                for (size_t j = 0; j < d; j++)
+                    dot += basis[c * d + j] * products[b * d + j];
+                projection.push_back(dot);
+            }
+        }
+
+        if (m < k || (m - lastCheck < lanczosCheckInterval && m < maxBasis))
+            continue;
+        lastCheck = m;
+
+        // Ritz pairs from the eigendecomposition of T
+        DenseBuffer t(m * m);
+        for (size_t b = 0, index = 0; b < m; b++)
+            for (size_t c = 0; c <= b; c++, index++) {
+                t[b * m + c] = projection[index];
+                t[c * m + b] = projection[index];
+            }
+        symmetricEigen(t, m, ritzValues, ritzVectors);
+
+        // Residual of the top k Ritz pairs, A y - theta y with y = V^T s
+        const CpuAlgorithmFPType scale =
+            std::max(std::abs(ritzValues[0]), (CpuAlgorithmFPType)1e-300);
+        converged = true;
+        DenseBuffer residual(d);
+        for (size_t c = 0; c < k && converged; c++) {
+            std::fill(residual.begin(), residual.end(), 0.0);
+            for (size_t i = 0; i < m; i++) {
+                const CpuAlgorithmFPType s = ritzVectors[i * m + c];
+                for (size_t j = 0; j < d; j++)
+                    residual[j] += s * (products[i * d + j] -
+                                        ritzValues[c] * basis[i * d + j]);
+            }
+            CpuAlgorithmFPType norm = 0.0;
+            for (size_t j = 0; j < d; j++)
+                norm += residual[j] * residual[j];
+            converged = std::sqrt(norm) <= lanczosTolerance * scale;
+        }
+    }
+
+    matrix->releaseBlockOfRows(block);
+
+    // The Krylov basis spans the whole space if it has d vectors, so its Ritz
+    // pairs are exact
+    if (!converged && m < d) {
+        logger::println(logger::INFO,
+                        "PCA (native): block Lanczos did not converge with "
+                        "%zu vectors, decomposing the whole matrix",
+                        m);
+        NumericTablePtr values, vectors;
+        eigenByOneDAL(matrix, values, vectors);
+        values->getBlockOfRows(0, 1, readOnly, block);
+        eigenvalues.assign(block.getBlockPtr(), block.getBlockPtr() + k);
+        values->releaseBlockOfRows(block);
+        vectors->getBlockOfRows(0, k, readOnly, block);
+        eigenvectors.assign(block.getBlockPtr(), block.getBlockPtr() + k * d);
+        vectors->releaseBlockOfRows(block);
+        return;
+    }
+
+    eigenvalues.assign(ritzValues.begin(), ritzValues.begin() + k);
+    eigenvectors.assign(k * d, 0.0);
+    for (size_t c = 0; c < k; c++)
+        for (size_t i = 0; i < m; i++) {
+            const CpuAlgorithmFPType s = ritzVectors[i * m + c];
+            for (size_t j = 0; j < d; j++)
+                eigenvectors[c * d + j] += s * basis[i * d + j];
+        }
+
+    logger::println(logger::INFO,
+                    "PCA (native): %zu eigenpairs from %zu block Lanczos "
+                    "vectors",
+                    k, m);
+}
+
+void computeRandomizedPCA(ccl::communicator &comm, const NumericTablePtr &pData,
+                          size_t k, size_t oversampling, size_t nIterations,
+                          unsigned long seed, DenseBuffer &eigenvalues,
+                          DenseBuffer &eigenvectors,
+                          CpuAlgorithmFPType &totalVariance) {
+    const bool isRoot = (comm.rank() == ccl_root);
+    const size_t d = pData->getNumberOfColumns();
+    const size_t l = std::min(d, k + oversampling);
+
+    size_t nRows = pData->getNumberOfRows();
+    ccl::allreduce(&nRows, &nRows, 1, ccl::reduction::sum, comm).wait();
+    const CpuAlgorithmFPType scale = 1.0 / std::max<size_t>(nRows - 1, 1);
+
+    // Random starting basis
+    DenseBuffer q(d * l);
+    if (isRoot) {
+        std::mt19937_64 rng(seed);
+        std::normal_distribution<CpuAlgorithmFPType> normal;
+        for (auto &value : q)
+            value = normal(rng);
+        orthonormalizeColumns(q, d, l);
+    }
+    ccl::broadcast(q.data(), q.size(), ccl_root, comm).wait();
+
+    // The receive buffer of the reduction is allocated on all ranks, oneCCL
+    // may use it as scratch space on non-root ranks too
+    DenseBuffer local;
+    DenseBuffer product(d * l);
+    for (size_t iteration = 0; iteration <= nIterations; iteration++) {
+        multiplyByGram(pData, q, l, local);
+        ccl::reduce(local.data(), product.data(), local.size(),
+                    ccl::reduction::sum, ccl_root, comm)
+            .wait();
+        if (iteration == nIterations)
+            break;
+        if (isRoot) {
+            q.swap(product);
+            orthonormalizeColumns(q, d, l);
+        }
+        ccl::broadcast(q.data(), q.size(), ccl_root, comm).wait();
+    }
+
+    CpuAlgorithmFPType localSum = sumOfSquares(pData);
+    CpuAlgorithmFPType sum = 0.0;
+    ccl::reduce(&localSum, &sum, 1, ccl::reduction::sum, ccl_root, comm)
+        .wait();
+
+    if (!isRoot)
+        return;
+
+    // Rayleigh-Ritz: eigenvectors of Q^T C Q (l x l) give those of C
+    DenseBuffer small(l * l, 0.0);
+    for (size_t j = 0; j < d; j++)
+        for (size_t a = 0; a < l; a++)
+            for (size_t b = 0; b < l; b++)
+                small[a * l + b] += q[j * l + a] * product[j * l + b] * scale;
+    for (size_t a = 0; a < l; a++)
+        for (size_t b = a + 1; b < l; b++) {
+            const CpuAlgorithmFPType mean =
+                (small[a * l + b] + small[b * l + a]) / 2;
+            small[a * l + b] = mean;
+            small[b * l + a] = mean;
+        }
+
+    DenseBuffer smallValues, smallVectors;
+    symmetricEigen(small, l, smallValues, smallVectors);
+
+    const size_t nComponents = std::min(k, l);
+    eigenvalues.assign(smallValues.begin(), smallValues.begin() + nComponents);
+    eigenvectors.assign(nComponents * d, 0.0);
+    for (size_t c = 0; c < nComponents; c++)
+        for (size_t j = 0; j < d; j++) {
+            CpuAlgorithmFPType value = 0.0;
+            for (size_t a = 0; a < l; a++)
+                value += q[j * l + a] * smallVectors[a * l + c];
+            eigenvectors[c * d + j] = value;
+        }
+    totalVariance = sum * scale;
+
+    logger::println(logger::INFO,
+                    "PCA (native): randomized PCA of %zu components with %zu "
+                    "iterations over %zu rows",
+                    nComponents, nIterations, nRows);
+}
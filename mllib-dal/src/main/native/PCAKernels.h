@@ -0,0 +1,79 @@
+/*******************************************************************************
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+
+#pragma once
+
+#include <oneapi/ccl.hpp>
+#include <vector>
+
+#include "service.h"
+
+// Dense matrix in row-major order
+typedef std::vector<CpuAlgorithmFPType> DenseBuffer;
+
+// X^T (X Q) for the local rows X (n x d) of pData and Q (d x l), the result
+// is d x l
+void multiplyByGram(const NumericTablePtr &pData, const DenseBuffer &q,
+                    size_t l, DenseBuffer &result);
+
+// Projection X C^T (n x k) of the rows X (n x d) of pData on the components C
+// (k x d), blocked so a tile of the components stays in cache while a tile of
+// rows is multiplied by it
+void projectRows(const NumericTablePtr &pData,
+                 const CpuAlgorithmFPType *components, size_t k,
+                 CpuAlgorithmFPType *result);
+
+// Sum of the squares of all values of pData
+CpuAlgorithmFPType sumOfSquares(const NumericTablePtr &pData);
+
+// Orthonormalize the columns of a (nRows x nColumns) in place by modified
+// Gram-Schmidt, repeated once for accuracy. Columns that are linearly
+// dependent on the previous ones are set to zero.
+void orthonormalizeColumns(DenseBuffer &a, size_t nRows, size_t nColumns);
+
+// Eigenvalues in descending order and the corresponding eigenvectors as the
+// columns of eigenvectors (n x n) of the symmetric matrix a (n x n), by the
+// eigensolver of oneDAL PCA
+void symmetricEigen(const DenseBuffer &a, size_t n, DenseBuffer &eigenvalues,
+                    DenseBuffer &eigenvectors);
+
+/*
+ * Top k eigenvalues in descending order and eigenvectors (k x d, one per row)
+ * of the symmetric positive semi-definite matrix (d x d), by block Lanczos
+ * iteration with blocks of k vectors and full reorthogonalization, so
+ * eigenvalues repeated up to k times are all found. Ritz pairs are checked
+ * every few steps and the iteration stops once the residuals of the top k are
+ * small, so only a Krylov basis of a few times k vectors is built for a well
+ * separated spectrum. The basis has at most 4 k + 20 vectors, if the top k
+ * have not converged by then the whole matrix is decomposed by oneDAL PCA.
+ */
+void computeTopEigenpairs(const NumericTablePtr &matrix, size_t k,
+                          unsigned long seed, DenseBuffer &eigenvalues,
+                          DenseBuffer &eigenvectors);
+
+/*
+ * Top k eigenvalues and eigenvectors of the covariance X^T X / (nRows - 1) of
+ * the centered rows X of all ranks, by randomized subspace iteration. Every
+ * iteration multiplies a d x l basis by the covariance with one reduction of
+ * the local products, and the root orthonormalizes it, so no d x d matrix is
+ * built. Results are set on the root only: eigenvalues (k), eigenvectors
+ * (k x d, one per row) and the total variance, the trace of the covariance.
+ */
+void computeRandomizedPCA(ccl::communicator &comm, const NumericTablePtr &pData,
+                          size_t k, size_t oversampling, size_t nIterations,
+                          unsigned long seed, DenseBuffer &eigenvalues,
+                          DenseBuffer &eigenvectors,
+                          CpuAlgorithmFPType &totalVariance);
@@ -32,8 +32,10 @@ javah -d $WORK_DIR/javah -classpath "$WORK_DIR/../../../target/classes:$DAAL_JAR
     com.intel.oap.mllib.OneCCL$ \
     com.intel.oap.mllib.OneDAL$ \
     com.intel.oap.mllib.clustering.KMeansDALImpl \
+    com.intel.oap.mllib.clustering.BisectingKMeansDALImpl \
     com.intel.oap.mllib.feature.PCADALImpl \
     com.intel.oap.mllib.recommendation.ALSDALImpl \
+    com.intel.oap.mllib.recommendation.ALSRecommendDALImpl \
     com.intel.oap.mllib.classification.NaiveBayesDALImpl \
     com.intel.oap.mllib.regression.LinearRegressionDALImpl \
     com.intel.oap.mllib.stat.CorrelationDALImpl \
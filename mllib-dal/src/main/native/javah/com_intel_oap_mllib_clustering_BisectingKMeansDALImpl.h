@@ -0,0 +1,21 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class com_intel_oap_mllib_clustering_BisectingKMeansDALImpl */
+
+#ifndef _Included_com_intel_oap_mllib_clustering_BisectingKMeansDALImpl
+#define _Included_com_intel_oap_mllib_clustering_BisectingKMeansDALImpl
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     com_intel_oap_mllib_clustering_BisectingKMeansDALImpl
+ * Method:    cBisectingKMeansDALCompute
+ * Signature: (JIIDJIILcom/intel/oap/mllib/clustering/BisectingKMeansResult;)J
+ */
+JNIEXPORT jlong JNICALL Java_com_intel_oap_mllib_clustering_BisectingKMeansDALImpl_cBisectingKMeansDALCompute
+  (JNIEnv *, jobject, jlong, jint, jint, jdouble, jlong, jint, jint, jobject);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
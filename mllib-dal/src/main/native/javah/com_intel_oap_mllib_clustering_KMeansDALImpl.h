@@ -10,10 +10,18 @@ extern "C" {
 /*
  * Class:     com_intel_oap_mllib_clustering_KMeansDALImpl
  * Method:    cKMeansOneapiComputeWithInitCenters
- * Signature: (JJIDIIII[ILcom/intel/oap/mllib/clustering/KMeansResult;)J
+ * Signature: (IJJJJIDIIIILjava/lang/String;IJLjava/lang/String;Ljava/lang/String;IJLjava/lang/String;Ljava/lang/String;IZLjava/nio/ByteBuffer;Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;[ILcom/intel/oap/mllib/clustering/KMeansResult;)J
  */
 JNIEXPORT jlong JNICALL Java_com_intel_oap_mllib_clustering_KMeansDALImpl_cKMeansOneapiComputeWithInitCenters
-  (JNIEnv *, jobject, jint, jlong, jlong, jlong, jlong, jint, jdouble, jint, jint, jint, jint, jintArray, jobject);
+  (JNIEnv *, jobject, jint, jlong, jlong, jlong, jlong, jint, jdouble, jint, jint, jint, jint, jstring, jint, jlong, jstring, jstring, jint, jlong, jstring, jstring, jint, jboolean, jobject, jobject, jobject, jintArray, jobject);
+
+/*
+ * Class:     com_intel_oap_mllib_clustering_KMeansDALImpl
+ * Method:    cKMeansPredict
+ * Signature: (JJILjava/lang/String;Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;)V
+ */
+JNIEXPORT void JNICALL Java_com_intel_oap_mllib_clustering_KMeansDALImpl_cKMeansPredict
+  (JNIEnv *, jobject, jlong, jlong, jint, jstring, jobject, jobject);
 
 #ifdef __cplusplus
 }
@@ -10,10 +10,18 @@ extern "C" {
 /*
  * Class:     com_intel_oap_mllib_feature_PCADALImpl
  * Method:    cPCATrainDAL
- * Signature: (JIII[ILcom/intel/oap/mllib/feature/PCAResult;)J
+ * Signature: (IJJJIZJZIII[ILcom/intel/oap/mllib/feature/PCAResult;)J
  */
 JNIEXPORT jlong JNICALL Java_com_intel_oap_mllib_feature_PCADALImpl_cPCATrainDAL
-  (JNIEnv *, jobject, jint, jlong, jlong, jlong, jint, jint, jint, jintArray, jobject);
+  (JNIEnv *, jobject, jint, jlong, jlong, jlong, jint, jboolean, jlong, jboolean, jint, jint, jint, jintArray, jobject);
+
+/*
+ * Class:     com_intel_oap_mllib_feature_PCADALImpl
+ * Method:    cPCATransform
+ * Signature: (JJILjava/nio/ByteBuffer;)V
+ */
+JNIEXPORT void JNICALL Java_com_intel_oap_mllib_feature_PCADALImpl_cPCATransform
+  (JNIEnv *, jobject, jlong, jlong, jint, jobject);
 
 #ifdef __cplusplus
 }
@@ -7,21 +7,37 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+/*
+ * Class:     com_intel_oap_mllib_recommendation_ALSDALImpl
+ * Method:    cCreateContext
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cCreateContext
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     com_intel_oap_mllib_recommendation_ALSDALImpl
+ * Method:    cReleaseContext
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cReleaseContext
+  (JNIEnv *, jobject, jlong);
+
 /*
  * Class:     com_intel_oap_mllib_recommendation_ALSDALImpl
  * Method:    cDALImplictALS
- * Signature: (JJIIDDIIILcom/intel/oap/mllib/recommendation/ALSResult;)J
+ * Signature: (JJJIIDDDJZIIILcom/intel/oap/mllib/recommendation/ALSResult;)J
  */
 JNIEXPORT jlong JNICALL Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cDALImplictALS
-  (JNIEnv *, jobject, jlong, jlong, jint, jint, jdouble, jdouble, jint, jint, jint, jobject);
+  (JNIEnv *, jobject, jlong, jlong, jlong, jint, jint, jdouble, jdouble, jdouble, jlong, jboolean, jint, jint, jint, jobject);
 
 /*
  * Class:     com_intel_oap_mllib_recommendation_ALSDALImpl
  * Method:    cShuffleData
- * Signature: (Ljava/nio/ByteBuffer;IILcom/intel/oap/mllib/recommendation/ALSPartitionInfo;)Ljava/nio/ByteBuffer;
+ * Signature: (JLjava/nio/ByteBuffer;IIIZJILcom/intel/oap/mllib/recommendation/ALSPartitionInfo;)J
  */
-JNIEXPORT jobject JNICALL Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cShuffleData
-  (JNIEnv *, jobject, jobject, jint, jint, jobject);
+JNIEXPORT jlong JNICALL Java_com_intel_oap_mllib_recommendation_ALSDALImpl_cShuffleData
+  (JNIEnv *, jobject, jlong, jobject, jint, jint, jint, jboolean, jlong, jint, jobject);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,21 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class com_intel_oap_mllib_recommendation_ALSRecommendDALImpl */
+
+#ifndef _Included_com_intel_oap_mllib_recommendation_ALSRecommendDALImpl
+#define _Included_com_intel_oap_mllib_recommendation_ALSRecommendDALImpl
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     com_intel_oap_mllib_recommendation_ALSRecommendDALImpl
+ * Method:    cRecommendForAll
+ * Signature: (Ljava/nio/ByteBuffer;ILjava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IIIILjava/nio/ByteBuffer;Ljava/nio/ByteBuffer;)V
+ */
+JNIEXPORT void JNICALL Java_com_intel_oap_mllib_recommendation_ALSRecommendDALImpl_cRecommendForAll
+  (JNIEnv *, jobject, jobject, jint, jobject, jobject, jint, jint, jint, jint, jobject, jobject);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -260,6 +260,39 @@ object OneDAL {
     tables
   }
 
+  /**
+   * Return a new RDD containing one CSRNumericTable per executor, built from the sparse vectors
+   * of the partitions coalesced on that executor.
+   */
+  def coalesceSparseVectorsToSparseNumericTables(vectors: RDD[Vector],
+                                                 executorNum: Int): RDD[Long] = {
+    val dataForConversion = repartitionForConversion(vectors, executorNum)
+
+    val tables = dataForConversion
+      .coalesce(executorNum, partitionCoalescer = Some(new ExecutorInProcessCoalescePartitioner()))
+      .mapPartitions { it: Iterator[Vector] =>
+        val features = it.toArray
+
+        if (features.size == 0) {
+          Iterator()
+        } else {
+          val numColumns = features(0).size
+          // Dense rows may be mixed with sparse ones, all are stored as CSR
+          val sparseFeatures: Array[Vector] = features.map(_.toSparse)
+          Iterator(vectorsToSparseNumericTable(sparseFeatures, numColumns).getCNumericTable)
+        }
+      }.setName("sparseNumericTables").cache()
+
+    tables.count()
+
+    // Unpersist instances RDD
+    if (vectors.getStorageLevel != StorageLevel.NONE) {
+      vectors.unpersist()
+    }
+
+    tables
+  }
+
   def makeHomogenTable(arrayVectors: Array[Vector],
                        device: Common.ComputeDevice): HomogenTable = {
     val numCols = arrayVectors.head.size
@@ -565,7 +598,7 @@ object OneDAL {
     table
   }
 
-  private def vectorsToDenseNumericTable(
+  private[mllib] def vectorsToDenseNumericTable(
                                           it: Iterator[Vector],
                                           numRows: Int,
                                           numCols: Int): NumericTable = {
@@ -682,17 +715,21 @@ object OneDAL {
     matrix
   }
 
-  def coalesceVectorsToNumericTables(vectors: RDD[Vector], executorNum: Int): RDD[Long] = {
+  // Repartition to executorNum if not enough partitions
+  private def repartitionForConversion(vectors: RDD[Vector], executorNum: Int): RDD[Vector] = {
     require(executorNum > 0)
 
     logger.info(s"Processing partitions with $executorNum executors")
 
-    // Repartition to executorNum if not enough partitions
-    val dataForConversion = if (vectors.getNumPartitions < executorNum) {
+    if (vectors.getNumPartitions < executorNum) {
       vectors.repartition(executorNum).setName("Repartitioned for conversion").cache()
     } else {
       vectors
     }
+  }
+
+  def coalesceVectorsToNumericTables(vectors: RDD[Vector], executorNum: Int): RDD[Long] = {
+    val dataForConversion = repartitionForConversion(vectors, executorNum)
 
     // Get dimensions for each partition
     val partitionDims = Utils.getPartitionDims(dataForConversion)
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.intel.oap.mllib.clustering
+
+import com.intel.oap.mllib.Utils.getOneCCLIPPort
+import com.intel.oap.mllib.{CommonJob, OneCCL, OneDAL, Utils}
+import org.apache.spark.internal.Logging
+import org.apache.spark.ml.linalg.Vector
+import org.apache.spark.mllib.clustering.{BisectingKMeansTreeBuilder, BisectingKMeansModel => MLlibBisectingKMeansModel}
+import org.apache.spark.mllib.linalg.{Vectors => OldVectors}
+import org.apache.spark.rdd.RDD
+
+class BisectingKMeansDALImpl(val nClusters: Int,
+                             val maxIterations: Int,
+                             val minDivisibleClusterSize: Double,
+                             val seed: Long,
+                             val distanceMeasure: String,
+                             val executorNum: Int,
+                             val executorCores: Int
+                            ) extends Serializable with Logging {
+
+  def train(data: RDD[Vector]): MLlibBisectingKMeansModel = {
+    val sparkContext = data.sparkContext
+    val bisectingKMeansTimer = new Utils.AlgoTimeMetrics("BisectingKMeans", sparkContext)
+    bisectingKMeansTimer.record("Preprocessing")
+
+    val coalescedTables = OneDAL.coalesceVectorsToNumericTables(data, executorNum)
+    bisectingKMeansTimer.record("Data Convertion")
+
+    val kvsIPPort = getOneCCLIPPort(coalescedTables)
+
+    CommonJob.initCCLAndSetAffinityMask(coalescedTables, executorNum, kvsIPPort, "CPU")
+    bisectingKMeansTimer.record("OneCCL Init")
+
+    val results = coalescedTables.mapPartitionsWithIndex { (rank, iter) =>
+      val tableArr = iter.next()
+      val result = new BisectingKMeansResult()
+
+      // Every split runs on the rows in place, rows are never reshuffled by cluster
+      val cClusters = cBisectingKMeansDALCompute(
+        tableArr,
+        nClusters,
+        maxIterations,
+        minDivisibleClusterSize,
+        seed,
+        executorNum,
+        executorCores,
+        result
+      )
+
+      val ret = if (rank == 0) {
+        assert(cClusters != 0)
+        val clusterRows = OneDAL.numericTableToVectors(OneDAL.makeNumericTable(cClusters))
+        Iterator((result.getClusterIndices, clusterRows, result.getTotalCost))
+      } else {
+        Iterator.empty
+      }
+      OneCCL.cleanup()
+      ret
+    }.collect()
+
+    // Make sure there is only one result from rank 0
+    assert(results.length == 1)
+    bisectingKMeansTimer.record("Training")
+    bisectingKMeansTimer.print()
+
+    val (clusterIndices, clusterRows, totalCost) = results(0)
+
+    logInfo(s"BisectingKMeans found ${clusterIndices.length} clusters in the tree.")
+    logInfo(s"The cost is $totalCost.")
+
+    // Each row is [size, cost, center] of the cluster of the same tree index
+    val clusters = clusterIndices.zip(clusterRows).map { case (index, row) =>
+      val values = row.toArray
+      (index, (values(0).toLong, values(1), OldVectors.dense(values.drop(2))))
+    }.toMap
+
+    BisectingKMeansTreeBuilder.build(clusters, distanceMeasure, totalCost)
+  }
+
+  @native private[mllib] def cBisectingKMeansDALCompute(data: Long,
+                                                        clusterNum: Int,
+                                                        iterationNum: Int,
+                                                        minDivisibleClusterSize: Double,
+                                                        seed: Long,
+                                                        executorNum: Int,
+                                                        executorCores: Int,
+                                                        result: BisectingKMeansResult): Long
+}
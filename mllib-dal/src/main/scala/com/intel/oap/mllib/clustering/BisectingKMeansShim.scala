@@ -0,0 +1,43 @@
+/*
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.intel.oap.mllib.clustering
+
+import com.intel.oap.mllib.Utils
+
+import org.apache.spark.internal.Logging
+import org.apache.spark.ml.clustering.BisectingKMeansModel
+import org.apache.spark.ml.clustering.spark333.{BisectingKMeans => BisectingKMeansSpark333}
+import org.apache.spark.ml.param.ParamMap
+import org.apache.spark.sql.Dataset
+import org.apache.spark.{SPARK_VERSION, SparkException}
+
+trait BisectingKMeansShim extends Logging {
+  def initShim(params: ParamMap): Unit
+  def fit(dataset: Dataset[_]): BisectingKMeansModel
+}
+
+object BisectingKMeansShim extends Logging {
+  def create(uid: String): BisectingKMeansShim = {
+    logInfo(s"Loading BisectingKMeans for Spark $SPARK_VERSION")
+    val bisectingKMeans = Utils.getSparkVersion() match {
+      case "3.1.1" | "3.1.2" | "3.1.3" | "3.2.0" | "3.2.1" | "3.2.2" | "3.3.3" =>
+        new BisectingKMeansSpark333(uid)
+      case _ => throw new SparkException(s"Unsupported Spark version $SPARK_VERSION")
+    }
+    bisectingKMeans
+  }
+}
@@ -16,12 +16,14 @@
 
 package com.intel.oap.mllib.clustering
 
+import java.nio.{ByteBuffer, ByteOrder}
+
 import com.intel.oap.mllib.Utils.getOneCCLIPPort
 import com.intel.oap.mllib.{CommonJob, OneCCL, OneDAL, Utils}
 import com.intel.oneapi.dal.table.Common
 import org.apache.spark.TaskContext
 import org.apache.spark.internal.Logging
-import org.apache.spark.ml.linalg.Vector
+import org.apache.spark.ml.linalg.{DenseVector, SparseVector, Vector, Vectors}
 import org.apache.spark.ml.util._
 import org.apache.spark.mllib.clustering.{KMeansModel => MLlibKMeansModel}
 import org.apache.spark.mllib.linalg.{Vector => OldVector, Vectors => OldVectors}
@@ -33,20 +35,49 @@ class KMeansDALImpl(var nClusters: Int,
                     val distanceMeasure: String,
                     val centers: Array[OldVector],
                     val executorNum: Int,
-                    val executorCores: Int
+                    val executorCores: Int,
+                    val initMode: String = "k-means||",
+                    val initSteps: Int = 2,
+                    val seed: Long = 0L,
+                    val mode: String = "full",
+                    val batchSize: Int = 10000,
+                    val batchSeed: Long = 0L,
+                    val sparse: Boolean = false
                    ) extends Serializable with Logging {
 
-  def train(data: RDD[Vector]): MLlibKMeansModel = {
+  def train(data: RDD[Vector]): MLlibKMeansModel = trainWithTrace(data)._1
+
+  /**
+   * Train the model and return it with the cluster sizes and the per iteration objective and
+   * maximum centroid shift computed by the native training, the trace is not available on GPU.
+   */
+  def trainWithTrace(data: RDD[Vector]): (MLlibKMeansModel, Option[KMeansDALTrace]) = {
     val sparkContext = data.sparkContext
     val kmeansTimer = new Utils.AlgoTimeMetrics("KMeans", sparkContext)
     val useDevice = sparkContext.getConf.get("spark.oap.mllib.device", Utils.DefaultComputeDevice)
     val computeDevice = Common.ComputeDevice.getDeviceByName(useDevice)
+    val localStep = sparkContext.getConf.get("spark.oap.mllib.kmeans.localStep", "auto")
+    // The root rank saves the centroids every checkpointInterval iterations to checkpointPath
+    val checkpointPath = sparkContext.getConf.get("spark.oap.mllib.kmeans.checkpointPath", "")
+    val checkpointInterval =
+      sparkContext.getConf.getInt("spark.oap.mllib.kmeans.checkpointInterval", 10)
+    val warmStart = sparkContext.getConf.getBoolean("spark.oap.mllib.kmeans.warmStart", false)
     kmeansTimer.record("Preprocessing")
 
+    // Rows are scaled to unit length once for cosine distance
+    val input = if (distanceMeasure == "cosine") {
+      data.map(KMeansDALImpl.normalize)
+    } else {
+      data
+    }
+
+    // Sparse vectors are kept as CSR tables on CPU, sized by nnz instead of rows x cols
     val coalescedTables = if (useDevice == "GPU") {
-      OneDAL.coalesceVectorsToHomogenTables(data, executorNum, computeDevice)
+      OneDAL.coalesceVectorsToHomogenTables(input, executorNum, computeDevice)
+    } else if (sparse) {
+      OneDAL.coalesceSparseVectorsToSparseNumericTables(input, executorNum)
     } else {
-      OneDAL.coalesceVectorsToNumericTables(data, executorNum)
+      OneDAL.coalesceVectorsToNumericTables(input, executorNum)
     }
     kmeansTimer.record("Data Convertion")
 
@@ -71,8 +102,20 @@ class KMeansDALImpl(var nClusters: Int,
         (iter.next().toString.toLong, 0L, 0L)
       }
 
+      // The trace is written by the native training to direct buffers
+      val (clusterSizes, objectives, maxShifts) = if (useDevice == "GPU") {
+        (null, null, null)
+      } else {
+        (ByteBuffer.allocateDirect(nClusters * 8).order(ByteOrder.nativeOrder()),
+          ByteBuffer.allocateDirect(maxIterations * 8).order(ByteOrder.nativeOrder()),
+          ByteBuffer.allocateDirect(maxIterations * 8).order(ByteOrder.nativeOrder()))
+      }
+
+      // Without initial centers they are computed natively with initMode
       val initCentroids = if (useDevice == "GPU") {
         OneDAL.makeHomogenTable(centers, computeDevice).getcObejct()
+      } else if (centers == null) {
+        0L
       } else {
         OneDAL.makeNumericTable(centers).getCNumericTable
       }
@@ -89,6 +132,20 @@ class KMeansDALImpl(var nClusters: Int,
         executorNum,
         executorCores,
         computeDevice.ordinal(),
+        initMode,
+        initSteps,
+        seed,
+        localStep,
+        mode,
+        batchSize,
+        batchSeed,
+        distanceMeasure,
+        checkpointPath,
+        checkpointInterval,
+        warmStart,
+        clusterSizes,
+        objectives,
+        maxShifts,
         gpuIndices,
         result
       )
@@ -100,7 +157,20 @@ class KMeansDALImpl(var nClusters: Int,
           } else {
             OneDAL.numericTableToVectors(OneDAL.makeNumericTable(cCentroids))
           }
-          Iterator((centerVectors, result.getTotalCost, result.getIterationNum))
+          val trace = if (useDevice == "GPU") {
+            None
+          } else {
+            val sizes = new Array[Long](nClusters)
+            clusterSizes.asLongBuffer().get(sizes)
+            val objectiveHistory = new Array[Double](maxIterations)
+            objectives.asDoubleBuffer().get(objectiveHistory)
+            val maxShiftHistory = new Array[Double](maxIterations)
+            maxShifts.asDoubleBuffer().get(maxShiftHistory)
+            val iterationNum = result.getIterationNum
+            Some(KMeansDALTrace(sizes, objectiveHistory.take(iterationNum),
+              maxShiftHistory.take(iterationNum)))
+          }
+          Iterator((centerVectors, result.getTotalCost, result.getIterationNum, trace))
         } else {
           Iterator.empty
         }
@@ -116,6 +186,7 @@ class KMeansDALImpl(var nClusters: Int,
     val centerVectors = results(0)._1
     val totalCost = results(0)._2
     val iterationNum = results(0)._3
+    val trace = results(0)._4
 
     if (iterationNum == maxIterations) {
       logInfo(s"KMeans reached the max number of iterations: $maxIterations.")
@@ -124,13 +195,70 @@ class KMeansDALImpl(var nClusters: Int,
     }
 
     logInfo(s"The cost is $totalCost.")
+    trace.foreach { t =>
+      logInfo(s"Cost of each iteration: ${t.objectiveHistory.mkString(", ")}")
+      logInfo(s"Maximum centroid shift of each iteration: ${t.maxShiftHistory.mkString(", ")}")
+    }
     logInfo(s"OneDAL output centroids:\n${centerVectors.mkString("\n")}")
 
     val parentModel = new MLlibKMeansModel(
       centerVectors.map(OldVectors.fromML(_)),
       distanceMeasure, totalCost, iterationNum)
 
-    parentModel
+    (parentModel, trace)
+  }
+
+  /**
+   * Assign each row of data to the closest of centers with native kernels on CPU, rows keep
+   * the order of data and come with the distance to the center if withDistances is set.
+   */
+  def predict(data: RDD[Vector],
+              centers: Array[Vector],
+              withDistances: Boolean = true): RDD[(Int, Double)] = {
+    val centerVectors = if (distanceMeasure == "cosine") {
+      centers.map(KMeansDALImpl.normalize)
+    } else {
+      centers
+    }
+    // Centers are shipped with the tasks, a broadcast could not be released once the lazy
+    // result is computed
+    val oldCenters = centerVectors.map(OldVectors.fromML)
+    data.mapPartitions { iter =>
+      val rows = if (distanceMeasure == "cosine") {
+        iter.map(KMeansDALImpl.normalize).toArray
+      } else {
+        iter.toArray
+      }
+      if (rows.isEmpty) {
+        Iterator.empty
+      } else {
+        // As in training, sparse rows are kept as a CSR table instead of rows x cols values
+        val table = if (sparse) {
+          OneDAL.vectorsToSparseNumericTable(rows.map(_.toSparse), rows.head.size)
+        } else {
+          OneDAL.vectorsToDenseNumericTable(rows.iterator, rows.length, rows.head.size)
+        }
+        val centersTable = OneDAL.makeNumericTable(oldCenters)
+        val clusterIndices = ByteBuffer.allocateDirect(rows.length * 4)
+          .order(ByteOrder.nativeOrder())
+        val distances = if (withDistances) {
+          ByteBuffer.allocateDirect(rows.length * 8).order(ByteOrder.nativeOrder())
+        } else {
+          null
+        }
+
+        cKMeansPredict(table.getCNumericTable, centersTable.getCNumericTable, executorCores,
+          distanceMeasure, clusterIndices, distances)
+        OneDAL.cFreeDataMemory(table.getCNumericTable)
+        OneDAL.cFreeDataMemory(centersTable.getCNumericTable)
+
+        val indexBuffer = clusterIndices.asIntBuffer()
+        val distanceBuffer = if (withDistances) distances.asDoubleBuffer() else null
+        Iterator.tabulate(rows.length) { i =>
+          (indexBuffer.get(i), if (withDistances) distanceBuffer.get(i) else Double.NaN)
+        }
+      }
+    }
   }
 
   @native private[mllib] def cKMeansOneapiComputeWithInitCenters( rank: Int,
@@ -144,6 +272,47 @@ class KMeansDALImpl(var nClusters: Int,
                                                          executorNum: Int,
                                                          executorCores: Int,
                                                          computeDeviceOrdinal: Int,
+                                                         initMode: String,
+                                                         initSteps: Int,
+                                                         seed: Long,
+                                                         localStep: String,
+                                                         mode: String,
+                                                         batchSize: Int,
+                                                         batchSeed: Long,
+                                                         distanceMeasure: String,
+                                                         checkpointPath: String,
+                                                         checkpointInterval: Int,
+                                                         warmStart: Boolean,
+                                                         clusterSizes: ByteBuffer,
+                                                         objectives: ByteBuffer,
+                                                         maxShifts: ByteBuffer,
                                                          gpuIndices: Array[Int],
                                                          result: KMeansResult): Long
+
+  @native private[mllib] def cKMeansPredict(data: Long,
+                                            centers: Long,
+                                            executorCores: Int,
+                                            distanceMeasure: String,
+                                            clusterIndices: ByteBuffer,
+                                            distances: ByteBuffer): Unit
+}
+
+/**
+ * Trace of a native KMeans training. Cluster sizes are the counts of the rows assigned to the
+ * final centers, iterations of mini-batch training without a full objective evaluation have NaN
+ * objective. Centroid shifts are cosine distances for cosine training, as Spark checks them.
+ */
+case class KMeansDALTrace(clusterSizes: Array[Long],
+                          objectiveHistory: Array[Double],
+                          maxShiftHistory: Array[Double])
+
+object KMeansDALImpl {
+  private[clustering] def normalize(v: Vector): Vector = {
+    val norm = Vectors.norm(v, 2.0)
+    require(norm > 0.0, "Cosine distance is not defined for zero-length vectors.")
+    v match {
+      case dv: DenseVector => Vectors.dense(dv.values.map(_ / norm))
+      case sv: SparseVector => Vectors.sparse(sv.size, sv.indices, sv.values.map(_ / norm))
+    }
+  }
 }
@@ -16,7 +16,7 @@
 
 package com.intel.oap.mllib.feature
 
-import java.nio.DoubleBuffer
+import java.nio.{ByteBuffer, ByteOrder, DoubleBuffer}
 import com.intel.daal.data_management.data.{HomogenNumericTable, NumericTable}
 import com.intel.oap.mllib.Utils.getOneCCLIPPort
 import com.intel.oap.mllib.{CommonJob, OneCCL, OneDAL, Service, Utils}
@@ -37,17 +37,61 @@ class PCADALModel private[mllib] (
   val pc: OldDenseMatrix,
   val explainedVariance: OldDenseVector)
 
+/**
+ * Mergeable covariance state of the rows a PCA was fit on: the number of rows, the sums of the
+ * features and the cross-product of the rows centered at their mean (d x d, row-major). States of
+ * disjoint data merge exactly, so a saved state lets a later fit only process the new rows.
+ */
+class PCACovarianceState private[mllib] (
+  val nObservations: Double,
+  val sum: Array[Double],
+  val crossProduct: Array[Double]) extends Serializable {
+
+  def numFeatures: Int = sum.length
+}
+
 class PCADALImpl(val k: Int,
                  val executorNum: Int,
                  val executorCores: Int)
   extends Serializable with Logging {
 
   def train(data: RDD[Vector]): PCADALModel = {
-    val normalizedData = normalizeData(data)
-    val sparkContext = normalizedData.sparkContext
+    fit(data, None, saveCovarianceState = false)._1
+  }
+
+  // Fit on data together with the rows of previous fits summarized by previousState, the
+  // returned state covers all of them and can be saved for the next fit. Only the full solver
+  // on CPU keeps the covariance state.
+  def trainIncremental(data: RDD[Vector],
+                       previousState: Option[PCACovarianceState])
+    : (PCADALModel, PCACovarianceState) = {
+    val (model, state) = fit(data, previousState, saveCovarianceState = true)
+    (model, state.get)
+  }
+
+  private def fit(data: RDD[Vector],
+                  previousState: Option[PCACovarianceState],
+                  saveCovarianceState: Boolean): (PCADALModel, Option[PCACovarianceState]) = {
+    val sparkContext = data.sparkContext
     val pcaTimer = new Utils.AlgoTimeMetrics("PCA", sparkContext)
     val useDevice = sparkContext.getConf.get("spark.oap.mllib.device", Utils.DefaultComputeDevice)
     val computeDevice = Common.ComputeDevice.getDeviceByName(useDevice)
+    // "randomized" finds the top k components by subspace iteration without the d x d covariance
+    val solver = sparkContext.getConf.get("spark.oap.mllib.pca.solver", "full")
+    require(Seq("full", "randomized").contains(solver),
+      s"Unsupported PCA solver $solver, should be full or randomized")
+    require(!saveCovarianceState || useDevice != "GPU",
+      "Incremental PCA is only supported on CPU")
+    val randomized = solver == "randomized" && useDevice != "GPU" && !saveCovarianceState
+    previousState.foreach { state =>
+      val numFeatures = data.first().size
+      require(state.numFeatures == numFeatures,
+        s"Covariance state has ${state.numFeatures} features, data has $numFeatures")
+    }
+    // The covariance centers the rows itself, rows of an incremental fit must not be centered
+    // at the mean of this fit only or they could not be merged with the saved state
+    val normalizedData = if (saveCovarianceState) data else normalizeData(data)
+    val bcPreviousState = previousState.map(sparkContext.broadcast(_))
     pcaTimer.record("Preprocessing")
 
     val coalescedTables = if (useDevice == "GPU") {
@@ -75,17 +119,28 @@ class PCADALImpl(val k: Int,
       } else {
         null
       }
+      // Only the root merges the saved covariance state
+      val previousStateTable = if (rank == 0) {
+        bcPreviousState.map(bcState => covarianceStateToNumericTable(bcState.value))
+      } else {
+        None
+      }
       cPCATrainDAL(
         rank,
         tableArr,
         rows,
         columns,
+        k,
+        randomized,
+        previousStateTable.map(_.getCNumericTable).getOrElse(0L),
+        saveCovarianceState,
         executorNum,
         executorCores,
         computeDevice.ordinal(),
         gpuIndices,
         result
       )
+      previousStateTable.foreach(table => OneDAL.cFreeDataMemory(table.getCNumericTable))
 
       val ret = if (rank == 0) {
         val principleComponents = if (useDevice == "GPU") {
@@ -104,10 +159,21 @@ class PCADALImpl(val k: Int,
         } else {
           val explainedVarianceNumericTable = OneDAL.makeNumericTable(
             result.getExplainedVarianceNumericTable)
-          getExplainedVarianceFromDAL(explainedVarianceNumericTable, k)
+          // Only the top k eigenvalues are returned with the sum of all of them
+          getExplainedVarianceFromDAL(explainedVarianceNumericTable, k,
+            result.getTotalVariance)
+        }
+
+        val covarianceState = if (saveCovarianceState) {
+          val stateNumericTable = result.getCovarianceStateNumericTable
+          val state = covarianceStateFromNumericTable(OneDAL.makeNumericTable(stateNumericTable))
+          OneDAL.cFreeDataMemory(stateNumericTable)
+          Some(state)
+        } else {
+          None
         }
 
-        Iterator((principleComponents, explainedVariance))
+        Iterator((principleComponents, explainedVariance, covarianceState))
       } else {
         Iterator.empty
       }
@@ -126,8 +192,61 @@ class PCADALImpl(val k: Int,
       OldDenseMatrix.fromML(pc),
       OldVectors.fromML(explainedVariance).toDense
     )
+    bcPreviousState.foreach(_.destroy())
+
+    (parentModel, results(0)._3)
+  }
 
-    parentModel
+  // Rows of the native covariance state table: the number of rows first, the sums and the
+  // cross-product
+  private def covarianceStateToNumericTable(state: PCACovarianceState): NumericTable = {
+    val numFeatures = state.numFeatures
+    val counts = new Array[Double](numFeatures)
+    counts(0) = state.nObservations
+    val rows = Iterator(Vectors.dense(counts), Vectors.dense(state.sum)) ++
+      state.crossProduct.grouped(numFeatures).map(row => Vectors.dense(row))
+    OneDAL.vectorsToDenseNumericTable(rows, numFeatures + 2, numFeatures)
+  }
+
+  private def covarianceStateFromNumericTable(table: NumericTable): PCACovarianceState = {
+    val numFeatures = table.getNumberOfColumns.toInt
+    val values = getDoubleBufferDataFromDAL(table, numFeatures + 2, numFeatures)
+    new PCACovarianceState(values(0), values.slice(numFeatures, 2 * numFeatures),
+      values.slice(2 * numFeatures, values.length))
+  }
+
+  // Project each row on the principal components pc (d x k), partition by partition in row
+  // order. Like Spark's PCAModel the rows are not centered. Partitions are projected in blocks
+  // of blockRows rows, by default about 1M values, so only one block is copied at a time.
+  def transform(data: RDD[Vector],
+                pc: OldDenseMatrix,
+                blockRows: Int = 0): RDD[Vector] = {
+    // Components are shipped with the tasks, a broadcast could not be released once the lazy
+    // result is computed
+    val components = pc.colIter.toArray
+    val numComponents = pc.numCols
+    val rowsPerBlock = if (blockRows > 0) blockRows else math.max(1, (1 << 20) / pc.numRows)
+    data.mapPartitions { iter =>
+      iter.grouped(rowsPerBlock).flatMap { rows =>
+        val table = OneDAL.vectorsToDenseNumericTable(rows.iterator, rows.length, pc.numRows)
+        val componentsTable = OneDAL.makeNumericTable(components)
+        val projected = ByteBuffer.allocateDirect(rows.length * numComponents * 8)
+          .order(ByteOrder.nativeOrder())
+
+        cPCATransform(table.getCNumericTable, componentsTable.getCNumericTable, executorCores,
+          projected)
+        OneDAL.cFreeDataMemory(table.getCNumericTable)
+        OneDAL.cFreeDataMemory(componentsTable.getCNumericTable)
+
+        val projectedBuffer = projected.asDoubleBuffer()
+        Iterator.tabulate(rows.length) { i =>
+          val values = new Array[Double](numComponents)
+          projectedBuffer.position(i * numComponents)
+          projectedBuffer.get(values)
+          Vectors.dense(values)
+        }
+      }
+    }
   }
 
   // Normalize data before training
@@ -183,13 +302,14 @@ class PCADALImpl(val k: Int,
     new DenseMatrix(numCols, k, arrayDouble.slice(0, numCols * k), false)
   }
 
-  private def getExplainedVarianceFromDAL(table_1xn: NumericTable, k: Int): DenseVector = {
+  private def getExplainedVarianceFromDAL(table_1xn: NumericTable,
+                                          k: Int,
+                                          totalVariance: Double): DenseVector = {
     val dataNumCols = table_1xn.getNumberOfColumns.toInt
     val arrayDouble = getDoubleBufferDataFromDAL(table_1xn, 1, dataNumCols)
-    val sum = arrayDouble.sum
     val topK = Arrays.copyOfRange(arrayDouble, 0, k)
     for (i <- 0 until k)
-      topK(i) = topK(i) / sum
+      topK(i) = topK(i) / totalVariance
     new DenseVector(topK)
   }
 
@@ -214,9 +334,18 @@ class PCADALImpl(val k: Int,
                                    data: Long,
                                    numRows: Long,
                                    numCols: Long,
+                                   k: Int,
+                                   randomized: Boolean,
+                                   covarianceState: Long,
+                                   saveCovarianceState: Boolean,
                                    executorNum: Int,
                                    executorCores: Int,
                                    computeDeviceOrdinal: Int,
                                    gpuIndices: Array[Int],
                                    result: PCAResult): Long
+
+  @native private[mllib] def cPCATransform(data: Long,
+                                           components: Long,
+                                           executorCores: Int,
+                                           result: ByteBuffer): Unit
 }
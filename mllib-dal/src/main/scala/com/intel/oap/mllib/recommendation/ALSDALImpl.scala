@@ -16,65 +16,90 @@
 
 package com.intel.oap.mllib.recommendation
 
-import com.intel.daal.data_management.data.CSRNumericTable
-import com.intel.daal.services.DaalContext
 import com.intel.oap.mllib.Utils.getOneCCLIPPort
 import com.intel.oap.mllib.{OneCCL, OneDAL, Utils}
-import org.apache.spark.Partitioner
 import org.apache.spark.internal.Logging
 import org.apache.spark.ml.recommendation.ALS.Rating
 import org.apache.spark.rdd.RDD
+import org.apache.spark.storage.StorageLevel
 
 import java.nio.{ByteBuffer, ByteOrder, FloatBuffer}
-import scala.collection.mutable.ArrayBuffer
 import scala.reflect.ClassTag
 
-class ALSDataPartitioner(blocks: Int, itemsInBlock: Long)
-  extends Partitioner {
-  def numPartitions: Int = blocks
-
-  def getPartition(key: Any): Int = {
-    val k = key.asInstanceOf[Long]
-    // itemsInBlock = numItems / partitions
-    // remaining records will belog to the last partition
-    // 21 => 5, 5, 5, 6
-    // 46 => 11, 11, 11, 13
-    math.min((k / itemsInBlock).toInt, blocks - 1)
-  }
-}
-
 class ALSDALImpl[@specialized(Int, Long) ID: ClassTag]( data: RDD[Rating[ID]],
                                                         nFactors: Int,
                                                         maxIter: Int,
                                                         regParam: Double,
                                                         alpha: Double,
-                                                        seed: Long
+                                                        seed: Long,
+                                                        implicitPrefs: Boolean = true,
+                                                        intermediateRDDStorageLevel: StorageLevel =
+                                                          StorageLevel.MEMORY_AND_DISK,
+                                                        finalRDDStorageLevel: StorageLevel =
+                                                          StorageLevel.MEMORY_AND_DISK
                                                       ) extends Serializable with Logging {
 
-  // Rating struct size is size of Long+Long+Float
-  val RATING_SIZE = 8 + 8 + 4
+  // Smallest of all IDs, largest user ID and largest item ID, -1 for empty ratings
+  private lazy val idBounds: (Long, Long, Long) = data.map { r =>
+    val user = r.user.toString.toLong
+    val item = r.item.toString.toLong
+    (math.min(user, item), user, item)
+  }.fold((Long.MaxValue, -1L, -1L)) { case ((min1, user1, item1), (min2, user2, item2)) =>
+    (math.min(min1, min2), math.max(user1, user2), math.max(item1, item2))
+  }
+
+  /**
+   * Native factor tables have a row for each ID from 0 to the largest one, so only non-negative
+   * Int IDs are trained natively, other IDs and empty ratings are left to MLlib. So are IDs
+   * whose float user and item factor tables would exceed spark.oap.mllib.als.maxFactorTableSize.
+   * The ID bounds are computed once and reused by train.
+   */
+  def isSupported: Boolean = implicitly[ClassTag[ID]] == ClassTag.Int && {
+    val (minId, maxUser, maxItem) = idBounds
+    val maxFactorTableSize = data.sparkContext.getConf
+      .getSizeAsBytes("spark.oap.mllib.als.maxFactorTableSize", "16g")
+    val factorTableSize = (maxUser + maxItem + 2) * nFactors * 4
+    if (factorTableSize > maxFactorTableSize) {
+      logInfo(s"ALSDAL factor tables of $factorTableSize bytes for largest user ID $maxUser " +
+        s"and item ID $maxItem exceed $maxFactorTableSize bytes, training with MLlib")
+    }
+    maxUser >= 0 && minId >= 0 && factorTableSize <= maxFactorTableSize
+  }
 
   def train(): (RDD[(ID, Array[Float])], RDD[(ID, Array[Float])]) = {
     val executorNum = Utils.sparkExecutorNum(data.sparkContext)
     val executorCores = Utils.sparkExecutorCores()
 
-    val nFeatures = data.max()(new Ordering[Rating[ID]]() {
-      override def compare(x: Rating[ID], y: Rating[ID]): Int =
-        Ordering[Long].compare(x.item.toString.toLong, y.item.toString.toLong)
-    }).item.toString.toLong + 1
-
-    val nVectors = data.max()(new Ordering[Rating[ID]]() {
-      override def compare(x: Rating[ID], y: Rating[ID]): Int =
-        Ordering[Long].compare(x.user.toString.toLong, y.user.toString.toLong)
-    }).user.toString.toLong + 1
+    val (_, maxUser, maxItem) = idBounds
+    val nFeatures = maxItem + 1
+    val nVectors = maxUser + 1
 
     val nBlocks = executorNum
 
+    // "balanced" splits users and items by sampled rating counts instead of equal ranges of ids
+    val partitioner = data.sparkContext.getConf.get("spark.oap.mllib.als.partitioner", "range")
+    require(Seq("range", "balanced").contains(partitioner),
+      s"Unsupported ALS partitioner $partitioner, should be range or balanced")
+    val balanced = partitioner == "balanced"
+    // Bytes sent and received by each executor in a round of the rating shuffle
+    val shuffleRoundSize =
+      data.sparkContext.getConf.getSizeAsBytes("spark.oap.mllib.als.shuffleRoundSize", "256m")
+    require(shuffleRoundSize > 0, "spark.oap.mllib.als.shuffleRoundSize should be positive")
+    // Encoding of rating values in the shuffle, "auto" drops the values if all ratings are 1
+    val ratingEncodings = Seq("float32", "float16", "one")
+    val ratingEncoding = data.sparkContext.getConf.get("spark.oap.mllib.als.ratingEncoding", "auto")
+    require(ratingEncoding == "auto" || ratingEncodings.contains(ratingEncoding),
+      s"Unsupported ALS rating encoding $ratingEncoding, should be auto, float32, float16 or one")
+    val ratingEncodingIndex = ratingEncodings.indexOf(ratingEncoding)
+    // Stop early once the relative change of the training loss is within tolerance, 0 disables it
+    val tolerance = data.sparkContext.getConf.getDouble("spark.oap.mllib.als.tolerance", 0.0)
+    require(tolerance >= 0, "spark.oap.mllib.als.tolerance should not be negative")
+
     logInfo(s"ALSDAL fit using $executorNum Executors " +
       s"for $nVectors vectors and $nFeatures features")
 
     val numericTables = data.repartition(executorNum)
-      .setName("Repartitioned for conversion").cache()
+      .setName("Repartitioned for conversion").persist(intermediateRDDStorageLevel)
 
     val kvsIPPort = getOneCCLIPPort(numericTables)
 
@@ -89,24 +114,31 @@ class ALSDALImpl[@specialized(Int, Long) ID: ClassTag]( data: RDD[Rating[ID]],
 
         println("rankId", rankId, "nUsers", nVectors, "nItems", nFeatures)
 
-        val buffer = ratingsToByteBuffer(iter.toArray)
-        val bufferInfo = new ALSPartitionInfo
-        val shuffledBuffer = cShuffleData(buffer, nFeatures.toInt, nBlocks, bufferInfo)
-
-        val table = bufferToCSRNumericTable(shuffledBuffer, bufferInfo,
-          nVectors.toInt, nFeatures.toInt, nBlocks, rankId)
-
+        // Training state is kept in a context of this job, the oneCCL communicator is still
+        // global, so fits must not run concurrently
+        val context = cCreateContext()
         val result = new ALSResult()
-        cDALImplictALS(
-          table.getCNumericTable, nUsers = nVectors,
-          nFactors, maxIter, regParam, alpha,
-          executorNum,
-          executorCores,
-          rankId,
-          result
-        )
+        try {
+          val buffer = ratingsToByteBuffer(iter.toArray)
+          val bufferInfo = new ALSPartitionInfo
+          // Ratings are shuffled and converted to a CSR table natively
+          val table = cShuffleData(context, buffer, nFeatures.toInt, nVectors.toInt, nBlocks,
+            balanced, shuffleRoundSize, ratingEncodingIndex, bufferInfo)
+
+          cDALImplictALS(
+            context, table, nUsers = nVectors,
+            nFactors, maxIter, tolerance, regParam, alpha, seed,
+            implicitPrefs,
+            executorNum,
+            executorCores,
+            rankId,
+            result
+          )
+        } finally {
+          cReleaseContext(context)
+        }
         Iterator(result)
-      }.cache()
+      }.persist(intermediateRDDStorageLevel)
 
     val usersFactorsRDD = results
       .mapPartitionsWithIndex { (index: Int, partiton: Iterator[ALSResult]) =>
@@ -127,7 +159,7 @@ class ALSDALImpl[@specialized(Int, Long) ID: ClassTag]( data: RDD[Rating[ID]],
           }.toIterator
         }
         ret
-      }.setName("userFactors").cache()
+      }.setName("userFactors").persist(finalRDDStorageLevel)
 
     val itemsFactorsRDD = results
       .mapPartitionsWithIndex { (index: Int, partiton: Iterator[ALSResult]) =>
@@ -148,11 +180,22 @@ class ALSDALImpl[@specialized(Int, Long) ID: ClassTag]( data: RDD[Rating[ID]],
           }.toIterator
         }
         ret
-      }.setName("itemFactors").cache()
+      }.setName("itemFactors").persist(finalRDDStorageLevel)
 
     usersFactorsRDD.count()
     itemsFactorsRDD.count()
 
+    // Every rank has the same loss history, implicit loss or RMSE for explicit feedback
+    val lossHistory = results.map(_.getLossHistory).first()
+    logInfo(s"ALSDAL trained ${lossHistory.length} iterations, " +
+      s"loss history: ${lossHistory.mkString(", ")}")
+
+    // Factors are materialized, the native results are only needed again if they are not kept
+    if (finalRDDStorageLevel != StorageLevel.NONE) {
+      results.unpersist()
+      numericTables.unpersist()
+    }
+
     (usersFactorsRDD, itemsFactorsRDD)
   }
 
@@ -168,110 +211,34 @@ class ALSDALImpl[@specialized(Int, Long) ID: ClassTag]( data: RDD[Rating[ID]],
     buffer
   }
 
-  private def bufferToCSRNumericTable(buffer: ByteBuffer, info: ALSPartitionInfo,
-                                      nVectors: Int, nFeatures: Int,
-                                      nBlocks: Int, rankId: Int): CSRNumericTable = {
-    // Use little endian
-    buffer.order(ByteOrder.LITTLE_ENDIAN)
-
-    val ratingsNum = info.getRatingsNum
-    val csrRowNum = info.getCsrRowNum
-    val values = Array.fill(ratingsNum) {
-      0.0f
-    }
-    val columnIndices = Array.fill(ratingsNum) {
-      0L
-    }
-    val rowOffsets = ArrayBuffer[Long](1L)
-
-    var index = 0
-    var curRow = 0L
-    // Each partition converted to one CSRNumericTable
-    for (i <- 0 until ratingsNum) {
-      // Modify row index for each partition (start from 0)
-      val row = buffer.getLong(i * RATING_SIZE) - getPartitionOffset(rankId, nFeatures, nBlocks)
-      val column = buffer.getLong(i * RATING_SIZE + 8)
-      val rating = buffer.getFloat(i * RATING_SIZE + 16)
-
-      values(index) = rating
-      // one-based index
-      columnIndices(index) = column + 1
-
-      if (row > curRow) {
-        // multiple rows with zero elements
-        for (i <- 0 until (row - curRow).toInt) {
-          // one-based indexValues
-          rowOffsets += index + 1
-        }
-        curRow = row
-      }
-
-      index = index + 1
-    }
-    // one-based row index
-    rowOffsets += index + 1
-
-    // check CSR encoding
-    assert(values.length == ratingsNum,
-      "the length of values should be equal to the number of non-zero elements")
-    assert(columnIndices.length == ratingsNum,
-      "the length of columnIndices should be equal to the number of non-zero elements")
-    assert(rowOffsets.size == (csrRowNum + 1),
-      "the size of rowOffsets should be equal to the number of rows + 1")
-
-    val contextLocal = new DaalContext()
-    val cTable = OneDAL.cNewCSRNumericTableFloat(values, columnIndices, rowOffsets.toArray,
-      nVectors, csrRowNum)
-    val table = new CSRNumericTable(contextLocal, cTable)
-
-    table
-  }
-
-  private def getPartitionOffset(partitionId: Int, nRatings: Int, nBlocks: Int): Int = {
-    require(partitionId >= 0 && partitionId < nBlocks)
-    val itemsInBlock = nRatings / nBlocks
-    return partitionId * itemsInBlock
-  }
-
-  // Return Map partitionId -> (ratingsNum, csrRowNum, rowOffset)
-  private def getRatingsPartitionInfo(data: RDD[Rating[ID]]): Map[Int, (Int, Int, Int)] = {
-    val collectd = data.mapPartitionsWithIndex { case (index: Int, it: Iterator[Rating[ID]]) =>
-      var ratingsNum = 0
-      var s = Set[ID]()
-      it.foreach { v =>
-        s += v.user
-        ratingsNum += 1
-      }
-      Iterator((index, (ratingsNum, s.count(_ => true))))
-    }.collect
-
-    var ret = Map[Int, (Int, Int, Int)]()
-    var rowOffset = 0
-    collectd.foreach { v =>
-      val partitionId = v._1
-      val ratingsNum = v._2._1
-      val csrRowNum = v._2._2
-      ret += (partitionId -> (ratingsNum, csrRowNum, rowOffset))
-      rowOffset = rowOffset + csrRowNum
-    }
-
-    ret
-  }
-
-  // Single entry to call Implict ALS DAL backend
-  @native private def cDALImplictALS(data: Long,
+  // Single entry to call ALS DAL backend, explicit feedback if implicitPrefs is false
+  @native private def cDALImplictALS(context: Long,
+                                     data: Long,
                                      nUsers: Long,
                                      nFactors: Int,
                                      maxIter: Int,
+                                     tolerance: Double,
                                      regParam: Double,
                                      alpha: Double,
+                                     seed: Long,
+                                     implicitPrefs: Boolean,
                                      executor_num: Int,
                                      executor_cores: Int,
                                      rankId: Int,
                                      result: ALSResult): Long
 
-  @native private def cShuffleData(data: ByteBuffer,
+  // Create and release the native state of one ALS training job
+  @native private def cCreateContext(): Long
+
+  @native private def cReleaseContext(context: Long): Unit
+
+  @native private def cShuffleData(context: Long,
+                                   data: ByteBuffer,
                                    nTotalKeys: Int,
+                                   nColumns: Int,
                                    nBlocks: Int,
-                                   info: ALSPartitionInfo): ByteBuffer
+                                   balanced: Boolean,
+                                   maxRoundBytes: Long,
+                                   ratingEncoding: Int,
+                                   info: ALSPartitionInfo): Long
 }
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.intel.oap.mllib.recommendation
+
+import com.intel.oap.mllib.Utils.getOneCCLIPPort
+import com.intel.oap.mllib.{CommonJob, OneCCL, Utils}
+import org.apache.spark.internal.Logging
+import org.apache.spark.ml.recommendation.ALSModel
+import org.apache.spark.rdd.RDD
+import org.apache.spark.sql.{DataFrame, Row}
+import org.apache.spark.sql.types.{ArrayType, FloatType, IntegerType, StructField, StructType}
+
+import java.nio.{ByteBuffer, ByteOrder}
+
+/**
+ * Top `num` dst rows by dot product for every src row. Each executor holds a block of src
+ * factors and a block of dst factors, dst blocks are passed around a ring of the oneCCL ranks
+ * so every src block is scored against every dst block natively.
+ */
+class ALSRecommendDALImpl(srcFactors: RDD[(Int, Array[Float])],
+                          dstFactors: RDD[(Int, Array[Float])],
+                          rank: Int,
+                          num: Int) extends Serializable with Logging {
+
+  def recommend(): RDD[(Int, Array[(Int, Float)])] = {
+    val sparkContext = srcFactors.sparkContext
+    val executorNum = Utils.sparkExecutorNum(sparkContext)
+    val executorCores = Utils.sparkExecutorCores()
+
+    // Fewer recommendations if there are not enough dst rows
+    val k = math.min(num.toLong, dstFactors.count()).toInt
+    if (k == 0) {
+      return srcFactors.map { case (id, _) => (id, Array.empty[(Int, Float)]) }
+    }
+
+    val blocks = srcFactors.repartition(executorNum)
+      .zipPartitions(dstFactors.repartition(executorNum)) { (src, dst) =>
+        Iterator((src.toArray, dst.toArray))
+      }.setName("Factor blocks for recommendation").cache()
+
+    val kvsIPPort = getOneCCLIPPort(blocks)
+
+    CommonJob.initCCLAndSetAffinityMask(blocks, executorNum, kvsIPPort, "CPU")
+
+    val results = blocks.flatMap { case (src, dst) =>
+      val srcBuffer = factorsToByteBuffer(src)
+      val dstIdsBuffer = idsToByteBuffer(dst)
+      val dstBuffer = factorsToByteBuffer(dst)
+      val recIdsBuffer = allocate(src.length * k)
+      val recScoresBuffer = allocate(src.length * k)
+
+      cRecommendForAll(srcBuffer, src.length, dstIdsBuffer, dstBuffer, dst.length, rank, k,
+        executorCores, recIdsBuffer, recScoresBuffer)
+      OneCCL.cleanup()
+
+      val recIds = recIdsBuffer.asIntBuffer()
+      val recScores = recScoresBuffer.asFloatBuffer()
+      src.indices.map { i =>
+        val recs = Array.tabulate(k) { j => (recIds.get(i * k + j), recScores.get(i * k + j)) }
+        (src(i)._1, recs)
+      }
+    }.setName("Recommendations").cache()
+
+    results.count()
+    blocks.unpersist()
+
+    results
+  }
+
+  private def allocate(n: Int): ByteBuffer =
+    ByteBuffer.allocateDirect(n * 4).order(ByteOrder.nativeOrder())
+
+  private def idsToByteBuffer(factors: Array[(Int, Array[Float])]): ByteBuffer = {
+    val buffer = allocate(factors.length)
+    factors.foreach { case (id, _) => buffer.putInt(id) }
+    buffer
+  }
+
+  private def factorsToByteBuffer(factors: Array[(Int, Array[Float])]): ByteBuffer = {
+    val buffer = allocate(factors.length * rank)
+    factors.foreach { case (_, features) => features.foreach(buffer.putFloat) }
+    buffer
+  }
+
+  @native private def cRecommendForAll(srcFactors: ByteBuffer,
+                                       nSrc: Int,
+                                       dstIds: ByteBuffer,
+                                       dstFactors: ByteBuffer,
+                                       nDst: Int,
+                                       rank: Int,
+                                       num: Int,
+                                       executorCores: Int,
+                                       recIds: ByteBuffer,
+                                       recScores: ByteBuffer): Unit
+}
+
+/**
+ * `recommendForAllUsers` and `recommendForAllItems` of [[ALSModel]] computed by
+ * [[ALSRecommendDALImpl]], with the same output as Spark. Falls back to Spark if OAP MLlib is
+ * not enabled or the cluster is not supported.
+ */
+object ALSRecommendDALImpl extends Logging {
+
+  def recommendForAllUsers(model: ALSModel, numItems: Int): DataFrame = {
+    if (!useDAL(model)) {
+      return model.recommendForAllUsers(numItems)
+    }
+    recommendForAll(model, model.userFactors, model.itemFactors, model.getUserCol,
+      model.getItemCol, numItems)
+  }
+
+  def recommendForAllItems(model: ALSModel, numUsers: Int): DataFrame = {
+    if (!useDAL(model)) {
+      return model.recommendForAllItems(numUsers)
+    }
+    recommendForAll(model, model.itemFactors, model.userFactors, model.getItemCol,
+      model.getUserCol, numUsers)
+  }
+
+  private def useDAL(model: ALSModel): Boolean = {
+    val sparkContext = model.userFactors.sparkSession.sparkContext
+    Utils.isOAPEnabled() && Utils.checkClusterPlatformCompatibility(sparkContext)
+  }
+
+  private def recommendForAll(model: ALSModel,
+                              srcFactors: DataFrame,
+                              dstFactors: DataFrame,
+                              srcOutputColumn: String,
+                              dstOutputColumn: String,
+                              num: Int): DataFrame = {
+    def toRDD(factors: DataFrame): RDD[(Int, Array[Float])] = factors.rdd.map { row =>
+      (row.getInt(0), row.getSeq[Float](1).toArray)
+    }
+
+    val recommendations = new ALSRecommendDALImpl(toRDD(srcFactors), toRDD(dstFactors),
+      model.rank, num).recommend()
+
+    val schema = StructType(Seq(
+      StructField(srcOutputColumn, IntegerType),
+      StructField("recommendations", ArrayType(StructType(Seq(
+        StructField(dstOutputColumn, IntegerType),
+        StructField("rating", FloatType)))))))
+    val rows = recommendations.map { case (id, recs) =>
+      Row(id, recs.map { case (dstId, score) => Row(dstId, score) }.toSeq)
+    }
+    srcFactors.sparkSession.createDataFrame(rows, schema)
+  }
+}
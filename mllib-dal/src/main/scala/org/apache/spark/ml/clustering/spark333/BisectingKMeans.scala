@@ -0,0 +1,157 @@
+// scalastyle:off
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// scalastyle:on
+
+package org.apache.spark.ml.clustering.spark333
+
+import com.intel.oap.mllib.{OneDAL, Utils}
+import com.intel.oap.mllib.clustering.{BisectingKMeansDALImpl, BisectingKMeansShim}
+
+import org.apache.spark.annotation.Since
+import org.apache.spark.ml.clustering.{BisectingKMeans => SparkBisectingKMeans, _}
+import org.apache.spark.ml.functions.checkNonNegativeWeight
+import org.apache.spark.ml.linalg.Vector
+import org.apache.spark.ml.param._
+import org.apache.spark.ml.util._
+import org.apache.spark.ml.util.Instrumentation.instrumented
+import org.apache.spark.mllib.clustering.{BisectingKMeans => MLlibBisectingKMeans, BisectingKMeansModel => MLlibBisectingKMeansModel}
+import org.apache.spark.mllib.linalg.{Vectors => OldVectors}
+import org.apache.spark.rdd.RDD
+import org.apache.spark.sql.{Dataset, Row}
+import org.apache.spark.sql.functions._
+import org.apache.spark.sql.types.DoubleType
+import org.apache.spark.storage.StorageLevel
+
+/**
+ * A bisecting k-means algorithm based on the paper "A comparison of document clustering techniques"
+ * by Steinbach, Karypis, and Kumar, with modification to fit Spark.
+ *
+ * @see <a href="http://glaros.dtc.umn.edu/gkhome/fetch/papers/docclusterKDDTMW00.pdf">
+ * Steinbach, Karypis, and Kumar, A comparison of document clustering techniques,
+ * KDD Workshop on Text Mining, 2000.</a>
+ */
+@Since("2.0.0")
+class BisectingKMeans @Since("2.0.0") (
+    @Since("2.0.0") override val uid: String)
+  extends SparkBisectingKMeans with BisectingKMeansShim {
+
+  override def initShim(params: ParamMap): Unit = {
+    params.toSeq.foreach { paramMap.put(_) }
+  }
+
+  @Since("2.0.0")
+  override def fit(dataset: Dataset[_]): BisectingKMeansModel = instrumented { instr =>
+    transformSchema(dataset.schema, logging = true)
+
+    instr.logPipelineStage(this)
+    instr.logDataset(dataset)
+    instr.logParams(this, featuresCol, predictionCol, k, maxIter, seed,
+      minDivisibleClusterSize, distanceMeasure, weightCol)
+
+    val handleWeight = isDefined(weightCol) && $(weightCol).nonEmpty
+    val w = if (handleWeight) {
+      checkNonNegativeWeight(col($(weightCol)).cast(DoubleType))
+    } else {
+      lit(1.0)
+    }
+    val instances = dataset.select(DatasetUtils.columnToVector(dataset, getFeaturesCol), w)
+      .rdd.map { case Row(point: Vector, weight: Double) => (point, weight) }
+
+    val handlePersistence = (dataset.storageLevel == StorageLevel.NONE)
+
+    val isPlatformSupported = Utils.checkClusterPlatformCompatibility(
+      dataset.sparkSession.sparkContext)
+    // Bisecting KMeans is only supported on CPU for dense data
+    val useDevice = dataset.sparkSession.sparkContext.getConf.get("spark.oap.mllib.device",
+      Utils.DefaultComputeDevice)
+    val useBisectingKMeansDAL = Utils.isOAPEnabled() && isPlatformSupported &&
+      useDevice != "GPU" && $(distanceMeasure) == "euclidean" && !handleWeight &&
+      OneDAL.isDenseDataset(dataset, $(featuresCol))
+
+    val parentModel = if (useBisectingKMeansDAL) {
+      trainWithDAL(instances, handlePersistence)
+    } else {
+      trainWithML(instances, handlePersistence)
+    }
+
+    val model = copyValues(new BisectingKMeansModel(uid, parentModel).setParent(this))
+
+    val summary = new BisectingKMeansSummary(
+      model.transform(dataset),
+      $(predictionCol),
+      $(featuresCol),
+      $(k),
+      $(maxIter),
+      parentModel.trainingCost)
+    instr.logNamedValue("clusterSizes", summary.clusterSizes)
+    instr.logNumFeatures(model.clusterCenters.head.size)
+    model.setSummary(Some(summary))
+  }
+
+  private def trainWithDAL(instances: RDD[(Vector, Double)],
+                           handlePersistence: Boolean): MLlibBisectingKMeansModel = {
+    val sc = instances.sparkContext
+
+    val executor_num = Utils.sparkExecutorNum(sc)
+    val executor_cores = Utils.sparkExecutorCores()
+
+    logInfo(s"BisectingKMeansDAL fit using $executor_num Executors")
+
+    val inputData = instances.map {
+      case (point: Vector, weight: Double) => point
+    }
+
+    if (handlePersistence) {
+      inputData.persist(StorageLevel.MEMORY_AND_DISK)
+      inputData.count()
+    }
+
+    val bisectingKMeansDAL = new BisectingKMeansDALImpl(getK, getMaxIter,
+      getMinDivisibleClusterSize, getSeed, $(distanceMeasure), executor_num, executor_cores)
+
+    val parentModel = bisectingKMeansDAL.train(inputData)
+
+    if (handlePersistence) {
+      inputData.unpersist()
+    }
+
+    parentModel
+  }
+
+  private def trainWithML(instances: RDD[(Vector, Double)],
+                          handlePersistence: Boolean): MLlibBisectingKMeansModel =
+    instrumented { instr =>
+      val oldVectorInstances = instances.map {
+        case (point: Vector, weight: Double) => (OldVectors.fromML(point), weight)
+      }
+      val bkm = new MLlibBisectingKMeans()
+        .setK($(k))
+        .setMaxIterations($(maxIter))
+        .setMinDivisibleClusterSize($(minDivisibleClusterSize))
+        .setSeed($(seed))
+        .setDistanceMeasure($(distanceMeasure))
+      bkm.runWithWeight(oldVectorInstances, handlePersistence, Some(instr))
+    }
+}
+
+@Since("2.0.0")
+object BisectingKMeans extends DefaultParamsReadable[BisectingKMeans] {
+
+  @Since("2.0.0")
+  override def load(path: String): BisectingKMeans = super.load(path)
+}
@@ -19,8 +19,8 @@
 
 package org.apache.spark.ml.clustering.spark333
 
-import com.intel.oap.mllib.Utils
-import com.intel.oap.mllib.clustering.{KMeansDALImpl, KMeansShim}
+import com.intel.oap.mllib.{OneDAL, Utils}
+import com.intel.oap.mllib.clustering.{KMeansDALImpl, KMeansDALTrace, KMeansShim}
 
 import org.apache.spark.annotation.Since
 import org.apache.spark.ml.clustering.{KMeans => SparkKMeans, _}
@@ -33,7 +33,7 @@ import org.apache.spark.mllib.clustering.{DistanceMeasure, KMeans => MLlibKMeans
 import org.apache.spark.mllib.linalg.{Vectors => OldVectors}
 import org.apache.spark.mllib.linalg.VectorImplicits._
 import org.apache.spark.rdd.RDD
-import org.apache.spark.sql.{Dataset, Row}
+import org.apache.spark.sql.{DataFrame, Dataset, Row}
 import org.apache.spark.sql.functions._
 import org.apache.spark.sql.types.DoubleType
 import org.apache.spark.storage.StorageLevel
@@ -74,22 +74,45 @@ class KMeans @Since("1.5.0") (
 
     val isPlatformSupported = Utils.checkClusterPlatformCompatibility(
       dataset.sparkSession.sparkContext)
+    // Cosine distance is only supported on CPU
+    val useDevice = dataset.sparkSession.sparkContext.getConf.get("spark.oap.mllib.device",
+      Utils.DefaultComputeDevice)
+    val isDistanceMeasureSupported = $(distanceMeasure) == "euclidean" ||
+      ($(distanceMeasure) == "cosine" && useDevice != "GPU")
     val useKMeansDAL = Utils.isOAPEnabled() && isPlatformSupported &&
-      $(distanceMeasure) == "euclidean" && !handleWeight
+      isDistanceMeasureSupported && !handleWeight
 
-    val model = if (useKMeansDAL) {
-      trainWithDAL(instances, handlePersistence)
+    val (model, trace) = if (useKMeansDAL) {
+      // The first row picks the table format, the conversion of each partition accepts any mix
+      // of dense and sparse rows
+      val isSparse = useDevice != "GPU" && !OneDAL.isDenseDataset(dataset, $(featuresCol))
+      trainWithDAL(instances, handlePersistence, isSparse)
     } else {
-      trainWithML(instances, handlePersistence)
+      (trainWithML(instances, handlePersistence), None)
     }
 
-    val summary = new KMeansSummary(
-      model.transform(dataset),
-      $(predictionCol),
-      $(featuresCol),
-      $(k),
-      model.parentModel.numIter,
-      model.parentModel.trainingCost)
+    // Cluster sizes of the native training save a pass over the predictions
+    val summary = trace match {
+      case Some(t) =>
+        instr.logNamedValue("objectiveHistory", t.objectiveHistory)
+        instr.logNamedValue("maxShiftHistory", t.maxShiftHistory)
+        new KMeansDALSummary(
+          model.transform(dataset),
+          $(predictionCol),
+          $(featuresCol),
+          $(k),
+          model.parentModel.numIter,
+          model.parentModel.trainingCost,
+          t.clusterSizes)
+      case None =>
+        new KMeansSummary(
+          model.transform(dataset),
+          $(predictionCol),
+          $(featuresCol),
+          $(k),
+          model.parentModel.numIter,
+          model.parentModel.trainingCost)
+    }
 
     model.setSummary(Some(summary))
     instr.logNamedValue("clusterSizes", summary.clusterSizes)
@@ -98,7 +121,9 @@ class KMeans @Since("1.5.0") (
   }
 
   private def trainWithDAL(instances: RDD[(Vector, Double)],
-                           handlePersistence: Boolean): KMeansModel = instrumented { instr =>
+                           handlePersistence: Boolean,
+                           isSparse: Boolean): (KMeansModel, Option[KMeansDALTrace]) =
+    instrumented { instr =>
 
     val sc = instances.sparkContext
 
@@ -111,41 +136,55 @@ class KMeans @Since("1.5.0") (
       instances.persist(StorageLevel.MEMORY_AND_DISK)
     }
 
-    val initStartTime = System.nanoTime()
+    val useDevice = sc.getConf.get("spark.oap.mllib.device", Utils.DefaultComputeDevice)
+    // Initial centers are computed natively on the oneCCL ranks for dense data on CPU when
+    // enabled, by default Spark picks them as the stock KMeans does
+    val useNativeInit = useDevice != "GPU" && !isSparse &&
+      sc.getConf.getBoolean("spark.oap.mllib.kmeans.nativeInit", false)
 
-    val distanceMeasureInstance = DistanceMeasure.decodeFromString($(distanceMeasure))
+    // Mini-batch training samples batchSize rows per executor each iteration
+    val trainingMode = sc.getConf.get("spark.oap.mllib.kmeans.mode", "full")
+    val batchSize = sc.getConf.getInt("spark.oap.mllib.kmeans.batchSize", 10000)
 
-    // Use MLlibKMeans to initialize centers
-    val mllibKMeans = new MLlibKMeans()
-      .setK($(k))
-      .setInitializationMode($(initMode))
-      .setInitializationSteps($(initSteps))
-      .setMaxIterations($(maxIter))
-      .setSeed($(seed))
-      .setEpsilon($(tol))
-      .setDistanceMeasure($(distanceMeasure))
+    val centers = if (useNativeInit) {
+      null
+    } else {
+      val initStartTime = System.nanoTime()
 
-    val dataWithNorm = instances.map {
-      case (point: Vector, weight: Double) => new VectorWithNorm(point)
-    }
+      val distanceMeasureInstance = DistanceMeasure.decodeFromString($(distanceMeasure))
 
-    // Cache for init
-    dataWithNorm.persist(StorageLevel.MEMORY_AND_DISK)
+      // Use MLlibKMeans to initialize centers
+      val mllibKMeans = new MLlibKMeans()
+        .setK($(k))
+        .setInitializationMode($(initMode))
+        .setInitializationSteps($(initSteps))
+        .setMaxIterations($(maxIter))
+        .setSeed($(seed))
+        .setEpsilon($(tol))
+        .setDistanceMeasure($(distanceMeasure))
 
-    val centersWithNorm = if ($(initMode) == "random") {
-      mllibKMeans.initRandom(dataWithNorm)
-    } else {
-      mllibKMeans.initKMeansParallel(dataWithNorm, distanceMeasureInstance)
-    }
+      val dataWithNorm = instances.map {
+        case (point: Vector, weight: Double) => new VectorWithNorm(point)
+      }
+
+      // Cache for init
+      dataWithNorm.persist(StorageLevel.MEMORY_AND_DISK)
 
-    dataWithNorm.unpersist()
+      val centersWithNorm = if ($(initMode) == "random") {
+        mllibKMeans.initRandom(dataWithNorm)
+      } else {
+        mllibKMeans.initKMeansParallel(dataWithNorm, distanceMeasureInstance)
+      }
+
+      dataWithNorm.unpersist()
 
-    val centers = centersWithNorm.map(_.vector)
+      val initTimeInSeconds = (System.nanoTime() - initStartTime) / 1e9
 
-    val initTimeInSeconds = (System.nanoTime() - initStartTime) / 1e9
+      val strInitMode = $(initMode)
+      logInfo(f"Initialization with $strInitMode took $initTimeInSeconds%.3f seconds.")
 
-    val strInitMode = $(initMode)
-    logInfo(f"Initialization with $strInitMode took $initTimeInSeconds%.3f seconds.")
+      centersWithNorm.map(_.vector)
+    }
 
     val inputData = instances.map {
       case (point: Vector, weight: Double) => point
@@ -157,9 +196,10 @@ class KMeans @Since("1.5.0") (
     }
 
     val kmeansDAL = new KMeansDALImpl(getK, getMaxIter, getTol,
-      DistanceMeasure.EUCLIDEAN, centers, executor_num, executor_cores)
+      $(distanceMeasure), centers, executor_num, executor_cores,
+      $(initMode), $(initSteps), $(seed), trainingMode, batchSize, $(seed), isSparse)
 
-    val parentModel = kmeansDAL.train(inputData)
+    val (parentModel, trace) = kmeansDAL.trainWithTrace(inputData)
 
     val model = copyValues(new KMeansModel(uid, parentModel).setParent(this))
 
@@ -167,7 +207,7 @@ class KMeans @Since("1.5.0") (
       instances.unpersist()
     }
 
-    model
+    (model, trace)
   }
 
   private def trainWithML(instances: RDD[(Vector, Double)],
@@ -189,6 +229,22 @@ class KMeans @Since("1.5.0") (
     }
 }
 
+/**
+ * Summary of a KMeans model trained natively, cluster sizes are computed by the training.
+ */
+private[clustering] class KMeansDALSummary(
+    predictions: DataFrame,
+    predictionCol: String,
+    featuresCol: String,
+    k: Int,
+    numIter: Int,
+    trainingCost: Double,
+    sizes: Array[Long])
+  extends KMeansSummary(predictions, predictionCol, featuresCol, k, numIter, trainingCost) {
+
+  override lazy val clusterSizes: Array[Long] = sizes
+}
+
 @Since("1.6.0")
 object KMeans extends DefaultParamsReadable[KMeans] {
 
@@ -234,9 +234,16 @@ class ALS extends DefaultParamsReadable[ALS] with Logging with ALSShim {
 
     val isPlatformSupported = DALUtils.checkClusterPlatformCompatibility(ratings.sparkContext)
 
+    // Nonnegative explicit feedback is only supported by MLlib. checkpointInterval only
+    // truncates the lineage of the MLlib iterations, numUserBlocks and numItemBlocks only
+    // partition the MLlib blocks, native factors are split among the executors.
+    // IDs are only checked if the fit could run natively
+    val dalImpl = new ALSDALImpl(ratings, rank, maxIter, regParam, alpha, seed, implicitPrefs,
+      intermediateRDDStorageLevel, finalRDDStorageLevel)
     val (userIdAndFactors, itemIdAndFactors) =
-      if (implicitPrefs && DALUtils.isOAPEnabled() && isPlatformSupported) {
-        new ALSDALImpl(ratings, rank, maxIter, regParam, alpha, seed).train()
+      if ((implicitPrefs || !nonnegative) && DALUtils.isOAPEnabled() && isPlatformSupported &&
+        dalImpl.isSupported) {
+        dalImpl.train()
       } else {
         trainMLlib(ratings, rank, numUserBlocks, numItemBlocks, maxIter, regParam, implicitPrefs,
           alpha, nonnegative, intermediateRDDStorageLevel, finalRDDStorageLevel,
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2020 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.apache.spark.mllib.clustering
+
+import org.apache.spark.mllib.linalg.Vector
+
+/**
+ * Builds a [[BisectingKMeansModel]] from the clusters computed by the native bisecting k-means,
+ * the same way as BisectingKMeans.buildTree of Spark. Clusters are keyed by their index in the
+ * binary tree, the root is 1 and the children of i are 2i and 2i + 1.
+ */
+object BisectingKMeansTreeBuilder {
+  private val rootIndex: Long = 1
+
+  def build(clusters: Map[Long, (Long, Double, Vector)],
+            distanceMeasure: String,
+            trainingCost: Double): BisectingKMeansModel = {
+    val distanceMeasureInstance = DistanceMeasure.decodeFromString(distanceMeasure)
+    var leafIndex = 0
+    var internalIndex = -1
+
+    def buildSubTree(rawIndex: Long): ClusteringTreeNode = {
+      val (size, cost, center) = clusters(rawIndex)
+      val centerWithNorm = new VectorWithNorm(center)
+      val childIndices = Seq(2 * rawIndex, 2 * rawIndex + 1).filter(clusters.contains)
+      if (childIndices.nonEmpty) {
+        val index = internalIndex
+        internalIndex -= 1
+        val height = childIndices.map { childIndex =>
+          val childCenter = new VectorWithNorm(clusters(childIndex)._3)
+          distanceMeasureInstance.distance(centerWithNorm, childCenter)
+        }.max
+        val children = childIndices.map(buildSubTree).toArray
+        new ClusteringTreeNode(index, size, centerWithNorm, cost, height, children)
+      } else {
+        val index = leafIndex
+        leafIndex += 1
+        new ClusteringTreeNode(index, size, centerWithNorm, cost, 0.0, Array.empty)
+      }
+    }
+
+    new BisectingKMeansModel(buildSubTree(rootIndex), distanceMeasure, trainingCost)
+  }
+}
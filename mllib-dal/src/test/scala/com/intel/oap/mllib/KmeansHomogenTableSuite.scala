@@ -50,7 +50,7 @@ class KmeansHomogenTableSuite extends FunctionsSuite with Logging {
         val gpuIndices = Array(0)
         val result = new KMeansResult();
         val centroids = kmeansDAL.cKMeansOneapiComputeWithInitCenters(0, dataTable.getcObejct(), sourceData.length, sourceData(0).length, centroidsTable.getcObejct(),10, 0.001,
-            5, 1, 1, TestCommon.getComputeDevice.ordinal(), gpuIndices, result);
+            5, 1, 1, TestCommon.getComputeDevice.ordinal(), "k-means||", 2, 0L, "auto", "full", 10000, 0L, "euclidean", "", 0, false, null, null, null, gpuIndices, result);
         val resultVectors = OneDAL.homogenTableToVectors(OneDAL.makeHomogenTable(centroids));
         assertArrayEquals(TestCommon.convertArray(expectCentroids), TestCommon.convertArray(resultVectors), 0.000001)
     }
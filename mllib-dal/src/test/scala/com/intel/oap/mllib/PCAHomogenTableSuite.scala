@@ -47,7 +47,8 @@ class PCAHomogenTableSuite extends FunctionsSuite with Logging {
         val pcaDAL = new PCADALImpl(5, 1, 1)
         val gpuIndices = Array(0)
         val result = new PCAResult()
-        pcaDAL.cPCATrainDAL(0, dataTable.getcObejct(), sourceData.length, sourceData(0).length, 1,  1, TestCommon.getComputeDevice.ordinal(), gpuIndices, result);
+        pcaDAL.cPCATrainDAL(0, dataTable.getcObejct(), sourceData.length, sourceData(0).length,
+            sourceData(0).length, false, 0L, false, 1, 1, TestCommon.getComputeDevice.ordinal(), gpuIndices, result);
         val pcNumericTable = OneDAL.makeHomogenTable(result.getPcNumericTable)
         val explainedVarianceNumericTable = OneDAL.makeHomogenTable(
             result.getExplainedVarianceNumericTable)
@@ -79,7 +80,8 @@ class PCAHomogenTableSuite extends FunctionsSuite with Logging {
         val pcaDAL = new PCADALImpl(5, 1, 1)
         val gpuIndices = Array(0)
         val result = new PCAResult()
-        pcaDAL.cPCATrainDAL(0, dataTable.getcObejct(), sourceData.length, sourceData(0).length, 1, 1, TestCommon.getComputeDevice.ordinal(), gpuIndices, result);
+        pcaDAL.cPCATrainDAL(0, dataTable.getcObejct(), sourceData.length, sourceData(0).length,
+            sourceData(0).length, false, 0L, false, 1, 1, TestCommon.getComputeDevice.ordinal(), gpuIndices, result);
         val pcNumericTable = OneDAL.makeHomogenTable(result.getPcNumericTable)
         val explainedVarianceNumericTable = OneDAL.makeHomogenTable(
             result.getExplainedVarianceNumericTable)
@@ -17,7 +17,13 @@
 
 package org.apache.spark.ml.clustering
 
+import java.nio.{ByteBuffer, ByteOrder}
+import java.nio.file.Files
+
 import scala.util.Random
+import com.intel.oap.mllib.Utils
+import com.intel.oap.mllib.clustering.KMeansDALImpl
+import com.intel.oneapi.dal.table.Common
 import org.dmg.pmml.PMML
 import org.dmg.pmml.clustering.ClusteringModel
 import org.apache.spark.{SparkConf, SparkException, TestCommon}
@@ -27,6 +33,7 @@ import org.apache.spark.ml.util.{DefaultReadWriteTest, MLTest, MLTestingUtils, P
 import org.apache.spark.ml.util.TestingUtils._
 import org.apache.spark.mllib.clustering.{DistanceMeasure, KMeans => MLlibKMeans, KMeansModel => MLlibKMeansModel}
 import org.apache.spark.mllib.linalg.{Vectors => MLlibVectors}
+import org.apache.spark.rdd.RDD
 import org.apache.spark.sql.{DataFrame, Dataset, SparkSession}
 
 private[clustering] case class TestRow(features: Vector)
@@ -49,6 +56,43 @@ class MLlibKMeansSuite extends MLTest with DefaultReadWriteTest with PMMLReadWri
     conf.set("spark.oap.mllib.device", TestCommon.getComputeDevice.toString)
   }
 
+  // Native kernels selected by the spark.oap.mllib.kmeans settings only run on CPU
+  private def assumeCPU(): Unit = {
+    assume(TestCommon.getComputeDevice != Common.ComputeDevice.GPU)
+  }
+
+  private def withConf[T](settings: (String, String)*)(body: => T): T = {
+    val conf = spark.sparkContext.conf
+    val previous = settings.map { case (key, _) => key -> conf.getOption(key) }
+    settings.foreach { case (key, value) => conf.set(key, value) }
+    try {
+      body
+    } finally {
+      previous.foreach {
+        case (key, Some(value)) => conf.set(key, value)
+        case (key, None) => conf.remove(key)
+      }
+    }
+  }
+
+  private def newKMeansDAL(k: Int,
+                           maxIter: Int,
+                           tol: Double,
+                           distanceMeasure: String,
+                           initialCenters: Array[Vector],
+                           initMode: String = MLlibKMeans.K_MEANS_PARALLEL,
+                           seed: Long = 1L): KMeansDALImpl = {
+    val centers = if (initialCenters == null) null else initialCenters.map(MLlibVectors.fromML)
+    new KMeansDALImpl(k, maxIter, tol, distanceMeasure, centers,
+      Utils.sparkExecutorNum(spark.sparkContext), Utils.sparkExecutorCores(),
+      initMode = initMode, seed = seed)
+  }
+
+  private def assertSameCenters(actual: Array[Vector], expected: Array[Vector]): Unit = {
+    assert(actual.length === expected.length)
+    actual.zip(expected).foreach { case (a, e) => assert(a ~== e absTol 1e-6) }
+  }
+
   test("default parameters") {
     val kmeans = new KMeans()
 
@@ -219,6 +263,270 @@ class MLlibKMeansSuite extends MLTest with DefaultReadWriteTest with PMMLReadWri
     assert(trueCost ~== floatArrayCost absTol 1e-6)
   }
 
+  test("KMeans with mixed dense and sparse rows") {
+    val points = Seq(
+      Vectors.sparse(3, Array(0), Array(1.0)),
+      Vectors.dense(1.1, 0.0, 0.0),
+      Vectors.dense(0.0, 10.0, 0.0),
+      Vectors.sparse(3, Array(1), Array(10.2)),
+      Vectors.sparse(3, Array(2), Array(-5.0)),
+      Vectors.dense(0.0, 0.0, -5.1))
+    // Three partitions, the second and the third start with a dense row
+    val mixed = spark.createDataFrame(
+      spark.sparkContext.parallelize(points, 3).map(v => TestRow(v)))
+    val dense = spark.createDataFrame(
+      spark.sparkContext.parallelize(points.map(_.toDense), 3).map(v => TestRow(v)))
+
+    def fit(df: DataFrame): KMeansModel = new KMeans().setK(3).setSeed(1).setMaxIter(10).fit(df)
+    val mixedModel = fit(mixed)
+    val denseModel = fit(dense)
+    assert(mixedModel.summary.trainingCost ~== denseModel.summary.trainingCost absTol 1e-6)
+
+    val predictions = mixedModel.transform(mixed).collect().map(row =>
+      row.getAs[Vector]("features").toDense -> row.getAs[Int]("prediction")).toMap
+    assert(predictions.values.toSet.size == 3)
+    assert(predictions(Vectors.dense(1.0, 0.0, 0.0)) == predictions(Vectors.dense(1.1, 0.0, 0.0)))
+    assert(predictions(Vectors.dense(0.0, 10.0, 0.0)) == predictions(Vectors.dense(0.0, 10.2, 0.0)))
+    assert(predictions(Vectors.dense(0.0, 0.0, -5.0)) == predictions(Vectors.dense(0.0, 0.0, -5.1)))
+  }
+
+  test("cluster sizes of the summary match the predictions") {
+    val data = spark.createDataFrame(spark.sparkContext.parallelize(
+      Seq.tabulate(200)(i => Vectors.dense(i % 7, (i * 13) % 11)), 4).map(v => TestRow(v)))
+    // Centers still move in the last iteration
+    val model = new KMeans().setK(4).setSeed(7).setMaxIter(2).fit(data)
+    val predictedSizes = model.transform(data).groupBy("prediction").count().collect()
+      .map(row => row.getInt(0) -> row.getLong(1)).toMap
+    val summarySizes = model.summary.clusterSizes
+    assert(summarySizes.sum == 200)
+    summarySizes.zipWithIndex.foreach { case (size, cluster) =>
+      assert(size == predictedSizes.getOrElse(cluster, 0L))
+    }
+  }
+
+  test("native training matches Spark KMeans from the same initial centers") {
+    assumeCPU()
+    val data = KMeansSuite.generateUniformData(spark, 400, 3, 11)
+    val initialCenters = data.take(6)
+
+    val nativeModel = newKMeansDAL(6, 50, 1e-9, DistanceMeasure.EUCLIDEAN, initialCenters)
+      .train(data)
+    val sparkModel = new MLlibKMeans().setK(6).setMaxIterations(50).setEpsilon(1e-9)
+      .setInitialModel(new MLlibKMeansModel(initialCenters.map(MLlibVectors.fromML)))
+      .run(data.map(MLlibVectors.fromML))
+
+    assertSameCenters(nativeModel.clusterCenters.map(_.asML), sparkModel.clusterCenters.map(_.asML))
+    assert(nativeModel.trainingCost ~== sparkModel.trainingCost relTol 1e-6)
+  }
+
+  test("native k-means|| and random initialization") {
+    assumeCPU()
+    val data = KMeansSuite.generateBlobs(spark, 400, 3, 5)
+    val corners = Seq(Vectors.dense(0.0, 0.0, 0.0), Vectors.dense(10.0, 0.0, 0.0),
+      Vectors.dense(0.0, 10.0, 0.0), Vectors.dense(10.0, 10.0, 0.0))
+
+    Seq(MLlibKMeans.K_MEANS_PARALLEL, MLlibKMeans.RANDOM).foreach { initMode =>
+      // Without initial centers they are picked natively, the same seed picks the same ones
+      def train(): MLlibKMeansModel = newKMeansDAL(4, 20, 1e-6, DistanceMeasure.EUCLIDEAN, null,
+        initMode, seed = 3).train(data)
+      val model = train()
+      assert(model.clusterCenters.length === 4)
+      assertSameCenters(model.clusterCenters.map(_.asML), train().clusterCenters.map(_.asML))
+
+      // k-means|| seeds one center in each blob
+      if (initMode == MLlibKMeans.K_MEANS_PARALLEL) {
+        corners.foreach { corner =>
+          assert(model.clusterCenters.exists(c => Vectors.sqdist(c.asML, corner) < 0.01))
+        }
+      }
+    }
+  }
+
+  test("native initialization is enabled by configuration") {
+    assumeCPU()
+    val df = spark.createDataFrame(KMeansSuite.generateBlobs(spark, 400, 3, 5).map(TestRow(_)))
+    val corners = Seq(Vectors.dense(0.0, 0.0, 0.0), Vectors.dense(10.0, 0.0, 0.0),
+      Vectors.dense(0.0, 10.0, 0.0), Vectors.dense(10.0, 10.0, 0.0))
+
+    def fit(): KMeansModel = new KMeans().setK(4).setSeed(3).fit(df)
+    val sparkInitModel = fit()
+    val nativeInitModel = withConf("spark.oap.mllib.kmeans.nativeInit" -> "true")(fit())
+    Seq(sparkInitModel, nativeInitModel).foreach { model =>
+      corners.foreach { corner =>
+        assert(model.clusterCenters.exists(c => Vectors.sqdist(c, corner) < 0.01))
+      }
+    }
+  }
+
+  test("Hamerly local step gives the same centers as oneDAL") {
+    assumeCPU()
+    val data = KMeansSuite.generateUniformData(spark, 500, 5, 17)
+    val initialCenters = data.take(8)
+
+    def train(localStep: String): MLlibKMeansModel = {
+      withConf("spark.oap.mllib.kmeans.localStep" -> localStep) {
+        newKMeansDAL(8, 30, 1e-9, DistanceMeasure.EUCLIDEAN, initialCenters).train(data)
+      }
+    }
+    val hamerlyModel = train("hamerly")
+    val lloydModel = train("oneDAL")
+
+    assertSameCenters(hamerlyModel.clusterCenters.map(_.asML),
+      lloydModel.clusterCenters.map(_.asML))
+    assert(hamerlyModel.numIter === lloydModel.numIter)
+    assert(hamerlyModel.trainingCost ~== lloydModel.trainingCost relTol 1e-9)
+  }
+
+  test("mini-batch training converges to the full training centers") {
+    assumeCPU()
+    val data = KMeansSuite.generateBlobs(spark, 2000, 2, 23)
+    val initialCenters = Array(Vectors.dense(1.0, 1.0), Vectors.dense(9.0, 1.0),
+      Vectors.dense(1.0, 9.0), Vectors.dense(9.0, 9.0))
+
+    val fullModel = newKMeansDAL(4, 200, 1e-6, DistanceMeasure.EUCLIDEAN, initialCenters)
+      .train(data)
+    def trainMiniBatch(data: RDD[Vector], sparse: Boolean): MLlibKMeansModel =
+      new KMeansDALImpl(4, 200, 1e-2, DistanceMeasure.EUCLIDEAN,
+        initialCenters.map(MLlibVectors.fromML), Utils.sparkExecutorNum(spark.sparkContext),
+        Utils.sparkExecutorCores(), mode = "minibatch", batchSize = 50, batchSeed = 7,
+        sparse = sparse).train(data)
+
+    // Batches of a CSR table are sampled as the rows of a dense one
+    Seq(trainMiniBatch(data, sparse = false),
+      trainMiniBatch(data.map(_.toSparse), sparse = true)).foreach { miniBatchModel =>
+      // Stops on the centroid shift before the iteration limit
+      assert(miniBatchModel.numIter < 200)
+      miniBatchModel.clusterCenters.zip(fullModel.clusterCenters).foreach { case (m, f) =>
+        assert(Vectors.sqdist(m.asML, f.asML) < 0.01)
+      }
+      assert(miniBatchModel.trainingCost < 1.1 * fullModel.trainingCost)
+    }
+  }
+
+  test("native cosine distance matches Spark's CosineDistanceMeasure") {
+    assumeCPU()
+    // Centered so rows point in all directions
+    val data = KMeansSuite.generateUniformData(spark, 300, 3, 29)
+      .map(v => Vectors.dense(v.toArray.map(_ - 0.5)))
+    val initialCenters = data.take(4)
+
+    val nativeModel = newKMeansDAL(4, 100, 1e-12, DistanceMeasure.COSINE, initialCenters)
+      .train(data)
+    val sparkModel = new MLlibKMeans().setK(4).setMaxIterations(100).setEpsilon(1e-12)
+      .setDistanceMeasure(DistanceMeasure.COSINE)
+      .setInitialModel(new MLlibKMeansModel(initialCenters.map(MLlibVectors.fromML),
+        DistanceMeasure.COSINE, 0.0, -1))
+      .run(data.map(MLlibVectors.fromML))
+
+    assertSameCenters(nativeModel.clusterCenters.map(_.asML), sparkModel.clusterCenters.map(_.asML))
+    assert(nativeModel.trainingCost ~== sparkModel.trainingCost relTol 1e-6)
+  }
+
+  test("native cosine distance converges as Spark with the default tolerance") {
+    assumeCPU()
+    val data = KMeansSuite.generateUniformData(spark, 300, 3, 37)
+      .map(v => Vectors.dense(v.toArray.map(_ - 0.5)))
+    val initialCenters = data.take(4)
+    val tol = new KMeans().getTol
+
+    val nativeModel = newKMeansDAL(4, 100, tol, DistanceMeasure.COSINE, initialCenters)
+      .train(data)
+    val sparkModel = new MLlibKMeans().setK(4).setMaxIterations(100).setEpsilon(tol)
+      .setDistanceMeasure(DistanceMeasure.COSINE)
+      .setInitialModel(new MLlibKMeansModel(initialCenters.map(MLlibVectors.fromML),
+        DistanceMeasure.COSINE, 0.0, -1))
+      .run(data.map(MLlibVectors.fromML))
+
+    // Both stop once no center moved more than tol in cosine distance
+    assert(nativeModel.numIter === sparkModel.numIter)
+    assertSameCenters(nativeModel.clusterCenters.map(_.asML), sparkModel.clusterCenters.map(_.asML))
+    assert(nativeModel.trainingCost ~== sparkModel.trainingCost relTol 1e-6)
+  }
+
+  test("native predict matches the model") {
+    assumeCPU()
+    val data = KMeansSuite.generateUniformData(spark, 300, 4, 31)
+    Seq(DistanceMeasure.EUCLIDEAN, DistanceMeasure.COSINE).foreach { distanceMeasure =>
+      val kmeansDAL = newKMeansDAL(5, 10, 1e-6, distanceMeasure, data.take(5))
+      val model = kmeansDAL.train(data)
+      val centers = model.clusterCenters.map(_.asML)
+
+      val predictions = kmeansDAL.predict(data, centers).collect()
+      val rows = data.collect()
+      assert(predictions.length === rows.length)
+      rows.zip(predictions).foreach { case (row, (cluster, distance)) =>
+        assert(cluster === model.predict(MLlibVectors.fromML(row)))
+        val expected = if (distanceMeasure == DistanceMeasure.COSINE) {
+          val center = centers(cluster)
+          1.0 - row.dot(center) / (Vectors.norm(row, 2) * Vectors.norm(center, 2))
+        } else {
+          math.sqrt(Vectors.sqdist(row, centers(cluster)))
+        }
+        assert(distance ~== expected absTol 1e-9)
+      }
+      assert(kmeansDAL.predict(data, centers, withDistances = false).map(_._1).collect() ===
+        predictions.map(_._1))
+    }
+  }
+
+  test("native predict of sparse rows matches dense rows") {
+    assumeCPU()
+    // Half of the values are zero, the first feature keeps rows non-zero for cosine distance
+    val dense = KMeansSuite.generateUniformData(spark, 300, 6, 37).map { v =>
+      Vectors.dense(v(0) +: v.toArray.tail.map(x => if (x < 0.5) 0.0 else x))
+    }
+    val sparse = dense.map(_.toSparse)
+    val centers = dense.take(5)
+    Seq(DistanceMeasure.EUCLIDEAN, DistanceMeasure.COSINE).foreach { distanceMeasure =>
+      def predict(data: RDD[Vector], isSparse: Boolean): Array[(Int, Double)] =
+        new KMeansDALImpl(5, 10, 1e-6, distanceMeasure, null,
+          Utils.sparkExecutorNum(spark.sparkContext), Utils.sparkExecutorCores(),
+          sparse = isSparse).predict(data, centers).collect()
+
+      val expected = predict(dense, isSparse = false)
+      val actual = predict(sparse, isSparse = true)
+      assert(actual.map(_._1) === expected.map(_._1))
+      actual.zip(expected).foreach { case ((_, distance), (_, expectedDistance)) =>
+        assert(distance ~== expectedDistance absTol 1e-9)
+      }
+    }
+  }
+
+  test("native training resumes from a checkpoint") {
+    assumeCPU()
+    val data = KMeansSuite.generateUniformData(spark, 400, 3, 23)
+    val initialCenters = data.take(5)
+    def train(maxIter: Int): MLlibKMeansModel =
+      newKMeansDAL(5, maxIter, 0.0, DistanceMeasure.EUCLIDEAN, initialCenters).train(data)
+    val fullModel = train(8)
+    val secondCenters = train(2).clusterCenters
+
+    // Checkpoint of the centers after 2 iterations as written by the native training
+    val checkpoint = ByteBuffer.allocate(8 + 3 * 8 + 5 * 3 * 8).order(ByteOrder.nativeOrder())
+    checkpoint.put("OAPKMCK1".getBytes("US-ASCII"))
+    checkpoint.putLong(5L).putLong(3L).putLong(2L)
+    secondCenters.foreach(_.toArray.foreach(checkpoint.putDouble))
+    val dir = Files.createTempDirectory("kmeans-checkpoint")
+    val path = dir.resolve("centers")
+    Files.write(path, checkpoint.array())
+
+    try {
+      val resumedModel = withConf(
+        "spark.oap.mllib.kmeans.checkpointPath" -> path.toString,
+        "spark.oap.mllib.kmeans.warmStart" -> "true") {
+        train(8)
+      }
+      assertSameCenters(resumedModel.clusterCenters.map(_.asML),
+        fullModel.clusterCenters.map(_.asML))
+      assert(resumedModel.numIter === fullModel.numIter)
+      // A finished training removes its checkpoint
+      assert(!Files.exists(path))
+    } finally {
+      Files.deleteIfExists(path)
+      Files.delete(dir)
+    }
+  }
+
   test("read/write") {
     def checkModelData(model: KMeansModel, model2: KMeansModel): Unit = {
       assert(model.clusterCenters === model2.clusterCenters)
@@ -490,6 +798,24 @@ object KMeansSuite {
     spark.createDataFrame(rdd)
   }
 
+  // Rows of uniform values in [0, 1) in 4 partitions
+  def generateUniformData(spark: SparkSession, rows: Int, dim: Int, seed: Int): RDD[Vector] = {
+    val random = new Random(seed)
+    val data = Seq.fill(rows)(Vectors.dense(Array.fill(dim)(random.nextDouble())))
+    spark.sparkContext.parallelize(data, 4)
+  }
+
+  // Rows around the 4 corners (0, 0), (10, 0), (0, 10) and (10, 10) of the first two features
+  def generateBlobs(spark: SparkSession, rows: Int, dim: Int, seed: Int): RDD[Vector] = {
+    val random = new Random(seed)
+    val data = Seq.tabulate(rows) { i =>
+      Vectors.dense(Array.tabulate(dim) { j =>
+        (if (j < 2) 10.0 * ((i >> j) & 1) else 0.0) + 0.1 * random.nextGaussian()
+      })
+    }
+    spark.sparkContext.parallelize(data, 4)
+  }
+
   def generateSparseData(spark: SparkSession, rows: Int, dim: Int, seed: Int): DataFrame = {
     val sc = spark.sparkContext
     val random = new Random(seed)
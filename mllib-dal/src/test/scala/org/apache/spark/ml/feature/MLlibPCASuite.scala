@@ -17,13 +17,20 @@
 
 package org.apache.spark.ml.feature
 
+import scala.util.Random
+
+import com.intel.oap.mllib.Utils
+import com.intel.oap.mllib.feature.PCADALImpl
+import com.intel.oneapi.dal.table.Common
+
 import org.apache.spark.{SparkConf, TestCommon}
 import org.apache.spark.ml.linalg.{DenseMatrix, DenseVector, Matrices, Vector, Vectors}
 import org.apache.spark.ml.param.ParamsSuite
 import org.apache.spark.ml.util.TestingUtils._
 import org.apache.spark.ml.util.{DefaultReadWriteTest, MLTest, MLTestingUtils}
 import org.apache.spark.mllib.linalg.distributed.RowMatrix
-import org.apache.spark.mllib.linalg.{Vectors => OldVectors}
+import org.apache.spark.mllib.linalg.{DenseMatrix => OldDenseMatrix, Vectors => OldVectors}
+import org.apache.spark.rdd.RDD
 import org.apache.spark.sql.Row
 
 class MLlibPCASuite extends MLTest with DefaultReadWriteTest {
@@ -34,6 +41,46 @@ class MLlibPCASuite extends MLTest with DefaultReadWriteTest {
     conf.set("spark.oap.mllib.device", TestCommon.getComputeDevice.toString)
   }
 
+  private def withConf[T](settings: (String, String)*)(body: => T): T = {
+    val conf = sc.conf
+    val previous = settings.map { case (key, _) => key -> conf.getOption(key) }
+    settings.foreach { case (key, value) => conf.set(key, value) }
+    try {
+      body
+    } finally {
+      previous.foreach {
+        case (key, Some(value)) => conf.set(key, value)
+        case (key, None) => conf.remove(key)
+      }
+    }
+  }
+
+  // Rows with the given variances along the axes, rotated by a Householder reflection so the
+  // principal components are not axis aligned
+  private def generateData(rows: Int, variances: Array[Double], seed: Long): RDD[Vector] = {
+    val random = new Random(seed)
+    val v = Array.fill(variances.length)(random.nextGaussian())
+    val vv = v.map(x => x * x).sum
+    val data = Seq.fill(rows) {
+      val x = variances.map(variance => math.sqrt(variance) * random.nextGaussian())
+      val vx = v.zip(x).map { case (a, b) => a * b }.sum
+      Vectors.dense(x.indices.map(i => x(i) - 2 * vx / vv * v(i)).toArray)
+    }
+    sc.parallelize(data, 4)
+  }
+
+  // Components are compared up to their sign
+  private def assertSamePCA(pc: DenseMatrix,
+                            explainedVariance: DenseVector,
+                            expectedPC: DenseMatrix,
+                            expectedVariance: DenseVector): Unit = {
+    assert(explainedVariance ~== expectedVariance absTol 1e-6)
+    pc.colIter.zip(expectedPC.colIter).foreach { case (actual, expected) =>
+      val sign = if (actual.dot(expected) < 0) -1.0 else 1.0
+      assert(Vectors.dense(actual.toArray.map(_ * sign)) ~== expected absTol 1e-5)
+    }
+  }
+
   test("params") {
     ParamsSuite.checkParams(new PCA)
     val mat = Matrices.dense(2, 2, Array(0.0, 1.0, 2.0, 3.0)).asInstanceOf[DenseMatrix]
@@ -95,6 +142,145 @@ class MLlibPCASuite extends MLTest with DefaultReadWriteTest {
     }
   }
 
+  test("full solver over partitions with different means") {
+    // The partial covariances of the partitions are merged around different local means
+    val data = generateData(400, Array(8.0, 4.0, 2.0, 1.0, 0.5, 0.25), 13)
+      .mapPartitionsWithIndex { (index, rows) =>
+        rows.map(row => Vectors.dense(row.toArray.map(_ + 5.0 * index)))
+      }
+    val k = 3
+    val mat = new RowMatrix(data.map(OldVectors.fromML))
+    val (expectedPC, expectedVariance) = mat.computePrincipalComponentsAndExplainedVariance(k)
+
+    val pcaModel = new PCA().setInputCol("features").setK(k)
+      .fit(data.map(Tuple1(_)).toDF("features"))
+    assertSamePCA(pcaModel.pc, pcaModel.explainedVariance, expectedPC.asML, expectedVariance.asML)
+  }
+
+  test("randomized solver") {
+    val data = generateData(500, Array(10.0, 5.0, 2.0) ++ Array.fill(17)(0.1), 3)
+    val k = 3
+    val mat = new RowMatrix(data.map(OldVectors.fromML))
+    val (expectedPC, expectedVariance) = mat.computePrincipalComponentsAndExplainedVariance(k)
+
+    val df = data.map(Tuple1(_)).toDF("features")
+    val pcaModel = withConf("spark.oap.mllib.pca.solver" -> "randomized") {
+      new PCA().setInputCol("features").setK(k).fit(df)
+    }
+    assertSamePCA(pcaModel.pc, pcaModel.explainedVariance, expectedPC.asML, expectedVariance.asML)
+  }
+
+  test("repeated eigenvalues") {
+    // Pairs of opposite rows along 3 orthogonal directions give a covariance with one eigenvalue
+    // repeated 3 times, and pairs along a 4th direction a smaller one
+    val d = 10
+    val random = new Random(7)
+    val v = Array.fill(d)(random.nextGaussian())
+    val vv = v.map(x => x * x).sum
+    val data = Seq((2.0, 0), (2.0, 1), (2.0, 2), (1.0, 3)).flatMap { case (length, i) =>
+      // Axis i reflected by the Householder reflection of v
+      val direction = Array.tabulate(d)(j => (if (i == j) 1.0 else 0.0) - 2 * v(i) * v(j) / vv)
+      Seq(1.0, -1.0).map(sign => Vectors.dense(direction.map(_ * length * sign)))
+    }
+    val dataRDD = sc.parallelize(data, 2)
+    val k = 4
+    val mat = new RowMatrix(dataRDD.map(OldVectors.fromML))
+    val (expectedPC, expectedVariance) = mat.computePrincipalComponentsAndExplainedVariance(k)
+
+    val pcaModel = new PCA().setInputCol("features").setK(k)
+      .fit(dataRDD.map(Tuple1(_)).toDF("features"))
+    assert(pcaModel.explainedVariance ~== expectedVariance.asML absTol 1e-6)
+    // Components of the repeated eigenvalue are any basis of its eigenspace, so the projections
+    // on the eigenspace are compared
+    def projection(pc: DenseMatrix): DenseMatrix = {
+      val top = new DenseMatrix(d, 3, pc.colIter.take(3).flatMap(_.toArray).toArray)
+      top.multiply(top.transpose)
+    }
+    assert(projection(pcaModel.pc) ~== projection(expectedPC.asML) absTol 1e-6)
+    val component = pcaModel.pc.colIter.drop(3).next()
+    val expectedComponent = expectedPC.asML.colIter.drop(3).next()
+    val sign = if (component.dot(expectedComponent) < 0) -1.0 else 1.0
+    assert(Vectors.dense(component.toArray.map(_ * sign)) ~== expectedComponent absTol 1e-6)
+  }
+
+  test("full solver with a flat tail of eigenvalues") {
+    // k = 4 ends in the noise floor of 57 features of variance 1, whose sample eigenvalues are
+    // too close for the Lanczos basis to converge before the fallback to a full decomposition
+    val dataRDD = generateData(500, Array(30.0, 20.0, 10.0) ++ Array.fill(57)(1.0), 13)
+    val k = 4
+    val mat = new RowMatrix(dataRDD.map(OldVectors.fromML))
+    val (expectedPC, expectedVariance) = mat.computePrincipalComponentsAndExplainedVariance(k)
+
+    val pcaModel = new PCA().setInputCol("features").setK(k)
+      .fit(dataRDD.map(Tuple1(_)).toDF("features"))
+    assertSamePCA(pcaModel.pc, pcaModel.explainedVariance, expectedPC.asML,
+      expectedVariance.asML)
+  }
+
+  test("native transform matches PCAModel") {
+    assume(TestCommon.getComputeDevice != Common.ComputeDevice.GPU)
+    val data = generateData(300, Array(6.0, 3.0, 1.0, 0.5, 0.2), 11)
+    val df = data.map(Tuple1(_)).toDF("features")
+    val pcaModel = new PCA().setInputCol("features").setOutputCol("pcaFeatures").setK(3).fit(df)
+    val expected = pcaModel.transform(df).select("pcaFeatures").collect().map(_.getAs[Vector](0))
+
+    val pcaDAL = new PCADALImpl(3, Utils.sparkExecutorNum(sc), Utils.sparkExecutorCores())
+    val projected = pcaDAL.transform(data, OldDenseMatrix.fromML(pcaModel.pc)).collect()
+    assert(projected.length === expected.length)
+    projected.zip(expected).foreach { case (actual, e) => assert(actual ~== e absTol 1e-9) }
+
+    // Partitions split in several blocks, the last one partial
+    val blocked = pcaDAL.transform(data, OldDenseMatrix.fromML(pcaModel.pc), blockRows = 7)
+      .collect()
+    assert(blocked.length === projected.length)
+    blocked.zip(projected).foreach { case (actual, e) => assert(actual ~== e absTol 1e-12) }
+  }
+
+  test("incremental fit saves the covariance state of its rows") {
+    assume(TestCommon.getComputeDevice != Common.ComputeDevice.GPU)
+    val data = generateData(300, Array(5.0, 2.0, 1.0, 0.5), 17)
+    val k = 2
+    val pcaDAL = new PCADALImpl(k, Utils.sparkExecutorNum(sc), Utils.sparkExecutorCores())
+    val (model, state) = pcaDAL.trainIncremental(data, None)
+
+    val mat = new RowMatrix(data.map(OldVectors.fromML))
+    val (expectedPC, expectedVariance) = mat.computePrincipalComponentsAndExplainedVariance(k)
+    assertSamePCA(model.pc.asML, model.explainedVariance.asML, expectedPC.asML,
+      expectedVariance.asML)
+
+    // The cross-product is centered at the mean, (n - 1) times the covariance
+    val rows = data.collect()
+    assert(state.nObservations === rows.length)
+    assert(Vectors.dense(state.sum) ~==
+      Vectors.dense(rows.map(_.toArray).transpose.map(_.sum)) absTol 1e-8)
+    val covariance = mat.computeCovariance()
+    assert(Vectors.dense(state.crossProduct) ~==
+      Vectors.dense(Array.tabulate(16)(i => covariance(i / 4, i % 4) * (rows.length - 1)))
+      absTol 1e-6)
+  }
+
+  test("incremental fit merges the state of a previous fit") {
+    assume(TestCommon.getComputeDevice != Common.ComputeDevice.GPU)
+    val variances = Array(5.0, 2.0, 1.0, 0.5)
+    val first = generateData(300, variances, 17)
+    // Rows of the second fit have another mean
+    val second = generateData(200, variances, 19)
+      .map(row => Vectors.dense(row.toArray.map(_ + 3.0)))
+    val k = 2
+    val pcaDAL = new PCADALImpl(k, Utils.sparkExecutorNum(sc), Utils.sparkExecutorCores())
+
+    val (_, firstState) = pcaDAL.trainIncremental(first, None)
+    val (model, state) = pcaDAL.trainIncremental(second, Some(firstState))
+    val (unionModel, unionState) = pcaDAL.trainIncremental(first.union(second), None)
+
+    assert(state.nObservations === unionState.nObservations)
+    assert(Vectors.dense(state.sum) ~== Vectors.dense(unionState.sum) absTol 1e-8)
+    assert(Vectors.dense(state.crossProduct) ~== Vectors.dense(unionState.crossProduct)
+      absTol 1e-6)
+    assertSamePCA(model.pc.asML, model.explainedVariance.asML, unionModel.pc.asML,
+      unionModel.explainedVariance.asML)
+  }
+
   test("PCA read/write") {
     val t = new PCA()
       .setInputCol("myInputCol")
@@ -25,6 +25,7 @@ import scala.collection.mutable
 import scala.collection.mutable.{ArrayBuffer, WrappedArray}
 
 import com.github.fommil.netlib.BLAS.{getInstance => blas}
+import com.intel.oap.mllib.recommendation.ALSRecommendDALImpl
 import org.apache.commons.io.FileUtils
 import org.apache.commons.io.filefilter.TrueFileFilter
 import org.scalatest.BeforeAndAfterEach
@@ -63,6 +64,44 @@ class MLlibALSSuite extends MLTest with DefaultReadWriteTest with Logging {
     super.afterAll()
   }
 
+  private def withConf[T](settings: (String, String)*)(body: => T): T = {
+    val conf = sc.conf
+    val previous = settings.map { case (key, _) => key -> conf.getOption(key) }
+    settings.foreach { case (key, value) => conf.set(key, value) }
+    try {
+      body
+    } finally {
+      previous.foreach {
+        case (key, Some(value)) => conf.set(key, value)
+        case (key, None) => conf.remove(key)
+      }
+    }
+  }
+
+  /** Train ALS with the given spark.oap.mllib.als settings and collect the factors. */
+  private def trainWithSettings(
+      ratings: RDD[Rating[Int]],
+      implicitPrefs: Boolean,
+      settings: (String, String)*): (Map[Int, Seq[Float]], Map[Int, Seq[Float]]) = {
+    val (userFactors, itemFactors) = withConf(settings: _*) {
+      ALS.train(ratings, rank = 3, maxIter = 10, regParam = 0.01, implicitPrefs = implicitPrefs,
+        seed = 0)
+    }
+    (userFactors.mapValues(_.toSeq).collect().toMap,
+      itemFactors.mapValues(_.toSeq).collect().toMap)
+  }
+
+  private def assertSameFactors(actual: (Map[Int, Seq[Float]], Map[Int, Seq[Float]]),
+                                expected: (Map[Int, Seq[Float]], Map[Int, Seq[Float]])): Unit = {
+    Seq((actual._1, expected._1), (actual._2, expected._2)).foreach { case (a, e) =>
+      assert(a.keySet === e.keySet)
+      a.foreach { case (id, factors) =>
+        assert(Vectors.dense(factors.map(_.toDouble).toArray) ~==
+          Vectors.dense(e(id).map(_.toDouble).toArray) absTol 1e-5)
+      }
+    }
+  }
+
   test("LocalIndexEncoder") {
     val random = new Random
     for (numBlocks <- Seq(1, 2, 5, 10, 20, 50, 100)) {
@@ -316,6 +355,20 @@ class MLlibALSSuite extends MLTest with DefaultReadWriteTest with Logging {
     (sc.parallelize(training, 2), sc.parallelize(test, 2))
   }
 
+  /**
+   * Maps the users and items of a (training, test) split to 0 until the number of users and
+   * items, which are the IDs trained natively.
+   */
+  def withDenseIds(
+      split: (RDD[Rating[Int]], RDD[Rating[Int]])): (RDD[Rating[Int]], RDD[Rating[Int]]) = {
+    val (training, test) = split
+    val ratings = training.union(test)
+    val users = ratings.map(_.user).distinct().collect().sorted.zipWithIndex.toMap
+    val items = ratings.map(_.item).distinct().collect().sorted.zipWithIndex.toMap
+    (training.map(r => Rating(users(r.user), items(r.item), r.rating)),
+      test.map(r => Rating(users(r.user), items(r.item), r.rating)))
+  }
+
   /**
    * Generates an implicit feedback dataset for testing ALS.
    * @param numUsers number of users
@@ -486,6 +539,99 @@ class MLlibALSSuite extends MLTest with DefaultReadWriteTest with Logging {
      numItemBlocks = 5, numUserBlocks = 5)
   }
 
+  test("native explicit feedback has the RMSE of MLlib") {
+    val (training, test) = withDenseIds(
+      genExplicitTestData(numUsers = 50, numItems = 100, rank = 3, noiseStd = 0.01))
+    val testRatings = test.collect()
+    def testRMSE(userFactors: RDD[(Int, Array[Float])],
+                 itemFactors: RDD[(Int, Array[Float])]): Double = {
+      val users = userFactors.collectAsMap()
+      val items = itemFactors.collectAsMap()
+      val squaredErrors = testRatings.map { r =>
+        val err = r.rating - blas.sdot(3, users(r.user), 1, items(r.item), 1)
+        err.toDouble * err
+      }
+      math.sqrt(squaredErrors.sum / squaredErrors.length)
+    }
+
+    // Int IDs are trained natively, other ID types by MLlib
+    val (userFactors, itemFactors) =
+      ALS.train(training, rank = 3, maxIter = 10, regParam = 0.01, seed = 0)
+    val longTraining = training.map(r => Rating(r.user.toLong, r.item.toLong, r.rating))
+    val (mllibUserFactors, mllibItemFactors) =
+      ALS.train(longTraining, rank = 3, maxIter = 10, regParam = 0.01, seed = 0)
+
+    val rmse = testRMSE(userFactors, itemFactors)
+    val mllibRMSE = testRMSE(mllibUserFactors.map { case (id, f) => (id.toInt, f) },
+      mllibItemFactors.map { case (id, f) => (id.toInt, f) })
+    logInfo(s"Test RMSE is $rmse, MLlib test RMSE is $mllibRMSE.")
+    assert(rmse < 0.05)
+    assert(math.abs(rmse - mllibRMSE) < 0.01)
+  }
+
+  test("native balanced partitioner") {
+    val (training, test) = withDenseIds(
+      genExplicitTestData(numUsers = 50, numItems = 100, rank = 2, noiseStd = 0.01))
+    val testRatings = test.collect()
+    // Blocks differ, so do the initial factors, but both fit the ratings
+    Seq("range", "balanced").foreach { partitioner =>
+      val (users, items) = trainWithSettings(training, implicitPrefs = false,
+        "spark.oap.mllib.als.partitioner" -> partitioner)
+      assert(users.size === 50 && items.size === 100)
+      val squaredErrors = testRatings.map { r =>
+        val err = r.rating - blas.sdot(3, users(r.user).toArray, 1, items(r.item).toArray, 1)
+        err.toDouble * err
+      }
+      val rmse = math.sqrt(squaredErrors.sum / squaredErrors.length)
+      logInfo(s"Test RMSE with $partitioner partitioner is $rmse.")
+      assert(rmse < 0.05)
+    }
+  }
+
+  test("native shuffle rounds do not change the factors") {
+    val (training, _) = withDenseIds(
+      genExplicitTestData(numUsers = 50, numItems = 100, rank = 2, noiseStd = 0.01))
+    val expected = trainWithSettings(training, implicitPrefs = false)
+    // Rounds of 1 KB take several rounds to send the ratings
+    val actual = trainWithSettings(training, implicitPrefs = false,
+      "spark.oap.mllib.als.shuffleRoundSize" -> "1k")
+    assertSameFactors(actual, expected)
+  }
+
+  test("native factor tables above the size limit fall back to MLlib") {
+    val (training, _) = withDenseIds(
+      genExplicitTestData(numUsers = 50, numItems = 100, rank = 2, noiseStd = 0.01))
+    val expected = trainWithSettings(training, implicitPrefs = false,
+      "spark.oap.mllib.enabled" -> "false")
+    // 150 IDs of rank 3 need 1800 bytes of factors
+    val actual = trainWithSettings(training, implicitPrefs = false,
+      "spark.oap.mllib.als.maxFactorTableSize" -> "1k")
+    assertSameFactors(actual, expected)
+  }
+
+  test("native rating encodings do not change the factors") {
+    val random = new Random(5)
+    val pairs = for (user <- 0 until 40; item <- 0 until 60 if random.nextDouble() < 0.4)
+      yield (user, item)
+    // Whole ratings are exact in float16
+    val ratings = sc.parallelize(pairs.map { case (user, item) =>
+      Rating(user, item, (1 + random.nextInt(5)).toFloat)
+    }, 2)
+    val expected = trainWithSettings(ratings, implicitPrefs = false,
+      "spark.oap.mllib.als.ratingEncoding" -> "float32")
+    assertSameFactors(trainWithSettings(ratings, implicitPrefs = false,
+      "spark.oap.mllib.als.ratingEncoding" -> "float16"), expected)
+
+    // Values are not sent at all if every rating is 1
+    val ones = sc.parallelize(pairs.map { case (user, item) => Rating(user, item, 1.0f) }, 2)
+    val expectedOnes = trainWithSettings(ones, implicitPrefs = true,
+      "spark.oap.mllib.als.ratingEncoding" -> "float32")
+    Seq("one", "auto").foreach { encoding =>
+      assertSameFactors(trainWithSettings(ones, implicitPrefs = true,
+        "spark.oap.mllib.als.ratingEncoding" -> encoding), expectedOnes)
+    }
+  }
+
 //  test("implicit feedback") {
 //    val (training, test) =
 //      genImplicitTestData(numUsers = 20, numItems = 40, rank = 2, noiseStd = 0.01)
@@ -841,6 +987,27 @@ class MLlibALSSuite extends MLTest with DefaultReadWriteTest with Logging {
     }
   }
 
+  test("native recommendForAll is the same as recommendForAll") {
+    val spark = this.spark
+    import spark.implicits._
+    val model = getALSModel
+    Seq(2, 4, 6).foreach { k =>
+      val expectedItems = model.recommendForAllUsers(k)
+        .as[(Int, Seq[(Int, Float)])].collect().toMap
+      val topItems = ALSRecommendDALImpl.recommendForAllUsers(model, k)
+      assert(topItems.count() == model.userFactors.count)
+      assert(topItems.columns.contains("user"))
+      checkRecommendations(topItems, expectedItems, "item")
+
+      val expectedUsers = model.recommendForAllItems(k)
+        .as[(Int, Seq[(Int, Float)])].collect().toMap
+      val topUsers = ALSRecommendDALImpl.recommendForAllItems(model, k)
+      assert(topUsers.count() == model.itemFactors.count)
+      assert(topUsers.columns.contains("item"))
+      checkRecommendations(topUsers, expectedUsers, "user")
+    }
+  }
+
   test("recommendForUserSubset with k <, = and > num_items") {
     val spark = this.spark
     import spark.implicits._
@@ -1033,6 +1200,8 @@ class ALSCleanerSuite extends SparkFunSuite with BeforeAndAfterEach {
       FileUtils.listFiles(localDir, TrueFileFilter.INSTANCE, TrueFileFilter.INSTANCE).asScala.toSet
     try {
       conf.set("spark.local.dir", localDir.getAbsolutePath)
+      // Shuffle files of the MLlib implementation are checked
+      conf.set("spark.oap.mllib.enabled", "false")
       val sc = new SparkContext("local[2]", "ALSCleanerSuite", conf)
       try {
         sc.setCheckpointDir(checkpointDir.getAbsolutePath)
@@ -17,12 +17,16 @@
 
 package org.apache.spark.ml.stat
 
+import scala.util.Random
+
 import breeze.linalg.{DenseMatrix => BDM}
 import com.intel.oap.mllib.Utils
 import org.apache.spark.{SparkConf, SparkFunSuite, TestCommon}
 import org.apache.spark.internal.Logging
 import org.apache.spark.ml.linalg.{Matrices, Matrix, Vectors}
 import org.apache.spark.ml.util.TestingUtils._
+import org.apache.spark.mllib.linalg.{Vectors => OldVectors}
+import org.apache.spark.mllib.linalg.distributed.RowMatrix
 import org.apache.spark.mllib.util.MLlibTestSparkContext
 import org.apache.spark.sql.{DataFrame, Row}
 
@@ -66,6 +70,27 @@ class MLlibCorrelationSuite extends SparkFunSuite with MLlibTestSparkContext wit
     assert(Matrices.fromBreeze(extract(pearsonMat)) ~== expected absTol 1e-4)
   }
 
+  test("corr(X) pearson of partitions with different means") {
+    // Each partition of 50 rows has its own mean, so the partial results are merged around
+    // different local means
+    val random = new Random(5)
+    val rows = (0 until 200).map { i =>
+      val z = Array.fill(5)(random.nextGaussian())
+      val offset = 10.0 * (i / 50)
+      Vectors.dense(z(0) + offset, z(0) + z(1), z(2) - offset, 2 * z(2) - z(3), z(4) + 3 * offset)
+    }
+    val rdd = sc.parallelize(rows, 4)
+    val covariance = new RowMatrix(rdd.map(OldVectors.fromML)).computeCovariance().asML
+    val expected = Matrices.dense(5, 5, Array.tabulate(25) { index =>
+      val (i, j) = (index % 5, index / 5)
+      covariance(i, j) / math.sqrt(covariance(i, i) * covariance(j, j))
+    })
+
+    val df = spark.createDataFrame(rdd.map(Tuple1.apply)).toDF("features")
+    val pearsonMat = Correlation.corr(df, "features", "pearson")
+    assert(Matrices.fromBreeze(extract(pearsonMat)) ~== expected absTol 1e-9)
+  }
+
   test("corr(X) spearman") {
     val spearmanMat = Correlation.corr(X, "features", "spearman")
     // scalastyle:off
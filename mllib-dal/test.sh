@@ -104,6 +104,7 @@ if [ "HOST" = $DEVICE_OPT ]; then
 elif [ "CPU" = $DEVICE_OPT ]; then
   suiteArray=(
     "org.apache.spark.ml.clustering.MLlibKMeansSuite" \
+    "org.apache.spark.ml.clustering.MLlibBisectingKMeansSuite" \
     "org.apache.spark.ml.feature.MLlibPCASuite" \
     "org.apache.spark.ml.recommendation.MLlibALSSuite" \
     "org.apache.spark.ml.classification.MLlibNaiveBayesSuite" \